@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "DecisionTreeNode.h"
+#include "FlatTree.h"
+#include "ObliviousTree.h"
+
+// Times fitting, prediction and serialization on synthetic data sets, over a range of sample counts, parameter counts,
+// label counts and depth limits, and writes the results as JSON. Each case also fits an oblivious tree as deep as the
+// depth limit allows, and compares its speed and test accuracy with the ordinary tree's. Every data set comes from a
+// fixed seed, so runs of different versions of the library can be compared line by line.
+//
+// usage: pico_dt_bench [--quick] [--output results.json]
+
+namespace {
+    const int repeats = 5;
+
+    // the seed of the training data sets, whose blob centers every data set uses.
+    const uint64_t center_seed = 42;
+
+    template<typename Function>
+    double time_seconds(Function function) {
+        auto start = std::chrono::steady_clock::now();
+        function();
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// Run a function several times, giving the median time, which a stray interruption can't skew.
+    template<typename Function>
+    double median_seconds(Function function) {
+        double seconds[repeats];
+        for (double &repeat_seconds : seconds) {
+            repeat_seconds = time_seconds(function);
+        }
+        std::sort(seconds, seconds + repeats);
+        return seconds[repeats / 2];
+    }
+
+    enum class Generator {
+        blobs,
+        grid,
+        noisy
+    };
+
+    const char *generator_name(Generator generator) {
+        switch (generator) {
+            case Generator::blobs:
+                return "blobs";
+            case Generator::grid:
+                return "grid";
+            default:
+                return "noisy";
+        }
+    }
+
+    /// Samples stored one after another, with a label for each.
+    struct SyntheticData {
+        size_t count;
+        size_t parameter_count;
+        std::vector<double> values;
+        std::vector<double *> rows;
+        std::vector<int> labels;
+    };
+
+    /// Make a reproducible data set.
+    ///  - blobs: a gaussian blob around a random center for each label, overlapping enough to grow a real tree.
+    ///  - grid: uniform values, labelled by which cell of an axis aligned grid they fall in, like a checkerboard.
+    ///  - noisy: uniform values that are all distinct (as many split candidates as there can be), labelled by a few
+    ///    thresholds on the first parameters, with a fifth of the labels replaced by random ones.
+    SyntheticData generate(Generator generator, size_t count, size_t parameter_count, int label_count, uint64_t seed) {
+        std::mt19937_64 random(seed);
+        std::normal_distribution<double> noise(0.0, 1.0);
+        std::uniform_real_distribution<double> uniform(0.0, 8.0);
+        SyntheticData data{};
+        data.count = count;
+        data.parameter_count = parameter_count;
+        data.values.resize(count * parameter_count);
+        data.rows.resize(count);
+        data.labels.resize(count);
+
+        // every data set shares the training set's centers, so test samples come from the same blobs. a center is
+        // still drawn from random too, so the samples are the same whichever centers they use.
+        std::mt19937_64 center_random(center_seed);
+        std::vector<double> centers(label_count * parameter_count);
+        for (double &center : centers) {
+            center = uniform(center_random);
+            uniform(random);
+        }
+        for (size_t i = 0; i < count; ++i) {
+            double *row = data.values.data() + i * parameter_count;
+            data.rows[i] = row;
+            switch (generator) {
+                case Generator::blobs: {
+                    int label = (int) (random() % label_count);
+                    for (size_t j = 0; j < parameter_count; ++j) {
+                        row[j] = centers[label * parameter_count + j] + noise(random);
+                    }
+                    data.labels[i] = label;
+                    break;
+                }
+                case Generator::grid: {
+                    size_t cell_sum = 0;
+                    for (size_t j = 0; j < parameter_count; ++j) {
+                        row[j] = uniform(random);
+                        cell_sum += (size_t) row[j];
+                    }
+                    data.labels[i] = (int) (cell_sum % label_count);
+                    break;
+                }
+                case Generator::noisy: {
+                    size_t region = 0;
+                    for (size_t j = 0; j < parameter_count; ++j) {
+                        row[j] = uniform(random);
+                        if (j < 3) region = region * 3 + (size_t) (row[j] * 3 / 8);
+                    }
+                    data.labels[i] = random() % 5 == 0 ? (int) (random() % label_count) : (int) (region % label_count);
+                    break;
+                }
+            }
+        }
+        return data;
+    }
+
+    struct BenchmarkCase {
+        Generator generator;
+        size_t count;
+        size_t parameter_count;
+        int label_count;
+        int depth;
+    };
+
+    /// Everything measured for one case. Rates are per second, sizes are in bytes.
+    struct BenchmarkResult {
+        size_t node_count;
+        size_t serialized_size;
+        double fit_seconds;
+        double predict_rate;
+        double flat_predict_rate;
+        double profiled_predict_rate;
+        double batch_predict_rate;
+        double serialize_rate;
+        double size_rate;
+        double deserialize_rate;
+        double accuracy;
+        size_t oblivious_depth;
+        size_t oblivious_serialized_size;
+        double oblivious_fit_seconds;
+        double oblivious_predict_rate;
+        double oblivious_batch_predict_rate;
+        double oblivious_accuracy;
+        bool matches;
+    };
+
+    BenchmarkResult run_case(const BenchmarkCase &benchmark_case) {
+        SyntheticData train = generate(benchmark_case.generator, benchmark_case.count, benchmark_case.parameter_count,
+                                       benchmark_case.label_count, center_seed);
+        SyntheticData test = generate(benchmark_case.generator, 1 << 16, benchmark_case.parameter_count,
+                                      benchmark_case.label_count, 43);
+        BenchmarkResult result{};
+
+        // fit only ever grows a tree, so every repeat fits a tree of its own.
+        std::vector<pico_dt::DecisionTreeNode *> fitted_trees;
+        result.fit_seconds = median_seconds([&] {
+            auto *fitted_tree = new pico_dt::DecisionTreeNode(benchmark_case.parameter_count,
+                                                              benchmark_case.label_count);
+            fitted_tree->fit(train.rows.data(), train.labels.data(), train.count, benchmark_case.depth);
+            fitted_trees.push_back(fitted_tree);
+        });
+        pico_dt::DecisionTreeNode &tree = *fitted_trees.back();
+        auto flat_tree = pico_dt::FlatTree(tree);
+        result.node_count = flat_tree.get_node_count();
+
+        std::vector<int> expected(test.count);
+        std::vector<int> out(test.count);
+        double seconds = median_seconds([&] {
+            for (size_t i = 0; i < test.count; ++i) {
+                expected[i] = tree.predict(test.rows[i]);
+            }
+        });
+        result.predict_rate = (double) test.count / seconds;
+        seconds = median_seconds([&] {
+            for (size_t i = 0; i < test.count; ++i) {
+                out[i] = flat_tree.predict(test.rows[i]);
+            }
+        });
+        result.flat_predict_rate = (double) test.count / seconds;
+        result.matches = out == expected;
+
+        // laid out for the training samples, which come from the same distribution as the test samples.
+        std::vector<size_t> visit_counts(flat_tree.get_node_count());
+        flat_tree.profile(train.values.data(), train.count, benchmark_case.parameter_count, visit_counts.data());
+        auto profiled_tree = pico_dt::FlatTree(flat_tree, visit_counts.data());
+        seconds = median_seconds([&] {
+            for (size_t i = 0; i < test.count; ++i) {
+                out[i] = profiled_tree.predict(test.rows[i]);
+            }
+        });
+        result.profiled_predict_rate = (double) test.count / seconds;
+        result.matches &= out == expected;
+        seconds = median_seconds([&] {
+            for (size_t i = 0; i < test.count; i += 1024) {
+                flat_tree.predict_batch(test.rows[i], std::min((size_t) 1024, test.count - i),
+                                        benchmark_case.parameter_count, out.data() + i);
+            }
+        });
+        result.batch_predict_rate = (double) test.count / seconds;
+        result.matches &= out == expected;
+
+        // serialization is quick, so each timing covers enough calls to measure.
+        const int calls = 16;
+        result.serialized_size = tree.calculate_serialized_size();
+        seconds = median_seconds([&] {
+            for (int i = 0; i < calls; ++i) {
+                delete[] tree.serialize();
+            }
+        });
+        result.serialize_rate = calls / seconds;
+        volatile size_t size_sink = 0;
+        seconds = median_seconds([&] {
+            for (int i = 0; i < calls; ++i) {
+                size_sink = size_sink + tree.calculate_serialized_size();
+            }
+        });
+        result.size_rate = calls / seconds;
+        uint8_t *buffer = tree.serialize();
+        seconds = median_seconds([&] {
+            for (int i = 0; i < calls; ++i) {
+                delete pico_dt::deserialize_decision_tree(benchmark_case.parameter_count, benchmark_case.label_count,
+                                                          buffer, result.serialized_size);
+            }
+        });
+        result.deserialize_rate = calls / seconds;
+        auto *tree_copy = pico_dt::deserialize_decision_tree(benchmark_case.parameter_count,
+                                                             benchmark_case.label_count, buffer,
+                                                             result.serialized_size);
+        for (size_t i = 0; i < test.count; ++i) {
+            result.matches &= tree_copy != nullptr && tree_copy->predict(test.rows[i]) == expected[i];
+        }
+        delete tree_copy;
+        delete[] buffer;
+        for (auto *fitted_tree : fitted_trees) {
+            delete fitted_tree;
+        }
+
+        // the same data, fit as an oblivious tree.
+        size_t correct_count = 0;
+        for (size_t i = 0; i < test.count; ++i) {
+            correct_count += expected[i] == test.labels[i];
+        }
+        result.accuracy = (double) correct_count / (double) test.count;
+        size_t oblivious_depth = std::min((size_t) benchmark_case.depth, (size_t) PICO_DT_OBLIVIOUS_MAX_DEPTH);
+        auto oblivious_tree = pico_dt::ObliviousTree(benchmark_case.parameter_count, benchmark_case.label_count);
+        result.oblivious_fit_seconds = median_seconds([&] {
+            oblivious_tree.fit(train.rows.data(), train.labels.data(), train.count, oblivious_depth);
+        });
+        result.oblivious_depth = oblivious_tree.get_depth();
+        result.oblivious_serialized_size = oblivious_tree.calculate_serialized_size();
+        seconds = median_seconds([&] {
+            for (size_t i = 0; i < test.count; ++i) {
+                expected[i] = oblivious_tree.predict(test.rows[i]);
+            }
+        });
+        result.oblivious_predict_rate = (double) test.count / seconds;
+        seconds = median_seconds([&] {
+            oblivious_tree.predict_batch(test.values.data(), test.count, benchmark_case.parameter_count, out.data());
+        });
+        result.oblivious_batch_predict_rate = (double) test.count / seconds;
+        result.matches &= out == expected;
+        correct_count = 0;
+        for (size_t i = 0; i < test.count; ++i) {
+            correct_count += expected[i] == test.labels[i];
+        }
+        result.oblivious_accuracy = (double) correct_count / (double) test.count;
+        return result;
+    }
+}
+
+int main(int argc, char **argv) {
+    bool quick = false;
+    const char *output_path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--quick") == 0) {
+            quick = true;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--quick] [--output results.json]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    // every generator across sample counts, parameter counts, label counts and depth limits, for scaling curves.
+    std::vector<BenchmarkCase> cases;
+    std::vector<size_t> counts = quick ? std::vector<size_t>{1000, 4000} : std::vector<size_t>{1000, 10000, 50000};
+    for (Generator generator : {Generator::blobs, Generator::grid, Generator::noisy}) {
+        for (size_t count : counts) {
+            for (size_t parameter_count : {2, 8}) {
+                for (int label_count : {4, 16}) {
+                    for (int depth : {4, 16, 64}) {
+                        cases.push_back({generator, count, parameter_count, label_count, depth});
+                    }
+                }
+            }
+        }
+    }
+
+    FILE *output = output_path != nullptr ? fopen(output_path, "w") : stdout;
+    if (output == nullptr) {
+        fprintf(stderr, "couldn't open %s\n", output_path);
+        return 2;
+    }
+    bool all_match = true;
+    fprintf(output, "{\n  \"repeats\": %d,\n  \"results\": [", repeats);
+    for (size_t i = 0; i < cases.size(); ++i) {
+        const BenchmarkCase &benchmark_case = cases[i];
+        fprintf(stderr, "[%zu/%zu] %s n=%zu parameters=%zu labels=%d depth=%d\n", i + 1, cases.size(),
+                generator_name(benchmark_case.generator), benchmark_case.count, benchmark_case.parameter_count,
+                benchmark_case.label_count, benchmark_case.depth);
+        BenchmarkResult result = run_case(benchmark_case);
+        all_match &= result.matches;
+        fprintf(output, "%s\n    {\"dataset\": \"%s\", \"n\": %zu, \"parameter_count\": %zu, \"label_count\": %d, "
+                        "\"depth\": %d, \"node_count\": %zu, \"serialized_size\": %zu, \"fit_seconds\": %.6g, "
+                        "\"predict_per_second\": %.6g, \"flat_predict_per_second\": %.6g, "
+                        "\"profiled_predict_per_second\": %.6g, \"batch_predict_per_second\": %.6g, "
+                        "\"serialize_per_second\": %.6g, "
+                        "\"calculate_serialized_size_per_second\": %.6g, \"deserialize_per_second\": %.6g, "
+                        "\"accuracy\": %.6g, \"oblivious_depth\": %zu, \"oblivious_serialized_size\": %zu, "
+                        "\"oblivious_fit_seconds\": %.6g, \"oblivious_predict_per_second\": %.6g, "
+                        "\"oblivious_batch_predict_per_second\": %.6g, \"oblivious_accuracy\": %.6g, "
+                        "\"predictions_match\": %s}",
+                i > 0 ? "," : "", generator_name(benchmark_case.generator), benchmark_case.count,
+                benchmark_case.parameter_count, benchmark_case.label_count, benchmark_case.depth, result.node_count,
+                result.serialized_size, result.fit_seconds, result.predict_rate, result.flat_predict_rate,
+                result.profiled_predict_rate, result.batch_predict_rate, result.serialize_rate, result.size_rate,
+                result.deserialize_rate, result.accuracy, result.oblivious_depth, result.oblivious_serialized_size,
+                result.oblivious_fit_seconds, result.oblivious_predict_rate, result.oblivious_batch_predict_rate,
+                result.oblivious_accuracy, result.matches ? "true" : "false");
+        fflush(output);
+    }
+    fprintf(output, "\n  ]\n}\n");
+    if (output != stdout) fclose(output);
+    return all_match ? 0 : 1;
+}
@@ -0,0 +1,70 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "DecisionTreeNode.h"
+#include "example_tree.h"
+#include "example_tree_types.h"
+
+// Checks the headers pico_dt_generate_tree_header made from a model against the model itself, at points of a grid
+// that covers every value the model was fit on and every threshold between them. The build runs this after linking it.
+//
+// usage: pico_dt_example_generated_tree <model>
+
+namespace {
+    const size_t parameter_count = 3;
+    const int label_count = 5;
+
+    // steps of 1/16 from -1/4 to 16 + 1/4, past the ends of the training values
+    const int grid_size = 16 * 16 + 9;
+    const long sample_count = 1000000;
+
+    double grid_value(std::mt19937 &generator) {
+        return (double) (generator() % grid_size) / 16 - 0.25;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <model>\n", argv[0]);
+        return 2;
+    }
+
+    FILE *model_file = fopen(argv[1], "rb");
+    if (model_file == nullptr) {
+        fprintf(stderr, "Could not open %s.\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> model;
+    uint8_t block[4096];
+    size_t read_size;
+    while ((read_size = fread(block, 1, sizeof(block), model_file)) > 0) {
+        model.insert(model.end(), block, block + read_size);
+    }
+    fclose(model_file);
+
+    pico_dt::DecisionTreeNode *tree = pico_dt::deserialize_decision_tree(parameter_count, label_count,
+                                                                         model.data(), model.size());
+    if (tree == nullptr) {
+        fprintf(stderr, "%s is not a valid model.\n", argv[1]);
+        return 1;
+    }
+
+    long function_mismatches = 0;
+    long type_mismatches = 0;
+    std::mt19937 generator(42);
+    double parameters[parameter_count];
+    for (long i = 0; i < sample_count; i++) {
+        for (double &parameter : parameters) {
+            parameter = grid_value(generator);
+        }
+        int expected = tree->predict(parameters);
+        if (pico_dt_generated::example_tree(parameters) != expected) function_mismatches++;
+        if (pico_dt_generated::example_tree_types::predict(parameters) != expected) type_mismatches++;
+    }
+    delete tree;
+
+    printf("Generated functions differing from predict: %li of %li\n", function_mismatches, sample_count);
+    printf("Generated types differing from predict: %li of %li\n", type_mismatches, sample_count);
+    return function_mismatches == 0 && type_mismatches == 0 ? 0 : 1;
+}
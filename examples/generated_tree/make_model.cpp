@@ -0,0 +1,55 @@
+#include <cstdio>
+#include <random>
+
+#include "DecisionTreeNode.h"
+#include "PortableFormat.h"
+
+// Fits a tree on a fixed synthetic data set and writes it in the portable format, for the generated_tree example to
+// compile into headers. The samples come from a fixed seed, so every build writes the same model.
+//
+// usage: pico_dt_example_model <output model>
+
+namespace {
+    const size_t parameter_count = 3;
+    const int label_count = 5;
+    const size_t sample_count = 400;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s <output model>\n", argv[0]);
+        return 2;
+    }
+
+    std::mt19937 generator(42);
+    double *values = new double[sample_count * parameter_count];
+    double *parameters[sample_count];
+    int labels[sample_count];
+    for (size_t i = 0; i < sample_count; i++) {
+        parameters[i] = values + i * parameter_count;
+        // parameters are multiples of 1/8 in [0, 16), so every threshold lies on a 1/16 grid
+        for (size_t j = 0; j < parameter_count; j++) {
+            parameters[i][j] = (double) (generator() % 128) / 8;
+        }
+        labels[i] = (int) (parameters[i][0] + 2 * parameters[i][1] * parameters[i][2] / 16) % label_count;
+        // some noise, so the tree grows deep enough to need nested functions and types
+        if (generator() % 8 == 0) labels[i] = (int) (generator() % label_count);
+    }
+
+    pico_dt::DecisionTreeNode tree(parameter_count, label_count);
+    tree.fit(parameters, labels, sample_count);
+    delete[] values;
+
+    uint8_t *buffer = pico_dt::serialize_portable_tree(tree);
+    size_t size = pico_dt::calculate_portable_size(tree);
+    FILE *model_file = fopen(argv[1], "wb");
+    if (model_file == nullptr) {
+        fprintf(stderr, "Could not open %s.\n", argv[1]);
+        delete[] buffer;
+        return 1;
+    }
+    fwrite(buffer, 1, size, model_file);
+    fclose(model_file);
+    delete[] buffer;
+    return 0;
+}
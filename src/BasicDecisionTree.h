@@ -0,0 +1,303 @@
+#ifndef PICO_DT_BASICDECISIONTREE_H
+#define PICO_DT_BASICDECISIONTREE_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace pico_dt {
+
+    /// A decision tree with its feature and label types, and its parameter and label counts, fixed at compile time.
+    /// Nodes only store what prediction needs, in one contiguous array, with parameter indices as small as NParams
+    /// allows, so a tree takes a fraction of the memory of a DecisionTreeNode tree. Label counts during fitting live
+    /// on the stack, and loops over parameters and labels have constant bounds the compiler can unroll.
+    ///
+    /// Fitting gives the same splits DecisionTreeNode::fit gives for the same samples converted to doubles. Each
+    /// threshold is the smallest Feature that isn't lesser than DecisionTreeNode's threshold, so the two trees predict
+    /// the same for every input that is a Feature.
+    /// \tparam Feature The type of every parameter. Either floating point, or an integer of 32 bits or fewer.
+    /// \tparam Label The type of every label. Labels run from 0 to NLabels - 1.
+    /// \tparam NParams The number of parameters each sample has.
+    /// \tparam NLabels The number of labels the tree might classify a sample as.
+    template<typename Feature, typename Label, size_t NParams, size_t NLabels>
+    class BasicDecisionTree {
+        static_assert(NParams > 0 && NLabels > 0, "trees need at least one parameter and one label");
+        static_assert(std::is_floating_point<Feature>::value ||
+                      (std::is_integral<Feature>::value && sizeof(Feature) <= 4),
+                      "features must be floating point, or integers every one of which a double can hold exactly");
+        static_assert(std::is_integral<Label>::value && NLabels - 1 <= (size_t) std::numeric_limits<Label>::max(),
+                      "every label must fit in the label type");
+
+    public:
+        /// The smallest unsigned type that can index every parameter, with one value to spare to mark leaves.
+        using ParameterIndex = typename std::conditional<(NParams < 0xFF), uint8_t,
+                typename std::conditional<(NParams < 0xFFFF), uint16_t, uint32_t>::type>::type;
+
+        /// One node of the tree. Branches point at their lesser child, and the greater child always comes right after
+        /// it. Leaves have a parameter of NParams, and keep their label in child.
+        struct Node {
+            Feature threshold;
+            uint32_t child;
+            ParameterIndex parameter;
+        };
+
+        /// Create a new tree, which predicts 0 until it is fit.
+        BasicDecisionTree() {
+            nodes = new Node[1];
+            nodes[0] = {Feature(), 0, (ParameterIndex) NParams};
+            node_count = 1;
+        }
+
+        /// Fit the tree to a given set of parameters and labels, replacing whatever it was fit to before.
+        /// \param parameters An array of pointers pointing to arrays of NParams parameters.
+        /// \param labels An array of labels, with one label for each parameter array given.
+        /// \param count The length of both the parameter pointer array (parameters) and label array (labels).
+        /// \param limit The maximum depth of the tree, or -1 for no limit.
+        void fit(const Feature *const *parameters, const Label *labels, size_t count, int limit = -1) {
+            if (count == 0) return;
+
+            // the same approach as DecisionTreeNode::fit: every parameter is sorted once, and splitting a node stable
+            // partitions its range of every column, so they stay sorted all the way down.
+            auto *sorted_samples = new size_t[NParams * count];
+            auto *partition_buffer = new size_t[count];
+            for (size_t i = 0; i < NParams; ++i) {
+                size_t *column = sorted_samples + i * count;
+                for (size_t j = 0; j < count; ++j) {
+                    column[j] = j;
+                }
+                std::sort(column, column + count, [parameters, i](size_t a, size_t b) {
+                    return parameters[a][i] < parameters[b][i];
+                });
+            }
+
+            // a tree over count samples has at most count leaves, and children are laid out in pairs as they're made.
+            auto *building = new Node[2 * count - 1];
+            size_t next_index = 1;
+            struct PendingNode {
+                size_t index;
+                size_t begin;
+                size_t count;
+                int limit;
+            };
+            // depth first, and the tree is at most count deep.
+            auto *stack = new PendingNode[count + 1];
+            size_t stack_size = 0;
+            stack[stack_size++] = {0, 0, count, limit};
+            while (stack_size > 0) {
+                PendingNode pending = stack[--stack_size];
+                Node &node = building[pending.index];
+                size_t lesser_count = fit_node(parameters, labels, sorted_samples, count, pending.begin,
+                                               pending.count, pending.limit, partition_buffer, node);
+                if (lesser_count == 0) continue;
+                node.child = (uint32_t) next_index;
+                int child_limit = pending.limit >= 0 ? pending.limit - 1 : -1;
+                stack[stack_size++] = {next_index + 1, pending.begin + lesser_count, pending.count - lesser_count,
+                                       child_limit};
+                stack[stack_size++] = {next_index, pending.begin, lesser_count, child_limit};
+                next_index += 2;
+            }
+            delete[] stack;
+            delete[] partition_buffer;
+            delete[] sorted_samples;
+
+            delete[] nodes;
+            node_count = next_index;
+            nodes = new Node[node_count];
+            memcpy(nodes, building, node_count * sizeof(Node));
+            delete[] building;
+        }
+
+        /// Predict a label given some parameters.
+        /// \param parameters An array of NParams parameters to use.
+        /// \return The predicted label.
+        Label predict(const Feature *parameters) const {
+            const Node *node = nodes;
+            while (node->parameter != NParams) {
+                node = nodes + node->child + !(parameters[node->parameter] < node->threshold);
+            }
+            return (Label) node->child;
+        }
+
+        /// Calculate the entropy of a set of labels. See https://en.wikipedia.org/wiki/Entropy_(information_theory)
+        /// \param labels An array of labels.
+        /// \param count The number of labels given.
+        /// \return The entropy of the labels.
+        static double calculate_entropy(const Label *labels, size_t count) {
+            size_t label_counts[NLabels] = {};
+            for (size_t i = 0; i < count; ++i) {
+                ++label_counts[(size_t) labels[i]];
+            }
+            return calculate_entropy_from_counts(label_counts, count);
+        }
+
+        /// Get the number of nodes, branches and leaves both, in this tree.
+        /// \return The node count.
+        size_t get_node_count() const {
+            return node_count;
+        }
+
+        /// Get the nodes of this tree. The root is node 0.
+        /// \return A pointer to the first node.
+        const Node *get_nodes() const {
+            return nodes;
+        }
+
+        BasicDecisionTree(const BasicDecisionTree &) = delete;
+
+        BasicDecisionTree &operator=(const BasicDecisionTree &) = delete;
+
+        ~ BasicDecisionTree() {
+            delete[] nodes;
+        }
+
+    private:
+        Node *nodes;
+
+        size_t node_count;
+
+        static double calculate_entropy_from_counts(const size_t *label_counts, size_t total_count) {
+            double entropy = 0.0;
+            for (size_t i = 0; i < NLabels; ++i) {  // run the summation
+                double p_i = (double) label_counts[i] / (double) total_count;
+                if (p_i == 0) continue;
+                entropy += p_i * log2(p_i);
+            }
+            return -entropy;
+        }
+
+        /// Get the smallest Feature that isn't lesser than a threshold, so x < it exactly when x < threshold for every
+        /// Feature x.
+        static Feature round_up_threshold(double threshold) {
+            if constexpr (std::is_integral<Feature>::value) {
+                return (Feature) std::ceil(threshold);
+            } else {
+                auto rounded = (Feature) threshold;
+                if ((double) rounded < threshold) {
+                    rounded = std::nextafter(rounded, std::numeric_limits<Feature>::infinity());
+                }
+                return rounded;
+            }
+        }
+
+        /// Fit a single node, filling it in as a leaf, or as a branch with everything but its child.
+        /// \return How many samples go to the lesser child, or 0 if the node is a leaf.
+        static size_t fit_node(const Feature *const *parameters, const Label *labels, size_t *sorted_samples,
+                               size_t total_count, size_t begin, size_t count, int limit, size_t *partition_buffer,
+                               Node &node) {
+            const size_t *samples = sorted_samples + begin;
+            size_t first_sample = samples[0];
+            for (size_t i = 1; i < count; ++i) {
+                if (samples[i] < first_sample) first_sample = samples[i];
+            }
+            node = {Feature(), (uint32_t) labels[first_sample], (ParameterIndex) NParams};
+
+            size_t label_counts[NLabels] = {};
+            for (size_t i = 0; i < count; ++i) {
+                ++label_counts[(size_t) labels[samples[i]]];
+            }
+            if (label_counts[(size_t) labels[first_sample]] == count || limit == 0) return 0;
+
+            // the same sweep as DecisionTreeNode::sweep_split_candidates, with the same tie breaking: the highest
+            // parameter, then the smallest threshold.
+            double parent_entropy = calculate_entropy_from_counts(label_counts, count);
+            double best_score = -std::numeric_limits<double>::infinity();
+            double best_threshold = 0;
+            size_t best_lesser_count = 0;
+            size_t best_parameter = 0;
+            for (size_t parameter = 0; parameter < NParams; ++parameter) {
+                const size_t *column = sorted_samples + parameter * total_count + begin;
+                size_t lesser_label_counts[NLabels] = {};
+                size_t greater_label_counts[NLabels];
+                for (size_t k = 0; k < NLabels; ++k) {
+                    greater_label_counts[k] = label_counts[k];
+                }
+                double parameter_best_score = -std::numeric_limits<double>::infinity();
+                double parameter_best_threshold = 0;
+                size_t parameter_best_lesser_count = 0;
+                size_t lesser_count = 0;
+                size_t scored_lesser_count = 0;
+                double score = 0;
+                bool scored = false;
+                auto try_threshold = [&](double threshold) {
+                    while (lesser_count < count && (double) parameters[column[lesser_count]][parameter] < threshold) {
+                        size_t label = (size_t) labels[column[lesser_count++]];
+                        ++lesser_label_counts[label];
+                        --greater_label_counts[label];
+                    }
+                    if (!scored || lesser_count != scored_lesser_count) {
+                        if (lesser_count == 0 || lesser_count == count) {
+                            score = 0;
+                        } else {
+                            double lesser_entropy = calculate_entropy_from_counts(lesser_label_counts, lesser_count);
+                            double greater_entropy = calculate_entropy_from_counts(greater_label_counts,
+                                                                                  count - lesser_count);
+                            score = parent_entropy - ((lesser_entropy + greater_entropy) / 2);
+                        }
+                        scored_lesser_count = lesser_count;
+                        scored = true;
+                    }
+                    if (score > parameter_best_score) {
+                        parameter_best_score = score;
+                        parameter_best_threshold = threshold;
+                        parameter_best_lesser_count = lesser_count;
+                    }
+                };
+                size_t run_start = 0;
+                while (run_start < count) {
+                    auto value = (double) parameters[column[run_start]][parameter];
+                    size_t next_run_start = run_start + 1;
+                    while (next_run_start < count && (double) parameters[column[next_run_start]][parameter] == value) {
+                        ++next_run_start;
+                    }
+                    if (next_run_start - run_start > 1) try_threshold(value);
+                    if (next_run_start < count) {
+                        try_threshold(((double) parameters[column[next_run_start]][parameter] + value) / 2);
+                    }
+                    run_start = next_run_start;
+                }
+                if (parameter_best_score >= best_score) {
+                    best_score = parameter_best_score;
+                    best_threshold = parameter_best_threshold;
+                    best_lesser_count = parameter_best_lesser_count;
+                    best_parameter = parameter;
+                }
+            }
+            // no threshold separates these samples (they're identical but labelled differently), so give up here.
+            if (best_lesser_count == 0 || best_lesser_count == count) return 0;
+
+            Feature threshold = round_up_threshold(best_threshold);
+            for (size_t i = 0; i < NParams; ++i) {
+                size_t *column = sorted_samples + i * total_count + begin;
+                size_t lesser_index = 0;
+                size_t greater_index = 0;
+                for (size_t j = 0; j < count; ++j) {
+                    size_t sample = column[j];
+                    if (parameters[sample][best_parameter] < threshold) column[lesser_index++] = sample;
+                    else partition_buffer[greater_index++] = sample;
+                }
+                memcpy(column + lesser_index, partition_buffer, greater_index * sizeof(size_t));
+            }
+            node = {threshold, 0, (ParameterIndex) best_parameter};
+            return best_lesser_count;
+        }
+    };
+
+    /// A tree of float parameters, for sensors read as floats.
+    template<size_t NParams, size_t NLabels>
+    using FloatDecisionTree = BasicDecisionTree<float, uint8_t, NParams, NLabels>;
+
+    /// A tree of 16 bit integer parameters, for raw readings from most ADCs.
+    template<size_t NParams, size_t NLabels>
+    using Int16DecisionTree = BasicDecisionTree<int16_t, uint8_t, NParams, NLabels>;
+
+    /// A tree of 8 bit integer parameters.
+    template<size_t NParams, size_t NLabels>
+    using Uint8DecisionTree = BasicDecisionTree<uint8_t, uint8_t, NParams, NLabels>;
+
+} // pico_dt
+
+#endif //PICO_DT_BASICDECISIONTREE_H
@@ -0,0 +1,231 @@
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "CrossValidation.h"
+#include "DecisionTreeNode.h"
+
+namespace pico_dt {
+    namespace {
+        /// A node of a fold's tree, with the label it would have had as a leaf, if a limit had stopped it there.
+        struct TruncatableNode {
+            double threshold;
+            size_t parameter;
+            size_t lesser;
+            size_t greater;
+            size_t depth;
+            int label;
+            bool leaf;
+        };
+
+        /// Number a tree's nodes depth first, root first. Leaves get their labels, branches get -1.
+        std::vector<TruncatableNode> number_nodes(const DecisionTreeNode &tree) {
+            std::vector<TruncatableNode> nodes;
+            struct PendingNode {
+                const DecisionTreeNode *node;
+                size_t depth;
+                size_t parent;
+                bool lesser;
+            };
+            std::vector<PendingNode> stack;
+            stack.push_back({&tree, 0, 0, false});
+            while (!stack.empty()) {
+                PendingNode pending = stack.back();
+                stack.pop_back();
+                size_t index = nodes.size();
+                const DecisionTreeNode *node = pending.node;
+                if (index > 0) (pending.lesser ? nodes[pending.parent].lesser : nodes[pending.parent].greater) = index;
+                if (node->is_leaf()) {
+                    nodes.push_back({0, 0, 0, 0, pending.depth, node->get_default_value(), true});
+                    continue;
+                }
+                nodes.push_back({node->get_comparison_threshold(), node->get_comparison_parameter(), 0, 0,
+                                 pending.depth, -1, false});
+                stack.push_back({node->get_greater_branch(), pending.depth + 1, index, false});
+                stack.push_back({node->get_lesser_branch(), pending.depth + 1, index, true});
+            }
+            return nodes;
+        }
+
+        /// Build the tree a fit with a limit of depth would have given, from a fold's numbered nodes, so predicting
+        /// with it can be timed. Children are always numbered after their parents, so building from the last node to
+        /// the first builds children first.
+        DecisionTreeNode *build_truncated_tree(const std::vector<TruncatableNode> &nodes, size_t depth,
+                                               size_t parameter_count, int label_count) {
+            std::vector<DecisionTreeNode *> built(nodes.size(), nullptr);
+            for (size_t i = nodes.size(); i-- > 0;) {
+                const TruncatableNode &node = nodes[i];
+                if (node.depth > depth) continue;
+                if (node.leaf || node.depth == depth) {
+                    built[i] = new DecisionTreeNode(parameter_count, label_count, node.label);
+                } else {
+                    built[i] = new DecisionTreeNode(parameter_count, label_count, node.parameter, node.threshold,
+                                                    built[node.lesser], built[node.greater]);
+                }
+            }
+            return built[0];
+        }
+
+        /// Everything one fold needs to score every limit.
+        struct Fold {
+            std::vector<TruncatableNode> nodes;
+            /// The held out samples, stored one after another, and their labels and weights.
+            std::vector<double> held_out_rows;
+            std::vector<int> held_out_labels;
+            std::vector<size_t> held_out_weights;
+        };
+    }
+
+    size_t cross_validate_limits(const Dataset &data, int label_count, size_t fold_count, const int *limits,
+                                 size_t limit_count, LimitScore *scores, unsigned int thread_count) {
+        size_t count = data.get_count();
+        size_t parameter_count = data.get_parameter_count();
+        const int *labels = data.get_labels();
+        for (size_t i = 0; i < limit_count; ++i) {
+            scores[i] = {limits[i], 0, 0, 0};
+        }
+        if (fold_count < 2 || fold_count > count || limit_count == 0) return 0;
+
+        // sort every parameter once, for every fold, the same way fit does.
+        std::vector<size_t> sorted_samples(parameter_count * count);
+        for (size_t i = 0; i < parameter_count; ++i) {
+            size_t *column = sorted_samples.data() + i * count;
+            for (size_t j = 0; j < count; ++j) {
+                column[j] = j;
+            }
+            const double *values = data.get_column(i);
+            std::sort(column, column + count, [values](size_t a, size_t b) {
+                return values[a] < values[b];
+            });
+        }
+        int deepest_limit = 0;
+        for (size_t i = 0; i < limit_count; ++i) {
+            if (limits[i] < 0) {
+                deepest_limit = -1;
+                break;
+            }
+            if (limits[i] > deepest_limit) deepest_limit = limits[i];
+        }
+
+        // fit each fold's tree once, to the deepest limit.
+        std::vector<Fold> folds(fold_count);
+        auto fit_fold = [&](size_t fold_index) {
+            Fold &fold = folds[fold_index];
+            size_t training_count = count - (count - fold_index + fold_count - 1) / fold_count;
+            std::vector<size_t> fold_samples(parameter_count * training_count);
+            std::vector<const size_t *> fold_columns(parameter_count);
+            for (size_t i = 0; i < parameter_count; ++i) {
+                const size_t *column = sorted_samples.data() + i * count;
+                size_t *fold_column = fold_samples.data() + i * training_count;
+                fold_columns[i] = fold_column;
+                for (size_t j = 0; j < count; ++j) {
+                    if (column[j] % fold_count != fold_index) *fold_column++ = column[j];
+                }
+            }
+            DecisionTreeNode tree(parameter_count, label_count);
+            tree.fit_presorted(data, fold_columns.data(), training_count, deepest_limit);
+            fold.nodes = number_nodes(tree);
+
+            // a branch cut off by a limit becomes a leaf with the label of the first sample that reaches it, so route
+            // the samples down the tree in order.
+            std::vector<double> sample(parameter_count);
+            for (size_t i = 0; i < count; ++i) {
+                for (size_t j = 0; j < parameter_count; ++j) {
+                    sample[j] = data.get_value(i, j);
+                }
+                if (i % fold_count == fold_index) {
+                    fold.held_out_rows.insert(fold.held_out_rows.end(), sample.begin(), sample.end());
+                    fold.held_out_labels.push_back(labels[i]);
+                    fold.held_out_weights.push_back(data.get_weight(i));
+                    continue;
+                }
+                TruncatableNode *node = &fold.nodes[0];
+                while (!node->leaf) {
+                    if (node->label < 0) node->label = labels[i];
+                    node = &fold.nodes[sample[node->parameter] < node->threshold ? node->lesser : node->greater];
+                }
+            }
+        };
+
+        // then score every limit on every fold, by stopping at the limit's depth.
+        std::vector<size_t> correct_counts(fold_count * limit_count);
+        std::vector<size_t> node_counts(fold_count * limit_count);
+        std::vector<double> seconds(fold_count * limit_count);
+        auto score_limit = [&](size_t index) {
+            const Fold &fold = folds[index / limit_count];
+            size_t depth = limits[index % limit_count] < 0 ? (size_t) -1 : (size_t) limits[index % limit_count];
+            for (const TruncatableNode &node : fold.nodes) {
+                node_counts[index] += node.depth <= depth;
+            }
+            for (size_t i = 0; i < fold.held_out_labels.size(); ++i) {
+                const double *sample = fold.held_out_rows.data() + i * parameter_count;
+                const TruncatableNode *node = &fold.nodes[0];
+                while (!node->leaf && node->depth < depth) {
+                    node = &fold.nodes[sample[node->parameter] < node->threshold ? node->lesser : node->greater];
+                }
+                if (node->label == fold.held_out_labels[i]) correct_counts[index] += fold.held_out_weights[i];
+            }
+        };
+
+        // time predicting the held out samples with the tree each limit gives, on this thread alone once every other
+        // thread is done, so the times are what predict takes on a quiet processor.
+        auto time_limit = [&](size_t index) {
+            const Fold &fold = folds[index / limit_count];
+            size_t depth = limits[index % limit_count] < 0 ? (size_t) -1 : (size_t) limits[index % limit_count];
+            DecisionTreeNode *tree = build_truncated_tree(fold.nodes, depth, parameter_count, label_count);
+            volatile int prediction_sink = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < fold.held_out_labels.size(); ++i) {
+                prediction_sink = prediction_sink + tree->predict(fold.held_out_rows.data() + i * parameter_count);
+            }
+            seconds[index] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            delete tree;
+        };
+
+#ifdef PICO_DT_ENABLE_THREADS
+        if (thread_count > 1) {
+            WorkStealingPool pool(thread_count);
+            pool.parallel_for(fold_count, fit_fold);
+            pool.parallel_for(fold_count * limit_count, score_limit);
+        } else
+#else
+        (void) thread_count;
+#endif
+        {
+            for (size_t i = 0; i < fold_count; ++i) {
+                fit_fold(i);
+            }
+            for (size_t i = 0; i < fold_count * limit_count; ++i) {
+                score_limit(i);
+            }
+        }
+        for (size_t i = 0; i < fold_count * limit_count; ++i) {
+            time_limit(i);
+        }
+
+        size_t total_weight = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total_weight += data.get_weight(i);
+        }
+        size_t best = 0;
+        for (size_t i = 0; i < limit_count; ++i) {
+            size_t correct_count = 0;
+            size_t node_count = 0;
+            double total_seconds = 0;
+            for (size_t j = 0; j < fold_count; ++j) {
+                correct_count += correct_counts[j * limit_count + i];
+                node_count += node_counts[j * limit_count + i];
+                total_seconds += seconds[j * limit_count + i];
+            }
+            scores[i].accuracy = (double) correct_count / (double) total_weight;
+            scores[i].average_node_count = (double) node_count / (double) fold_count;
+            scores[i].predict_seconds = total_seconds / (double) count;
+            if (scores[i].accuracy > scores[best].accuracy ||
+                (scores[i].accuracy == scores[best].accuracy &&
+                 scores[i].average_node_count < scores[best].average_node_count)) {
+                best = i;
+            }
+        }
+        return best;
+    }
+} // pico_dt
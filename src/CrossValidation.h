@@ -0,0 +1,48 @@
+#ifndef PICO_DT_CROSSVALIDATION_H
+#define PICO_DT_CROSSVALIDATION_H
+
+#include <cstddef>
+
+#include "Dataset.h"
+
+namespace pico_dt {
+
+    /// How well one depth limit did across every fold of a cross validation.
+    struct LimitScore {
+        /// The depth limit, as passed to fit. -1 for no limit.
+        int limit;
+        /// The fraction of samples predicted right by the tree fit without them.
+        double accuracy;
+        /// The average number of nodes in each fold's tree.
+        double average_node_count;
+        /// The average time DecisionTreeNode::predict took to predict one held out sample, in seconds, with each fold's
+        /// tree cut off at the limit, timed on one thread.
+        double predict_seconds;
+    };
+
+    /// Find the depth limit for fit that does best on samples the tree wasn't fit to, with k-fold cross validation (see
+    /// https://en.wikipedia.org/wiki/Cross-validation_(statistics)#k-fold_cross-validation). Sample i is held out of
+    /// fold i % fold_count, so shuffle samples that are in any kind of order first. Weighted samples are held out
+    /// whole, and count as that many samples towards accuracy.
+    ///
+    /// Every parameter is sorted once, for all the folds, and each fold's tree is fit to those sorted columns with the
+    /// fold's samples filtered out (see DecisionTreeNode::fit_presorted). Each fold fits one tree, to the deepest limit,
+    /// and reads the shallower limits' predictions off it by stopping early: a tree fit with a smaller limit is exactly
+    /// that tree cut off at that depth. So the cost barely grows with the number of limits. Folds, and then every
+    /// fold's limits, are spread across threads. Prediction times are measured last, on a single thread, with a copy
+    /// of each fold's tree cut off at each limit.
+    /// \param data The samples and labels to cross validate with.
+    /// \param label_count The number of labels the tree might classify a sample as.
+    /// \param fold_count How many folds to split the samples into. At least 2, and at most the sample count.
+    /// \param limits An array of depth limits to try, as passed to fit.
+    /// \param limit_count The number of limits given.
+    /// \param scores An array of limit_count scores to fill in, one for each limit.
+    /// \param thread_count How many threads to use. Only used when PICO_DT_ENABLE_THREADS is defined.
+    /// \return The index of the limit with the best accuracy, with ties going to the one with the smaller trees. 0 if
+    /// the fold count is out of range, and then the scores are all 0.
+    size_t cross_validate_limits(const Dataset &data, int label_count, size_t fold_count, const int *limits,
+                                 size_t limit_count, LimitScore *scores, unsigned int thread_count = 1);
+
+} // pico_dt
+
+#endif //PICO_DT_CROSSVALIDATION_H
@@ -0,0 +1,138 @@
+#include <cstdint>
+#include <cstring>
+
+#include "Dataset.h"
+
+namespace pico_dt {
+    Dataset::Dataset(double **parameters, const int *p_labels, size_t p_count, size_t p_parameter_count) {
+        owned_columns = new double[p_parameter_count * p_count];
+        for (size_t i = 0; i < p_parameter_count; ++i) {
+            for (size_t j = 0; j < p_count; ++j) {
+                owned_columns[i * p_count + j] = parameters[j][i];
+            }
+        }
+        columns = owned_columns;
+        labels = p_labels;
+        weights = nullptr;
+        count = p_count;
+        parameter_count = p_parameter_count;
+        stride = p_count;
+        owned_labels = nullptr;
+        owned_weights = nullptr;
+    }
+
+    Dataset::Dataset(const double *p_columns, const int *p_labels, size_t p_count, size_t p_parameter_count,
+                     size_t p_stride) {
+        owned_columns = nullptr;
+        owned_labels = nullptr;
+        owned_weights = nullptr;
+        columns = p_columns;
+        labels = p_labels;
+        weights = nullptr;
+        count = p_count;
+        parameter_count = p_parameter_count;
+        stride = p_stride;
+    }
+
+    Dataset::Dataset(const double *p_columns, const int *p_labels, const size_t *p_weights, size_t p_count,
+                     size_t p_parameter_count, size_t p_stride) : Dataset(p_columns, p_labels, p_count,
+                                                                          p_parameter_count, p_stride) {
+        weights = p_weights;
+    }
+
+    const int *Dataset::get_labels() const {
+        return labels;
+    }
+
+    const size_t *Dataset::get_weights() const {
+        return weights;
+    }
+
+    size_t Dataset::get_count() const {
+        return count;
+    }
+
+    size_t Dataset::get_parameter_count() const {
+        return parameter_count;
+    }
+
+    Dataset::~Dataset() {
+        delete[] owned_columns;
+        delete[] owned_labels;
+        delete[] owned_weights;
+    }
+
+    namespace {
+        uint64_t hash_sample(const Dataset &data, size_t sample) {
+            uint64_t hash = (uint64_t) (uint32_t) data.get_labels()[sample];
+            for (size_t i = 0; i < data.get_parameter_count(); ++i) {
+                uint64_t bits;
+                double value = data.get_value(sample, i);
+                memcpy(&bits, &value, sizeof(bits));
+                hash = (hash ^ bits) * 0x9E3779B97F4A7C15ull;
+                hash ^= hash >> 29;
+            }
+            return hash;
+        }
+
+        bool samples_match(const Dataset &data, size_t a, size_t b) {
+            if (data.get_labels()[a] != data.get_labels()[b]) return false;
+            for (size_t i = 0; i < data.get_parameter_count(); ++i) {
+                double a_value = data.get_value(a, i);
+                double b_value = data.get_value(b, i);
+                // bit for bit, so 0.0 and -0.0 (and differently encoded NaNs) are kept apart.
+                if (memcmp(&a_value, &b_value, sizeof(double)) != 0) return false;
+            }
+            return true;
+        }
+    }
+
+    Dataset *merge_duplicate_samples(const Dataset &data) {
+        size_t count = data.get_count();
+        size_t parameter_count = data.get_parameter_count();
+
+        // an open addressing hash table of the first sample of each distinct sample, at most half full.
+        size_t table_size = 1;
+        while (table_size < 2 * count) table_size <<= 1;
+        auto *table = new size_t[table_size];
+        for (size_t i = 0; i < table_size; ++i) {
+            table[i] = SIZE_MAX;
+        }
+        auto *firsts = new size_t[count];
+        auto *merged_weights = new size_t[count];
+        size_t merged_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t slot = hash_sample(data, i) & (table_size - 1);
+            while (table[slot] != SIZE_MAX && !samples_match(data, firsts[table[slot]], i)) {
+                slot = (slot + 1) & (table_size - 1);
+            }
+            if (table[slot] == SIZE_MAX) {
+                table[slot] = merged_count;
+                firsts[merged_count] = i;
+                merged_weights[merged_count++] = 0;
+            }
+            merged_weights[table[slot]] += data.get_weight(i);
+        }
+        delete[] table;
+
+        auto *merged_columns = new double[parameter_count * merged_count];
+        auto *merged_labels = new int[merged_count];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            const double *column = data.get_column(i);
+            for (size_t j = 0; j < merged_count; ++j) {
+                merged_columns[i * merged_count + j] = column[firsts[j]];
+            }
+        }
+        for (size_t j = 0; j < merged_count; ++j) {
+            merged_labels[j] = data.get_labels()[firsts[j]];
+        }
+        delete[] firsts;
+
+        auto *merged = new Dataset(merged_columns, merged_labels, merged_weights, merged_count, parameter_count,
+                                   merged_count);
+        merged->owned_columns = merged_columns;
+        merged->owned_labels = merged_labels;
+        merged->owned_weights = merged_weights;
+        return merged;
+    }
+} // pico_dt
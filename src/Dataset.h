@@ -0,0 +1,120 @@
+#ifndef PICO_DT_DATASET_H
+#define PICO_DT_DATASET_H
+
+#include <cstddef>
+
+namespace pico_dt {
+
+    /// A set of labelled samples for fitting, stored one parameter at a time (column-major), so every pass over a
+    /// parameter reads one contiguous array. Fitting never moves or copies the samples themselves, only arrays of
+    /// sample indices, which are partitioned in place at every split.
+    class Dataset {
+    public:
+        /// Create a Dataset by copying samples stored as rows into columns.
+        /// \param parameters An array of pointers pointing to arrays of parameters. Arrays of parameters must be
+        /// p_parameter_count long.
+        /// \param p_labels An array of labels, with one label for each parameter array given. Not copied, so it must
+        /// outlive the Dataset.
+        /// \param p_count The length of both the parameter pointer array (parameters) and label array (p_labels).
+        /// \param p_parameter_count How many parameters each sample has.
+        Dataset(double **parameters, const int *p_labels, size_t p_count, size_t p_parameter_count);
+
+        /// Create a Dataset over samples already stored as columns, without copying anything.
+        /// \param p_columns The first parameter of every sample, then the second, and so on. Must outlive the Dataset.
+        /// \param p_labels An array of labels, with one label for each sample. Must outlive the Dataset.
+        /// \param p_count The number of samples.
+        /// \param p_parameter_count How many parameters each sample has.
+        /// \param p_stride How many doubles apart consecutive parameters start. At least p_count.
+        Dataset(const double *p_columns, const int *p_labels, size_t p_count, size_t p_parameter_count,
+                size_t p_stride);
+
+        /// Create a Dataset over weighted samples already stored as columns, without copying anything. A sample with a
+        /// weight of n fits exactly as n copies of it would, but costs no more than one.
+        /// \param p_columns The first parameter of every sample, then the second, and so on. Must outlive the Dataset.
+        /// \param p_labels An array of labels, with one label for each sample. Must outlive the Dataset.
+        /// \param p_weights An array of weights, with one weight of at least 1 for each sample, or nullptr to weigh
+        /// every sample 1. Must outlive the Dataset.
+        /// \param p_count The number of samples.
+        /// \param p_parameter_count How many parameters each sample has.
+        /// \param p_stride How many doubles apart consecutive parameters start. At least p_count.
+        Dataset(const double *p_columns, const int *p_labels, const size_t *p_weights, size_t p_count,
+                size_t p_parameter_count, size_t p_stride);
+
+        /// Get every sample's value of one parameter.
+        /// \param parameter Which parameter to get.
+        /// \return An array of count values, one for each sample.
+        const double *get_column(size_t parameter) const {
+            return columns + parameter * stride;
+        }
+
+        /// Get one sample's value of one parameter.
+        /// \param sample Which sample to get.
+        /// \param parameter Which parameter to get.
+        /// \return The value.
+        double get_value(size_t sample, size_t parameter) const {
+            return columns[parameter * stride + sample];
+        }
+
+        /// Get the labels of the samples.
+        /// \return An array of count labels.
+        const int *get_labels() const;
+
+        /// Get the weights of the samples.
+        /// \return An array of count weights, or nullptr if every sample weighs 1.
+        const size_t *get_weights() const;
+
+        /// Get how many samples one sample stands for.
+        /// \param sample Which sample to get.
+        /// \return The weight.
+        size_t get_weight(size_t sample) const {
+            return weights != nullptr ? weights[sample] : 1;
+        }
+
+        /// Get the number of samples.
+        /// \return The sample count.
+        size_t get_count() const;
+
+        /// Get the number of parameters each sample has.
+        /// \return The parameter count.
+        size_t get_parameter_count() const;
+
+        Dataset(const Dataset &) = delete;
+
+        Dataset &operator=(const Dataset &) = delete;
+
+        ~ Dataset();
+
+    private:
+        friend Dataset *merge_duplicate_samples(const Dataset &data);
+
+        const double *columns;
+
+        const int *labels;
+
+        const size_t *weights;
+
+        size_t count;
+
+        size_t parameter_count;
+
+        size_t stride;
+
+        double *owned_columns;
+
+        int *owned_labels;
+
+        size_t *owned_weights;
+    };
+
+    /// Merge every set of identical samples (the same label, and the same parameters bit for bit) into a single
+    /// sample, weighing as much as they all did. Logged sensor data often repeats the same reading for long stretches,
+    /// and this way fitting costs only as much as the distinct samples do. Samples are hashed, so merging takes a
+    /// single pass. Merged samples keep the order they first appeared in, so fitting to the merged Dataset gives
+    /// exactly the tree fitting to data gives.
+    /// \param data The samples to merge. They may already be weighted.
+    /// \return A new Dataset, owning its own copy of the merged samples.
+    Dataset *merge_duplicate_samples(const Dataset &data);
+
+} // pico_dt
+
+#endif //PICO_DT_DATASET_H
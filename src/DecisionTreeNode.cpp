@@ -2,15 +2,26 @@
 // Created by rando on 1/29/24.
 //
 
+#include <algorithm>
+#ifdef PICO_DT_ENABLE_FIT_STATS
+#include <chrono>
+#endif
 #include <cmath>
 //#include <cstdio>
 #include <cstring>
 #include<limits>
+#include <new>
+#ifdef PICO_DT_ENABLE_THREADS
+#include <mutex>
+#endif
+#include <vector>
 
 #include "DecisionTreeNode.h"
+#include "PortableFormat.h"
+#include "WorkStealingPool.h"
 
 namespace pico_dt {
-    DecisionTreeNode::DecisionTreeNode(size_t p_parameter_count, int p_label_count) {
+    DecisionTreeNode::DecisionTreeNode(size_t p_parameter_count, int p_label_count, TreeArena *p_arena) {
         parameter_count = p_parameter_count;
         label_count = p_label_count;
         default_value = 0;
@@ -19,172 +30,949 @@ namespace pico_dt {
         parent_branch = nullptr;
         comparison_parameter = -1;
         comparison_threshold = -1.0;
+        arena = p_arena;
+        serialized_size.store(0, std::memory_order_relaxed);
+#ifdef PICO_DT_ENABLE_FIT_STATS
+        fit_stats_callback = nullptr;
+        fit_stats_context = nullptr;
+#endif
     }
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "misc-no-recursion"
-
-    void DecisionTreeNode::fit(double **parameters, int *labels, size_t count, int limit) {
-        // TODO: make this non-recursive, probably using parent_branch like in serialize
-        //  because apparently doing this recursively is bad
-        //  (technically it can cause a stack overflow)
-        //  storing a full parameter stack should be avoided
-        //  the parameter stack for a node can be recalculated quickly by the following
-        //  1. parameter list starts as full parameter list
-        //  2. current node starts as this node
-        //  3. if current node is lesser branch of parent branch
-        //     3.a. remove all samples greater than parent branch threshold from parameter list
-        //  4. if current node is lesser branch of parent branch
-        //     4.a. remove all samples less than parent branch threshold from parameter list
-        //  5. if parent branch is null, stopp
-        //  6. goto 3
-        //  This is basically the reverse of what happens in this method when going down the tree.
-        //  proof: A & B & C == C & B & A
+    namespace {
+        /// Fit a subtree from an explicit stack of pending nodes instead of by recursing. fit_node fits a single node,
+        /// filling in its two children and returning true if it split. It gets the pool too, to split up big nodes.
+        /// With a pool, children holding at least PICO_DT_PARALLEL_MIN_SAMPLES samples are handed to the pool as new
+        /// tasks so idle workers can steal them.
+        /// Each node only ever looks at its own samples, so the finished tree doesn't depend on which thread fit what.
+        /// With an arena, the stack comes from its scratch space and is left there for fit's ScratchSpace to release,
+        /// since tasks on other threads finish in no particular order. A node the stack has no room for is fit with a
+        /// limit of 0, so it stays a leaf, like nodes fit into a full arena.
+        template<typename PendingNode, typename FitNode>
+        void fit_pending_nodes(PendingNode root, TreeArena *arena, WorkStealingPool *pool, FitNode &fit_node) {
+            auto allocate_stack = [arena](size_t capacity) {
+                if (arena == nullptr) return new PendingNode[capacity];
+                return arena->allocate_scratch_array<PendingNode>(capacity);
+            };
+            PendingNode children[2];
+            auto fit_leaf = [&children, pool, &fit_node](PendingNode node, unsigned int worker) {
+                node.limit = 0;
+                fit_node(node, children, pool, worker);
+            };
+#ifdef PICO_DT_ENABLE_THREADS
+            unsigned int worker = pool != nullptr ? pool->current_worker() : 0;
+#else
+            unsigned int worker = 0;
+#endif
+            PendingNode *stack = allocate_stack(PICO_DT_FIT_STACK_BLOCK);
+            if (stack == nullptr) {
+                fit_leaf(root, worker);
+                return;
+            }
+            size_t stack_capacity = PICO_DT_FIT_STACK_BLOCK;
+            size_t stack_size = 0;
+            stack[stack_size++] = root;
 
-        //printf("Starting fit of tree, %zu parameters sent.\n", count);
-        if (calculate_entropy(labels, count) <= 0) {
-            //printf("Node is a leaf!\n");
-            // the entropy is 0! This node is pure! Find the first label and set it as the default value.
-            default_value = labels[0];
-            return;
+            while (stack_size > 0) {
+                PendingNode node = stack[--stack_size];
+                if (!fit_node(node, children, pool, worker)) continue;
+
+                // push the greater child first, so the lesser child is fit first like it used to be.
+                PendingNode pushed[2] = {children[0], children[1]};
+                for (int i = 1; i >= 0; --i) {
+#ifdef PICO_DT_ENABLE_THREADS
+                    if (pool != nullptr && pushed[i].count >= PICO_DT_PARALLEL_MIN_SAMPLES) {
+                        PendingNode child = pushed[i];
+                        pool->submit([child, arena, pool, &fit_node] {
+                            fit_pending_nodes(child, arena, pool, fit_node);
+                        });
+                        continue;
+                    }
+#endif
+                    if (stack_size == stack_capacity) {
+                        PendingNode *bigger_stack = allocate_stack(stack_capacity + PICO_DT_FIT_STACK_BLOCK);
+                        if (bigger_stack == nullptr) {
+                            fit_leaf(pushed[i], worker);
+                            continue;
+                        }
+                        for (size_t j = 0; j < stack_size; ++j) {
+                            bigger_stack[j] = stack[j];
+                        }
+                        if (arena == nullptr) delete[] stack;
+                        stack = bigger_stack;
+                        stack_capacity += PICO_DT_FIT_STACK_BLOCK;
+                    }
+                    stack[stack_size++] = pushed[i];
+                }
+            }
+            if (arena == nullptr) delete[] stack;
         }
-        if (limit == 0) {
-            //printf("Node shouldn't be a leaf, but was forced to be!\n");
-            // the entropy is 0! This node is pure! Find the first label and set it as the default value.
-            auto *label_counts = new size_t[label_count];
-            for (int i = 0; i < label_count; ++i) {
-                label_counts[i] = 0;
-            }
-            for (size_t i = 0; i < count; i++) {
-                ++label_counts[labels[i]];
-            }
-            size_t best_count = 0;
-            for (int i = 0; i < label_count; ++i) {
-                if(label_counts[i] > best_count){
-                    best_count = label_counts[i];
-                    default_value = i;
+
+        /// Fit a tree from its root node, on a pool of thread_count threads if there's more than one.
+        template<typename PendingNode, typename FitNode>
+        void fit_tree(PendingNode root, TreeArena *arena, unsigned int thread_count, FitNode &fit_node) {
+#ifdef PICO_DT_ENABLE_THREADS
+            if (thread_count > 1) {
+                WorkStealingPool pool(thread_count);
+                pool.submit([root, arena, &pool, &fit_node] { fit_pending_nodes(root, arena, &pool, fit_node); });
+                pool.wait();
+                return;
+            }
+#else
+            (void) thread_count;
+#endif
+            fit_pending_nodes(root, arena, nullptr, fit_node);
+        }
+
+#ifdef PICO_DT_ENABLE_FIT_STATS
+
+        /// What the calling thread has counted while fitting. A node's share is how much these grow while it is fit.
+        struct FitCounters {
+            size_t candidates;
+            size_t samples;
+            size_t bytes;
+        };
+
+        thread_local FitCounters fit_counters = {0, 0, 0};
+
+#endif
+
+        /// Hands out fit's scratch arrays, from the top of an arena if there is one or from the heap otherwise, and
+        /// frees them all at once when it goes away.
+        class ScratchSpace {
+        public:
+            explicit ScratchSpace(TreeArena *p_arena) {
+                arena = p_arena;
+                mark = arena != nullptr ? arena->get_scratch_mark() : 0;
+                failed = false;
+            }
+
+            template<typename T>
+            T *allocate(size_t count) {
+                T *array;
+                if (arena != nullptr) {
+                    array = arena->allocate_scratch_array<T>(count);
+                } else {
+                    heap_arrays.push_back(::operator new(count * sizeof(T)));
+                    array = static_cast<T *>(heap_arrays.back());
+                }
+                if (array == nullptr) failed = true;
+                PICO_DT_FIT_STATS(fit_counters.bytes += count * sizeof(T);)
+                return array;
+            }
+
+            bool has_failed() const {
+                return failed;
+            }
+
+            ScratchSpace(const ScratchSpace &) = delete;
+
+            ScratchSpace &operator=(const ScratchSpace &) = delete;
+
+            ~ScratchSpace() {
+                if (arena != nullptr) arena->release_scratch(mark);
+                for (void *array : heap_arrays) {
+                    ::operator delete(array);
                 }
             }
+
+        private:
+            TreeArena *arena;
+            size_t mark;
+            bool failed;
+            std::vector<void *> heap_arrays;
+        };
+
+#ifdef PICO_DT_ENABLE_FIT_STATS
+
+        /// Adds up what every node took by depth, and reports each depth to the callback when it goes away.
+        class FitStatsRecorder {
+        public:
+            FitStatsRecorder(FitStatsCallback p_callback, void *p_context) {
+                callback = p_callback;
+                context = p_context;
+            }
+
+            /// Add what the calling thread counted since before, and the time since start, to a depth.
+            void record(size_t depth, size_t nodes, const FitCounters &before,
+                        std::chrono::steady_clock::time_point start) {
+                double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+#ifdef PICO_DT_ENABLE_THREADS
+                std::lock_guard<std::mutex> lock(mutex);
+#endif
+                while (levels.size() <= depth) {
+                    levels.push_back({levels.size(), 0, 0, 0, 0, 0});
+                }
+                FitLevelStats &level = levels[depth];
+                level.nodes_created += nodes;
+                level.candidates_evaluated += fit_counters.candidates - before.candidates;
+                level.samples_scanned += fit_counters.samples - before.samples;
+                level.bytes_allocated += fit_counters.bytes - before.bytes;
+                level.seconds += seconds;
+            }
+
+            FitStatsRecorder(const FitStatsRecorder &) = delete;
+
+            FitStatsRecorder &operator=(const FitStatsRecorder &) = delete;
+
+            ~FitStatsRecorder() {
+                if (callback == nullptr) return;
+                for (const FitLevelStats &level : levels) {
+                    callback(level, context);
+                }
+            }
+
+        private:
+            FitStatsCallback callback;
+            void *context;
+            std::vector<FitLevelStats> levels;
+#ifdef PICO_DT_ENABLE_THREADS
+            std::mutex mutex;
+#endif
+        };
+
+        /// Records what fitting one node takes, from when it is made until it goes away.
+        class FitNodeTimer {
+        public:
+            FitNodeTimer(FitStatsRecorder &p_recorder, size_t p_depth) : recorder(p_recorder) {
+                depth = p_depth;
+                before = fit_counters;
+                start = std::chrono::steady_clock::now();
+            }
+
+            FitNodeTimer(const FitNodeTimer &) = delete;
+
+            FitNodeTimer &operator=(const FitNodeTimer &) = delete;
+
+            ~FitNodeTimer() {
+                recorder.record(depth, 1, before, start);
+            }
+
+        private:
+            FitStatsRecorder &recorder;
+            size_t depth;
+            FitCounters before;
+            std::chrono::steady_clock::time_point start;
+        };
+
+#endif
+
+        /// Get how many threads fit will really use, so scratch space can be made for each.
+        unsigned int fit_thread_count(unsigned int thread_count) {
+#ifdef PICO_DT_ENABLE_THREADS
+            return thread_count < 1 ? 1 : thread_count;
+#else
+            (void) thread_count;
+            return 1;
+#endif
+        }
+    }
+
+    void DecisionTreeNode::fit(double **parameters, int *labels, size_t count, int limit, unsigned int thread_count) {
+        if (count == 0) return;
+
+        // copy the rows into columns, in the arena if there is one.
+        ScratchSpace scratch(arena);
+        auto *columns = scratch.allocate<double>(parameter_count * count);
+        if (scratch.has_failed()) {
             default_value = labels[0];
             return;
         }
-        //printf("Node isn't a leaf.\n");
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (size_t j = 0; j < count; ++j) {
+                columns[i * count + j] = parameters[j][i];
+            }
+        }
+        fit(Dataset(columns, labels, count, parameter_count, count), limit, thread_count);
+    }
+
+    void DecisionTreeNode::fit(const Dataset &data, int limit, unsigned int thread_count) {
+        fit_sorted(data, nullptr, data.get_count(), limit, thread_count);
+    }
 
-        // create list of test splits
-        auto **test_splits = new double *[parameter_count];
+    void DecisionTreeNode::fit_presorted(const Dataset &data, const size_t *const *sorted_samples, size_t count,
+                                         int limit, unsigned int thread_count) {
+        fit_sorted(data, sorted_samples, count, limit, thread_count);
+    }
+
+    void DecisionTreeNode::fit_sorted(const Dataset &data, const size_t *const *presorted_samples, size_t count,
+                                      int limit, unsigned int thread_count) {
+        const int *labels = data.get_labels();
+        if (count == 0) return;
+        forget_serialized_size();
+        PICO_DT_FIT_STATS(FitStatsRecorder recorder(fit_stats_callback, fit_stats_context);
+                          FitCounters setup_before = fit_counters;
+                          auto setup_start = std::chrono::steady_clock::now();)
+
+        // every thread gets its own partition buffer and label counts.
+        ScratchSpace scratch(arena);
+        auto **sorted_samples = scratch.allocate<size_t *>(parameter_count);
+        for (size_t i = 0; i < parameter_count && !scratch.has_failed(); ++i) {
+            sorted_samples[i] = scratch.allocate<size_t>(count);
+        }
+        unsigned int scratch_count = fit_thread_count(thread_count);
+        auto *partition_buffers = scratch.allocate<size_t>(scratch_count * count);
+        auto *label_counts = scratch.allocate<size_t>(scratch_count * 3 * (size_t) label_count);
+        if (scratch.has_failed()) {
+            // the arena is too full to even start, so this node has to stay a leaf.
+            default_value = labels[presorted_samples != nullptr ? *std::min_element(presorted_samples[0],
+                                                                                    presorted_samples[0] + count) : 0];
+            return;
+        }
+
+        // sort every parameter column exactly once, unless that's been done already. each node owns the same
+        // [begin, begin + count) range in every column, and splitting a node just partitions those ranges in place, so
+        // the columns stay sorted all the way down the tree without re-sorting or copying any samples. nodes never
+        // share samples, so any number of them can be fit at once.
         for (size_t i = 0; i < parameter_count; ++i) {
-            // create a list for the test splits of this parameter
-            test_splits[i] = new double[count];
+            if (presorted_samples != nullptr) {
+                memcpy(sorted_samples[i], presorted_samples[i], count * sizeof(size_t));
+                continue;
+            }
             for (size_t j = 0; j < count; ++j) {
-                test_splits[i][j] = -std::numeric_limits<double>::infinity();
+                sorted_samples[i][j] = j;
             }
+            const double *values = data.get_column(i);
+            std::sort(sorted_samples[i], sorted_samples[i] + count, [values](size_t a, size_t b) {
+                return values[a] < values[b];
+            });
+        }
 
-            // add all of the copies of this parameter to the array
-            for (size_t j = 0; j < count; j++) {
-                double val = parameters[j][i];
+        struct PendingNode {
+            DecisionTreeNode *node;
+            size_t begin;
+            size_t count;
+            int limit;
+            PICO_DT_FIT_STATS(size_t depth;)
+        };
+        auto fit_node = [&](const PendingNode &pending, PendingNode *children, WorkStealingPool *pool,
+                            unsigned int worker) {
+            PICO_DT_FIT_STATS(FitNodeTimer timer(recorder, pending.depth);)
+            DecisionTreeNode *node = pending.node;
+            size_t lesser_count = node->fit_presorted_node(data, labels, sorted_samples, pending.begin,
+                                                           pending.count, pending.limit,
+                                                           partition_buffers + worker * count,
+                                                           label_counts + worker * 3 * (size_t) label_count, pool);
+            if (lesser_count == 0) return false;
+            int child_limit = pending.limit >= 0 ? pending.limit - 1 : -1;
+            children[0] = {node->lesser_branch, pending.begin, lesser_count, child_limit
+                           PICO_DT_FIT_STATS(, pending.depth + 1)};
+            children[1] = {node->greater_branch, pending.begin + lesser_count, pending.count - lesser_count,
+                           child_limit PICO_DT_FIT_STATS(, pending.depth + 1)};
+            return true;
+        };
+        PICO_DT_FIT_STATS(recorder.record(0, 0, setup_before, setup_start);)
+        fit_tree(PendingNode{this, 0, count, limit PICO_DT_FIT_STATS(, 0)}, arena, thread_count, fit_node);
+    }
 
-                // insertion sort it into the array.
-                for (size_t k = 0; k < count; k++) {
-                    if (val > test_splits[i][k]) {
-                        double temp = val;
-                        val = test_splits[i][k];
-                        test_splits[i][k] = temp;
-                    }
+    size_t DecisionTreeNode::fit_presorted_node(const Dataset &data, const int *labels, size_t **sorted_samples,
+                                                size_t begin, size_t count, int limit, size_t *partition_buffer,
+                                                size_t *label_counts, WorkStealingPool *pool) {
+        //printf("Starting fit of tree, %zu parameters sent.\n", count);
+        // the first column is as good as any other for finding which samples are in this node.
+        const size_t *samples = sorted_samples[0] + begin;
+        size_t first_sample = samples[0];
+        for (size_t i = 1; i < count; ++i) {
+            if (samples[i] < first_sample) first_sample = samples[i];
+        }
+
+        // count how many of each label there are, by weight. the node is pure (entropy of 0) when all samples share
+        // one label.
+        for (int i = 0; i < label_count; ++i) {
+            label_counts[i] = 0;
+        }
+        size_t weight = 0;
+        for (size_t i = 0; i < count; ++i) {
+            size_t sample_weight = data.get_weight(samples[i]);
+            label_counts[labels[samples[i]]] += sample_weight;
+            weight += sample_weight;
+        }
+        PICO_DT_FIT_STATS(fit_counters.samples += count;)
+        if (label_counts[labels[first_sample]] == weight) {
+            //printf("Node is a leaf!\n");
+            default_value = labels[first_sample];
+            return 0;
+        }
+        if (limit == 0) {
+            //printf("Node shouldn't be a leaf, but was forced to be!\n");
+            default_value = labels[first_sample];
+            return 0;
+        }
+
+        size_t split_parameter;
+        double split_threshold;
+        size_t lesser_count = find_best_split(data, labels, sorted_samples, begin, count, weight, label_counts,
+                                              label_counts + label_count, label_counts + 2 * label_count, pool,
+                                              split_parameter, split_threshold);
+        if (lesser_count == 0 || lesser_count == count) {
+            // no threshold separates these samples (they're identical but labelled differently), so give up here.
+            default_value = labels[first_sample];
+            return 0;
+        }
+        if (!create_branches()) {
+            // the arena is full.
+            default_value = labels[first_sample];
+            return 0;
+        }
+        comparison_parameter = split_parameter;
+        comparison_threshold = split_threshold;
+
+        // stable partition every column, so both children keep their columns sorted.
+        const double *split_values = data.get_column(comparison_parameter);
+        for (size_t i = 0; i < parameter_count; ++i) {
+            size_t *column = sorted_samples[i] + begin;
+            size_t lesser_index = 0;
+            size_t greater_index = 0;
+            for (size_t j = 0; j < count; ++j) {
+                size_t sample = column[j];
+                if (split_values[sample] < comparison_threshold) column[lesser_index++] = sample;
+                else partition_buffer[greater_index++] = sample;
+            }
+            memcpy(column + lesser_index, partition_buffer, greater_index * sizeof(size_t));
+        }
+        PICO_DT_FIT_STATS(fit_counters.samples += count * parameter_count;)
+        return lesser_count;
+    }
+
+    bool DecisionTreeNode::create_branches() {
+        DecisionTreeNode *lesser = create_decision_tree_node(arena, parameter_count, label_count);
+        DecisionTreeNode *greater = create_decision_tree_node(arena, parameter_count, label_count);
+        // only an arena can run out, and its nodes don't need freeing.
+        if (lesser == nullptr || greater == nullptr) return false;
+        PICO_DT_FIT_STATS(fit_counters.bytes += 2 * sizeof(DecisionTreeNode);)
+        lesser_branch = lesser;
+        lesser_branch->parent_branch = this;
+        greater_branch = greater;
+        greater_branch->parent_branch = this;
+        return true;
+    }
+
+    /// The histograms of pending binned nodes. With an arena they come from its scratch space and are kept on a free
+    /// list for reuse, since they're released in no particular order.
+    struct DecisionTreeNode::HistogramPool {
+        TreeArena *arena;
+        size_t histogram_size;
+        size_t *free_histograms;
+#ifdef PICO_DT_ENABLE_THREADS
+        std::mutex mutex;
+#endif
+
+        HistogramPool(TreeArena *p_arena, size_t p_histogram_size) {
+            arena = p_arena;
+            histogram_size = p_histogram_size;
+            free_histograms = nullptr;
+        }
+
+        size_t *acquire() {
+            PICO_DT_FIT_STATS(if (arena == nullptr || free_histograms == nullptr) {
+                fit_counters.bytes += histogram_size * sizeof(size_t);
+            })
+            if (arena == nullptr) return new size_t[histogram_size];
+#ifdef PICO_DT_ENABLE_THREADS
+            std::lock_guard<std::mutex> lock(mutex);
+#endif
+            if (free_histograms == nullptr) return arena->allocate_scratch_array<size_t>(histogram_size);
+            // free histograms are linked through their first element.
+            size_t *histogram = free_histograms;
+            memcpy(&free_histograms, histogram, sizeof(free_histograms));
+            return histogram;
+        }
+
+        void release(size_t *histogram) {
+            if (arena == nullptr) {
+                delete[] histogram;
+                return;
+            }
+#ifdef PICO_DT_ENABLE_THREADS
+            std::lock_guard<std::mutex> lock(mutex);
+#endif
+            memcpy(histogram, &free_histograms, sizeof(free_histograms));
+            free_histograms = histogram;
+        }
+    };
+
+    static_assert(sizeof(size_t *) <= sizeof(size_t), "free histograms are linked through their first element");
+
+    size_t DecisionTreeNode::find_best_split(const Dataset &data, const int *labels, size_t **sorted_samples,
+                                             size_t begin, size_t count, size_t weight,
+                                             const size_t *parent_label_counts, size_t *lesser_label_counts,
+                                             size_t *greater_label_counts, WorkStealingPool *pool,
+                                             size_t &split_parameter, double &split_threshold) const {
+        double parent_entropy = calculate_entropy_from_counts(parent_label_counts, weight);
+
+        // This gives exactly the split the old brute force search gave. It tried the midpoint of every pair of
+        // neighbouring sorted values (so a repeated value v was tried as a threshold of v itself), scored each with
+        // calculate_information_gain, and kept the last best score using >=. Thresholds were tried from largest to
+        // smallest, so among equal scores the highest parameter wins, and within a parameter the smallest threshold.
+        // Here every parameter is swept from smallest to largest threshold instead, moving samples from the greater
+        // side to the lesser side as the threshold passes them, so each candidate costs O(label_count) to score.
+        // Label counts are weighted, so a sample weighing n scores exactly as n copies of it would.
+        SplitCandidate best = {-std::numeric_limits<double>::infinity(), 0, 0};
+        split_parameter = 0;
+#ifdef PICO_DT_ENABLE_THREADS
+        if (pool != nullptr && pool->get_thread_count() > 1 && count >= PICO_DT_PARALLEL_SPLIT_MIN_SAMPLES) {
+            find_best_split_parallel(data, labels, sorted_samples, begin, count, parent_label_counts,
+                                     parent_entropy, pool, best, split_parameter);
+            split_threshold = best.threshold;
+            return best.lesser_count;
+        }
+#else
+        (void) pool;
+#endif
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (int k = 0; k < label_count; ++k) {
+                lesser_label_counts[k] = 0;
+                greater_label_counts[k] = parent_label_counts[k];
+            }
+            SplitCandidate parameter_best = {-std::numeric_limits<double>::infinity(), 0, 0};
+            sweep_split_candidates(data, labels, sorted_samples[i] + begin, count, i, 0, count,
+                                   parent_entropy, lesser_label_counts, greater_label_counts, parameter_best);
+            PICO_DT_FIT_STATS(fit_counters.samples += count;)
+            if (parameter_best.score >= best.score) {
+                best = parameter_best;
+                split_parameter = i;
+            }
+        }
+        split_threshold = best.threshold;
+        return best.lesser_count;
+    }
+
+#ifdef PICO_DT_ENABLE_THREADS
+
+    void DecisionTreeNode::find_best_split_parallel(const Dataset &data, const int *labels, size_t **sorted_samples,
+                                                    size_t begin, size_t count, const size_t *parent_label_counts,
+                                                    double parent_entropy, WorkStealingPool *pool,
+                                                    SplitCandidate &best, size_t &split_parameter) const {
+        // cut every parameter's sweep into chunks, aiming for a couple of chunks per thread overall. chunks only ever
+        // start at the start of a run of equal values, so each chunk tries exactly the thresholds the whole sweep
+        // would.
+        size_t chunk_count = (2 * (size_t) pool->get_thread_count() + parameter_count - 1) / parameter_count;
+        if (chunk_count > count / PICO_DT_PARALLEL_SPLIT_MIN_CHUNK) {
+            chunk_count = count / PICO_DT_PARALLEL_SPLIT_MIN_CHUNK;
+        }
+        if (chunk_count < 1) chunk_count = 1;
+        size_t work_count = parameter_count * chunk_count;
+
+        auto *chunk_starts = new size_t[parameter_count * (chunk_count + 1)];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            const size_t *column = sorted_samples[i] + begin;
+            const double *values = data.get_column(i);
+            size_t *starts = chunk_starts + i * (chunk_count + 1);
+            starts[0] = 0;
+            for (size_t k = 1; k < chunk_count; ++k) {
+                size_t start = k * count / chunk_count;
+                if (start < starts[k - 1]) start = starts[k - 1];
+                while (start > 0 && start < count && values[column[start - 1]] == values[column[start]]) {
+                    ++start;
                 }
+                starts[k] = start;
             }
+            starts[chunk_count] = count;
+        }
 
-            // finalize the array values
-            for (size_t j = 0; j < count - 1; ++j) {
-                // going to try to use the midpoints between values, not the values themselves.
-                test_splits[i][j] = (test_splits[i][j] + test_splits[i][j + 1]) / 2;
+        // each chunk needs the label counts of everything before it to start from, so count every chunk's labels
+        // first, then add them up.
+        auto *chunk_label_counts = new size_t[work_count * 2 * (size_t) label_count];
+        pool->parallel_for(work_count, [&](size_t work) {
+            size_t i = work / chunk_count;
+            size_t k = work % chunk_count;
+            const size_t *column = sorted_samples[i] + begin;
+            const size_t *starts = chunk_starts + i * (chunk_count + 1);
+            size_t *counts = chunk_label_counts + work * 2 * label_count;
+            for (int j = 0; j < label_count; ++j) {
+                counts[j] = 0;
+            }
+            for (size_t j = starts[k]; j < starts[k + 1]; ++j) {
+                counts[labels[column[j]]] += data.get_weight(column[j]);
+            }
+        });
+        auto *running_counts = new size_t[label_count];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (int j = 0; j < label_count; ++j) {
+                running_counts[j] = 0;
+            }
+            for (size_t k = 0; k < chunk_count; ++k) {
+                size_t *lesser_counts = chunk_label_counts + (i * chunk_count + k) * 2 * label_count;
+                size_t *greater_counts = lesser_counts + label_count;
+                for (int j = 0; j < label_count; ++j) {
+                    size_t chunk_label_count = lesser_counts[j];
+                    lesser_counts[j] = running_counts[j];
+                    greater_counts[j] = parent_label_counts[j] - running_counts[j];
+                    running_counts[j] += chunk_label_count;
+                }
             }
         }
+        delete[] running_counts;
 
-        // okay, we've picked our test parameters, now to evaluate.
-        size_t best_parameter = 0;
-        size_t best_split = 0;
-        double best_score = calculate_information_gain(parameters, labels, count, 0,
-                                                       test_splits[0][0]);
+        auto *chunk_best = new SplitCandidate[work_count];
+        // chunks run on whichever thread takes them, so each one's candidates are handed back to this thread.
+        PICO_DT_FIT_STATS(std::vector<size_t> chunk_candidates(work_count);)
+        pool->parallel_for(work_count, [&](size_t work) {
+            PICO_DT_FIT_STATS(FitCounters worker_counters = fit_counters;)
+            size_t i = work / chunk_count;
+            size_t k = work % chunk_count;
+            const size_t *starts = chunk_starts + i * (chunk_count + 1);
+            size_t *lesser_counts = chunk_label_counts + work * 2 * label_count;
+            chunk_best[work] = {-std::numeric_limits<double>::infinity(), 0, 0};
+            sweep_split_candidates(data, labels, sorted_samples[i] + begin, count, i, starts[k],
+                                   starts[k + 1], parent_entropy, lesser_counts, lesser_counts + label_count,
+                                   chunk_best[work]);
+            PICO_DT_FIT_STATS(chunk_candidates[work] = fit_counters.candidates - worker_counters.candidates;
+                              fit_counters = worker_counters;)
+        });
+        PICO_DT_FIT_STATS(for (size_t candidates : chunk_candidates) {
+            fit_counters.candidates += candidates;
+        }
+        // every sample is read twice per parameter, once counting labels and once sweeping.
+        fit_counters.samples += 2 * count * parameter_count;
+        fit_counters.bytes += parameter_count * (chunk_count + 1) * sizeof(size_t) +
+                              work_count * 2 * (size_t) label_count * sizeof(size_t) +
+                              (size_t) label_count * sizeof(size_t) + work_count * sizeof(SplitCandidate);)
+
+        // combine the chunks in the same order the single sweep would have visited them.
         for (size_t i = 0; i < parameter_count; ++i) {
-            for (size_t j = 0; j < count - 1; ++j) {
-                double this_score = calculate_information_gain(parameters, labels, count, i,
-                                                               test_splits[i][j]);
-                //printf("%zu, %zu, %lf, %lf\n", i, j, test_splits[i][j], this_information_gain_ratio);
-                // use >=, not > as lower values are sorted later
-                // in the case of parameters like 2.0, 2.0, 0.0, 0.0, the splits will be 2.0, 1.0, 0.0
-                // both 2.0 and 1.0 will split the samples in half, but 1.0 will split down the middle of the
-                // gap between parameters, not right at one on the parameters
-                if (this_score >= best_score) {
-                    best_score = this_score;
-                    best_parameter = i;
-                    best_split = j;
+            SplitCandidate parameter_best = {-std::numeric_limits<double>::infinity(), 0, 0};
+            for (size_t k = 0; k < chunk_count; ++k) {
+                if (chunk_best[i * chunk_count + k].score > parameter_best.score) {
+                    parameter_best = chunk_best[i * chunk_count + k];
                 }
             }
+            if (parameter_best.score >= best.score) {
+                best = parameter_best;
+                split_parameter = i;
+            }
         }
 
-        comparison_parameter = best_parameter;
-        comparison_threshold = test_splits[best_parameter][best_split];
+        delete[] chunk_starts;
+        delete[] chunk_label_counts;
+        delete[] chunk_best;
+    }
 
-        // cleanup. instead of waiting until the very end, we'll clean up now before recursing.
+#endif
+
+    void DecisionTreeNode::sweep_split_candidates(const Dataset &data, const int *labels, const size_t *column,
+                                                  size_t count, size_t parameter, size_t run_begin, size_t run_end,
+                                                  double parent_entropy, size_t *lesser_label_counts,
+                                                  size_t *greater_label_counts, SplitCandidate &best) const {
+        const double *values = data.get_column(parameter);
+        size_t lesser_count = run_begin;
+        size_t scored_lesser_count = 0;
+        double score = 0;
+        bool scored = false;
+        size_t lesser_weight = 0;
+        size_t greater_weight = 0;
+        for (int k = 0; k < label_count; ++k) {
+            lesser_weight += lesser_label_counts[k];
+            greater_weight += greater_label_counts[k];
+        }
+
+        auto try_threshold = [&](double threshold) {
+            while (lesser_count < count && values[column[lesser_count]] < threshold) {
+                size_t sample = column[lesser_count++];
+                size_t weight = data.get_weight(sample);
+                lesser_label_counts[labels[sample]] += weight;
+                greater_label_counts[labels[sample]] -= weight;
+                lesser_weight += weight;
+                greater_weight -= weight;
+            }
+            PICO_DT_FIT_STATS(++fit_counters.candidates;)
+            if (!scored || lesser_count != scored_lesser_count) {
+                if (lesser_count == 0 || lesser_count == count) {
+                    score = 0;
+                } else {
+                    double lesser_entropy = calculate_entropy_from_counts(lesser_label_counts, lesser_weight);
+                    double greater_entropy = calculate_entropy_from_counts(greater_label_counts, greater_weight);
+                    score = parent_entropy - ((lesser_entropy + greater_entropy) / 2);
+                }
+                scored_lesser_count = lesser_count;
+                scored = true;
+            }
+            // use >, not >= as thresholds are visited smallest first here
+            if (score > best.score) {
+                best = {score, threshold, lesser_count};
+            }
+        };
+
+        // walk runs of equal values in ascending order. a run of one sample weighing more than 1 is a run of copies.
+        size_t run_start = run_begin;
+        while (run_start < run_end) {
+            double value = values[column[run_start]];
+            size_t next_run_start = run_start + 1;
+            while (next_run_start < count && values[column[next_run_start]] == value) ++next_run_start;
+            if (next_run_start - run_start > 1 || data.get_weight(column[run_start]) > 1) try_threshold(value);
+            if (next_run_start < count) try_threshold((values[column[next_run_start]] + value) / 2);
+            run_start = next_run_start;
+        }
+    }
+
+    void DecisionTreeNode::fit_binned(double **parameters, int *labels, size_t count, size_t max_bins,
+                                      BinningMode mode, int limit, unsigned int thread_count) {
+        if (count == 0) return;
+
+        // copy the rows into columns, in the arena if there is one.
+        ScratchSpace scratch(arena);
+        auto *columns = scratch.allocate<double>(parameter_count * count);
+        if (scratch.has_failed()) {
+            default_value = labels[0];
+            return;
+        }
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (size_t j = 0; j < count; ++j) {
+                columns[i * count + j] = parameters[j][i];
+            }
+        }
+        fit_binned(Dataset(columns, labels, count, parameter_count, count), max_bins, mode, limit, thread_count);
+    }
+
+    void DecisionTreeNode::fit_binned(const Dataset &data, size_t max_bins, BinningMode mode, int limit,
+                                      unsigned int thread_count) {
+        size_t count = data.get_count();
+        const int *labels = data.get_labels();
+        const size_t *weights = data.get_weights();
+        if (count == 0) return;
+        forget_serialized_size();
+        PICO_DT_FIT_STATS(FitStatsRecorder recorder(fit_stats_callback, fit_stats_context);
+                          FitCounters setup_before = fit_counters;
+                          auto setup_start = std::chrono::steady_clock::now();)
+
+        FeatureBinner binner(parameter_count, max_bins, mode, arena);
+        binner.fit(data);
+
+        ScratchSpace scratch(arena);
+        auto *bin_offsets = scratch.allocate<size_t>(parameter_count + 1);
+        auto **bins = scratch.allocate<uint16_t *>(parameter_count);
+        for (size_t i = 0; i < parameter_count && !scratch.has_failed(); ++i) {
+            bins[i] = scratch.allocate<uint16_t>(count);
+        }
+        auto *samples = scratch.allocate<size_t>(count);
+        unsigned int scratch_count = fit_thread_count(thread_count);
+        auto *label_counts = scratch.allocate<size_t>(scratch_count * 3 * (size_t) label_count);
+        if (scratch.has_failed()) {
+            // the arena is too full to even start, so this node has to stay a leaf.
+            default_value = labels[0];
+            return;
+        }
+
+        // every parameter gets its own run of bins in the histogram, each bin holding one count per label.
+        bin_offsets[0] = 0;
         for (size_t i = 0; i < parameter_count; ++i) {
-            delete[] test_splits[i];
+            bin_offsets[i + 1] = bin_offsets[i] + binner.get_bin_count(i);
         }
-        delete[] test_splits;
+        size_t histogram_size = bin_offsets[parameter_count] * label_count;
 
-        size_t lesser_count = 0;
-        for (size_t i = 0; i < count; i++) {
-            if (parameters[i][comparison_parameter] < comparison_threshold) ++lesser_count;
+        // quantize every sample once. from here on the raw parameters are never looked at again.
+        for (size_t i = 0; i < parameter_count; ++i) {
+            const double *values = data.get_column(i);
+            for (size_t j = 0; j < count; ++j) {
+                bins[i][j] = binner.bin(i, values[j]);
+            }
         }
+        for (size_t i = 0; i < count; ++i) {
+            samples[i] = i;
+        }
+
+        // every pending node owns its histogram, and either hands it down to its larger child or releases it.
+        HistogramPool histograms(arena, histogram_size);
+        struct PendingNode {
+            DecisionTreeNode *node;
+            size_t begin;
+            size_t count;
+            int limit;
+            size_t *histogram;
+            PICO_DT_FIT_STATS(size_t depth;)
+        };
+        auto fit_node = [&](const PendingNode &pending, PendingNode *children, WorkStealingPool *,
+                            unsigned int worker) {
+            PICO_DT_FIT_STATS(FitNodeTimer timer(recorder, pending.depth);)
+            DecisionTreeNode *node = pending.node;
+            size_t *smaller_histogram = nullptr;
+            size_t lesser_count = node->fit_histogram_node(binner, bins, labels, weights, samples + pending.begin,
+                                                           pending.count, bin_offsets, pending.histogram,
+                                                           pending.limit,
+                                                           label_counts + worker * 3 * (size_t) label_count,
+                                                           histograms, smaller_histogram);
+            if (lesser_count == 0) {
+                histograms.release(pending.histogram);
+                return false;
+            }
+            int child_limit = pending.limit >= 0 ? pending.limit - 1 : -1;
+            size_t greater_count = pending.count - lesser_count;
+            bool lesser_is_smaller = lesser_count <= greater_count;
+            children[0] = {node->lesser_branch, pending.begin, lesser_count, child_limit,
+                           lesser_is_smaller ? smaller_histogram : pending.histogram
+                           PICO_DT_FIT_STATS(, pending.depth + 1)};
+            children[1] = {node->greater_branch, pending.begin + lesser_count, greater_count, child_limit,
+                           lesser_is_smaller ? pending.histogram : smaller_histogram
+                           PICO_DT_FIT_STATS(, pending.depth + 1)};
+            return true;
+        };
+        size_t *histogram = histograms.acquire();
+        if (histogram == nullptr) {
+            default_value = labels[0];
+            return;
+        }
+        build_histogram(bins, labels, weights, samples, count, bin_offsets, histogram);
+        PICO_DT_FIT_STATS(recorder.record(0, 0, setup_before, setup_start);)
+        fit_tree(PendingNode{this, 0, count, limit, histogram PICO_DT_FIT_STATS(, 0)}, arena, thread_count, fit_node);
+    }
+
+    size_t DecisionTreeNode::fit_histogram_node(const FeatureBinner &binner, uint16_t **bins, const int *labels,
+                                                const size_t *weights, size_t *samples, size_t count,
+                                                const size_t *bin_offsets, size_t *histogram, int limit,
+                                                size_t *label_counts, HistogramPool &histograms,
+                                                size_t *&smaller_histogram) {
+        // the bins of any one parameter hold every sample, so the first parameter's bins give the label counts, by
+        // weight.
+        size_t best_count = 0;
+        size_t weight = 0;
+        for (int i = 0; i < label_count; ++i) {
+            label_counts[i] = 0;
+            for (size_t j = 0; j < bin_offsets[1]; ++j) {
+                label_counts[i] += histogram[j * label_count + i];
+            }
+            weight += label_counts[i];
+            if (label_counts[i] > best_count) {
+                best_count = label_counts[i];
+                default_value = i;
+            }
+        }
+        if (best_count == weight || limit == 0) return 0;
+
+        size_t split_parameter;
+        size_t split_bin;
+        size_t lesser_weight = find_best_bin_split(binner, bin_offsets, histogram, weight, label_counts,
+                                                   label_counts + label_count, label_counts + 2 * label_count,
+                                                   split_parameter, split_bin);
+        if (lesser_weight == 0) return 0;
+        smaller_histogram = histograms.acquire();
+        if (smaller_histogram == nullptr) return 0;
+        if (!create_branches()) {
+            // the arena is full.
+            histograms.release(smaller_histogram);
+            return 0;
+        }
+        comparison_parameter = split_parameter;
+        comparison_threshold = binner.get_threshold(split_parameter, split_bin);
+
+        const uint16_t *split_bins = bins[split_parameter];
+        size_t lesser_count = std::partition(samples, samples + count, [split_bins, split_bin](size_t sample) {
+            return split_bins[sample] <= split_bin;
+        }) - samples;
+        PICO_DT_FIT_STATS(fit_counters.samples += count;)
         size_t greater_count = count - lesser_count;
 
-        // recursively fit the lesser child
-        //printf("Fitting lesser child.\n");
-        auto **lesser_parameters = new double *[lesser_count];
-        auto *lesser_labels = new int[lesser_count];
-        size_t lesser_index = 0;
-        for (size_t parent_index = 0; parent_index < count; parent_index++) {
-            if (parameters[parent_index][comparison_parameter] >= comparison_threshold) continue;
-            lesser_parameters[lesser_index] = parameters[parent_index];
-            lesser_labels[lesser_index++] = labels[parent_index];
-        }
-        lesser_branch = new DecisionTreeNode(parameter_count, label_count);
-        lesser_branch->parent_branch = this;
-        lesser_branch->fit(lesser_parameters, lesser_labels, lesser_count, limit >= 0 ? limit - 1 : -1);
-        //printf("Done fitting lesser child.\n");
-        delete[] lesser_parameters;
-        delete[] lesser_labels;
-
-        // recursively fit the greater child
-        //printf("Fitting greater child.\n");
-        auto **greater_parameters = new double *[greater_count];
-        auto *greater_labels = new int[greater_count];
-        size_t greater_index = 0;
-        for (size_t parent_index = 0; parent_index < count; parent_index++) {
-            if (parameters[parent_index][comparison_parameter] < comparison_threshold) continue;
-            greater_parameters[greater_index] = parameters[parent_index];
-            greater_labels[greater_index++] = labels[parent_index];
-        }
-        greater_branch = new DecisionTreeNode(parameter_count, label_count);
-        greater_branch->parent_branch = this;
-        greater_branch->fit(greater_parameters, greater_labels, greater_count, limit >= 0 ? limit - 1 : -1);
-        //printf("Done fitting greater child.\n");
-        delete[] greater_parameters;
-        delete[] greater_labels;
+        // only scan the smaller child. the parent's histogram minus the smaller child's is the larger child's, so it
+        // is turned into that in place.
+        size_t histogram_size = bin_offsets[parameter_count] * label_count;
+        if (lesser_count <= greater_count) {
+            build_histogram(bins, labels, weights, samples, lesser_count, bin_offsets, smaller_histogram);
+        } else {
+            build_histogram(bins, labels, weights, samples + lesser_count, greater_count, bin_offsets,
+                            smaller_histogram);
+        }
+        for (size_t i = 0; i < histogram_size; ++i) {
+            histogram[i] -= smaller_histogram[i];
+        }
+        return lesser_count;
+    }
 
+    size_t DecisionTreeNode::find_best_bin_split(const FeatureBinner &binner, const size_t *bin_offsets,
+                                                 const size_t *histogram, size_t weight,
+                                                 const size_t *parent_label_counts, size_t *lesser_label_counts,
+                                                 size_t *greater_label_counts, size_t &split_parameter,
+                                                 size_t &split_bin) const {
+        double parent_entropy = calculate_entropy_from_counts(parent_label_counts, weight);
+
+        // same scoring and tie-breaking as find_best_split, but only thresholds between bins are tried.
+        double best_score = -std::numeric_limits<double>::infinity();
+        size_t best_lesser_weight = 0;
+        split_parameter = 0;
+        split_bin = 0;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (int k = 0; k < label_count; ++k) {
+                lesser_label_counts[k] = 0;
+                greater_label_counts[k] = parent_label_counts[k];
+            }
+
+            double parameter_best_score = -std::numeric_limits<double>::infinity();
+            size_t parameter_best_bin = 0;
+            size_t parameter_best_lesser_weight = 0;
+            size_t lesser_weight = 0;
+            size_t bin_count = binner.get_bin_count(i);
+            for (size_t j = 0; j + 1 < bin_count; ++j) {
+                const size_t *bin_label_counts = histogram + (bin_offsets[i] + j) * label_count;
+                size_t bin_total = 0;
+                for (int k = 0; k < label_count; ++k) {
+                    lesser_label_counts[k] += bin_label_counts[k];
+                    greater_label_counts[k] -= bin_label_counts[k];
+                    bin_total += bin_label_counts[k];
+                }
+                // empty bins can't change the split, so there's no point scoring them again.
+                if (bin_total == 0) continue;
+                lesser_weight += bin_total;
+                if (lesser_weight == weight) break;
+
+                PICO_DT_FIT_STATS(++fit_counters.candidates;)
+                double lesser_entropy = calculate_entropy_from_counts(lesser_label_counts, lesser_weight);
+                double greater_entropy = calculate_entropy_from_counts(greater_label_counts, weight - lesser_weight);
+                double score = parent_entropy - ((lesser_entropy + greater_entropy) / 2);
+                if (score > parameter_best_score) {
+                    parameter_best_score = score;
+                    parameter_best_bin = j;
+                    parameter_best_lesser_weight = lesser_weight;
+                }
+            }
+
+            if (parameter_best_lesser_weight > 0 && parameter_best_score >= best_score) {
+                best_score = parameter_best_score;
+                best_lesser_weight = parameter_best_lesser_weight;
+                split_parameter = i;
+                split_bin = parameter_best_bin;
+            }
+        }
+        return best_lesser_weight;
     }
 
-#pragma clang diagnostic pop
+    void DecisionTreeNode::build_histogram(uint16_t **bins, const int *labels, const size_t *weights,
+                                           const size_t *samples, size_t count, const size_t *bin_offsets,
+                                           size_t *histogram) const {
+        for (size_t i = 0; i < bin_offsets[parameter_count] * label_count; ++i) {
+            histogram[i] = 0;
+        }
+        for (size_t i = 0; i < parameter_count; ++i) {
+            const uint16_t *parameter_bins = bins[i];
+            size_t *parameter_histogram = histogram + bin_offsets[i] * label_count;
+            for (size_t j = 0; j < count; ++j) {
+                size_t sample = samples[j];
+                parameter_histogram[parameter_bins[sample] * (size_t) label_count + labels[sample]] +=
+                        weights != nullptr ? weights[sample] : 1;
+            }
+        }
+        PICO_DT_FIT_STATS(fit_counters.samples += count * parameter_count;)
+    }
+
+    double DecisionTreeNode::calculate_entropy_from_counts(const size_t *label_counts, size_t total_count) const {
+        double entropy = 0.0;
+        for (int i = 0; i < label_count; ++i) {  // run the summation
+            double p_i = (double) label_counts[i] / (double) total_count;
+            if (p_i == 0) continue;
+            entropy += p_i * log2(p_i);
+        }
+        return -entropy;
+    }
 
-    double DecisionTreeNode::calculate_entropy(const int *labels, size_t total_count) const {
+    double DecisionTreeNode::calculate_entropy(const int *labels, size_t count, const size_t *weights) const {
 
-        // count how many of each label there are.
+        // count how many of each label there are, by weight.
         auto *label_counts = new size_t[label_count];
         for (size_t i = 0; i < label_count; ++i) {
             label_counts[i] = 0;
         }
-        for (size_t i = 0; i < total_count; i++) {
+        size_t total_count = 0;
+        for (size_t i = 0; i < count; i++) {
             int label = labels[i];
-            ++label_counts[label];
+            size_t weight = weights != nullptr ? weights[i] : 1;
+            label_counts[label] += weight;
+            total_count += weight;
         }
 
         // calculate the entropy
@@ -201,8 +989,9 @@ namespace pico_dt {
     }
 
     double
-    DecisionTreeNode::calculate_information_gain(double **parameters, const int *labels, size_t total_count,
-                                                 size_t split_parameter, double split_threshold) const {
+    DecisionTreeNode::calculate_information_gain(double **parameters, const int *labels, size_t count,
+                                                 size_t split_parameter, double split_threshold,
+                                                 const size_t *weights) const {
         // count how many of each label there are.
         auto *parent_label_counts = new size_t[label_count];
         auto *lesser_child_label_counts = new size_t[label_count];
@@ -214,19 +1003,22 @@ namespace pico_dt {
         }
         double lesser_child_split_count = 0;
         double greater_child_split_count = 0;
-        for (size_t i = 0; i < total_count; i++) {
+        size_t total_count = 0;
+        for (size_t i = 0; i < count; i++) {
+            size_t weight = weights != nullptr ? weights[i] : 1;
 
             //add to the total label count (parent entropy)
             int label = labels[i];
-            ++parent_label_counts[label];
+            parent_label_counts[label] += weight;
+            total_count += weight;
 
             // add to the child label counts
             if (parameters[i][split_parameter] < split_threshold) {
-                ++lesser_child_label_counts[label];
-                ++lesser_child_split_count;
+                lesser_child_label_counts[label] += weight;
+                lesser_child_split_count += (double) weight;
             } else {
-                ++greater_child_label_counts[label];
-                ++greater_child_split_count;
+                greater_child_label_counts[label] += weight;
+                greater_child_split_count += (double) weight;
             }
         }
 
@@ -268,9 +1060,9 @@ namespace pico_dt {
         return parent_entropy - ((lesser_child_entropy + greater_child_entropy) / 2);
     }
 
-    int DecisionTreeNode::predict(const double *parameters) {
+    int DecisionTreeNode::predict(const double *parameters) const {
         if (lesser_branch == nullptr || greater_branch == nullptr) return default_value;
-        DecisionTreeNode *dtn;
+        const DecisionTreeNode *dtn;
         if (parameters[comparison_parameter] < comparison_threshold) dtn = lesser_branch;
         else dtn = greater_branch;
 
@@ -281,7 +1073,49 @@ namespace pico_dt {
         }
     }
 
-    DecisionTreeNode::DecisionTreeNode(size_t p_parameter_count, int p_label_count, int p_default_value) {
+#ifdef PICO_DT_ENABLE_FIT_STATS
+
+    void DecisionTreeNode::set_fit_stats_callback(FitStatsCallback callback, void *context) {
+        fit_stats_callback = callback;
+        fit_stats_context = context;
+    }
+
+#endif
+
+    bool DecisionTreeNode::is_leaf() const {
+        return lesser_branch == nullptr || greater_branch == nullptr;
+    }
+
+    size_t DecisionTreeNode::get_parameter_count() const {
+        return parameter_count;
+    }
+
+    int DecisionTreeNode::get_label_count() const {
+        return label_count;
+    }
+
+    int DecisionTreeNode::get_default_value() const {
+        return default_value;
+    }
+
+    size_t DecisionTreeNode::get_comparison_parameter() const {
+        return comparison_parameter;
+    }
+
+    double DecisionTreeNode::get_comparison_threshold() const {
+        return comparison_threshold;
+    }
+
+    const DecisionTreeNode *DecisionTreeNode::get_lesser_branch() const {
+        return lesser_branch;
+    }
+
+    const DecisionTreeNode *DecisionTreeNode::get_greater_branch() const {
+        return greater_branch;
+    }
+
+    DecisionTreeNode::DecisionTreeNode(size_t p_parameter_count, int p_label_count, int p_default_value,
+                                       TreeArena *p_arena) {
         //printf("Creating decision tree node %p with default value of %d\n", this, p_default_value);
         parameter_count = p_parameter_count;
         label_count = p_label_count;
@@ -291,11 +1125,17 @@ namespace pico_dt {
         parent_branch = nullptr;
         comparison_parameter = -1;
         comparison_threshold = -1.0;
+        arena = p_arena;
+        serialized_size.store(0, std::memory_order_relaxed);
+#ifdef PICO_DT_ENABLE_FIT_STATS
+        fit_stats_callback = nullptr;
+        fit_stats_context = nullptr;
+#endif
     }
 
     DecisionTreeNode::DecisionTreeNode(size_t p_parameter_count, int p_label_count, size_t p_comparison_parameter,
                                        double p_comparison_threshold, DecisionTreeNode *p_lesser_branch,
-                                       DecisionTreeNode *p_greater_branch) {
+                                       DecisionTreeNode *p_greater_branch, TreeArena *p_arena) {
         //printf("Creating decision tree node %p with comparison threshold of %lf on parameter %ld, pointing to %p and %p\n", this, p_comparison_threshold, p_comparison_parameter, p_lesser_branch, p_greater_branch);
         parameter_count = p_parameter_count;
         label_count = p_label_count;
@@ -306,72 +1146,169 @@ namespace pico_dt {
         greater_branch->parent_branch = this;
         comparison_parameter = p_comparison_parameter;
         comparison_threshold = p_comparison_threshold;
+        arena = p_arena;
+        serialized_size.store(0, std::memory_order_relaxed);
+#ifdef PICO_DT_ENABLE_FIT_STATS
+        fit_stats_callback = nullptr;
+        fit_stats_context = nullptr;
+#endif
     }
 
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "misc-no-recursion"
+    void DecisionTreeNode::forget_serialized_size() {
+        for (DecisionTreeNode *node = this; node != nullptr; node = node->parent_branch) {
+            node->serialized_size.store(0, std::memory_order_relaxed);
+        }
+    }
 
-    size_t DecisionTreeNode::calculate_serialized_size() {
-        if (lesser_branch == nullptr || greater_branch == nullptr) return 1 + sizeof(default_value);
-        return 1 + sizeof(comparison_parameter) + sizeof(comparison_threshold) +
-               lesser_branch->calculate_serialized_size() + greater_branch->calculate_serialized_size();
+    /// Visit every node of the tree below this one in the order they are serialized: children before their parent,
+    /// lesser before greater. Walks the parent links instead of recursing or keeping a stack. Stops as soon as visit
+    /// returns false.
+    template<typename Visit>
+    bool DecisionTreeNode::visit_serialized(Visit visit) const {
+        const DecisionTreeNode *next_node = this;
+        while (true) {
+            if (!next_node->is_leaf()) {
+                next_node = next_node->lesser_branch;
+                continue;
+            }
+            if (!visit(next_node)) return false;
+
+            while (next_node != this) {
+                if (next_node != next_node->parent_branch->greater_branch) {
+                    next_node = next_node->parent_branch->greater_branch;
+                    break;
+                }
+                next_node = next_node->parent_branch;
+                if (!visit(next_node)) return false;
+            }
+            if (next_node == this) return true;
+        }
     }
 
-#pragma clang diagnostic pop
+    size_t DecisionTreeNode::calculate_serialized_size() const {
+        size_t remembered_size = serialized_size.load(std::memory_order_relaxed);
+        if (remembered_size != 0) return remembered_size;
+        size_t size = 0;
+        visit_serialized([&size](const DecisionTreeNode *node) {
+            size += node->is_leaf() ? 1 + sizeof(node->default_value)
+                                    : 1 + sizeof(node->comparison_parameter) + sizeof(node->comparison_threshold);
+            return true;
+        });
+        serialized_size.store(size, std::memory_order_relaxed);
+        return size;
+    }
 
-    void DecisionTreeNode::serialize_leaf(uint8_t *location) {
+    void DecisionTreeNode::serialize_leaf(uint8_t *location) const {
         location[0] = PICO_DT_LEAF_FLAG;
         memcpy(location + 1, &default_value, sizeof(default_value));
     }
 
-    void DecisionTreeNode::serialize_branch(uint8_t *location) {
+    void DecisionTreeNode::serialize_branch(uint8_t *location) const {
         location[0] = PICO_DT_BRANCH_FLAG;
         memcpy(location + 1, &comparison_parameter, sizeof(comparison_parameter));
         memcpy(location + 1 + sizeof(comparison_parameter), &comparison_threshold, sizeof(comparison_threshold));
     }
 
     uint8_t *DecisionTreeNode::serialize() {
-        auto *buffer = new uint8_t[calculate_serialized_size()];
-        auto *buffer_location = buffer;
-        DecisionTreeNode *next_node = this;
-        while (true) {
-            //printf("DTN: %p, LN: %p, GN: %p\n", next_node, next_node->lesser_branch, next_node->greater_branch);
-            if (next_node->lesser_branch != nullptr || next_node->greater_branch != nullptr) {
-                next_node = next_node->lesser_branch;
-                continue;
-            }
+        size_t size = calculate_serialized_size();
+        auto *buffer = new uint8_t[size];
+        serialize_into(buffer, size);
+        return buffer;
+    }
 
-            //printf("Serialize leaf node: %p\n", next_node);
-            next_node->serialize_leaf(buffer_location);
-            buffer_location += 1 + sizeof(default_value);
+    size_t DecisionTreeNode::serialize_into(uint8_t *buffer, size_t capacity) {
+        size_t size = calculate_serialized_size();
+        if (capacity < size) return 0;
+        uint8_t *buffer_location = buffer;
+        visit_serialized([&buffer_location](const DecisionTreeNode *node) {
+            if (node->is_leaf()) {
+                node->serialize_leaf(buffer_location);
+                buffer_location += 1 + sizeof(node->default_value);
+            } else {
+                node->serialize_branch(buffer_location);
+                buffer_location += 1 + sizeof(node->comparison_parameter) + sizeof(node->comparison_threshold);
+            }
+            return true;
+        });
+        return size;
+    }
 
-            while (true) {
-                if (next_node->parent_branch == nullptr) break;
-                if (next_node != next_node->parent_branch->greater_branch) {
-                    next_node = next_node->parent_branch->greater_branch;
-                    break;
+    bool DecisionTreeNode::serialize_chunked(uint8_t *buffer, size_t capacity, SerializedChunkWriter writer,
+                                             void *context) {
+        if (capacity == 0) return false;
+        size_t used = 0;
+        uint8_t record[1 + sizeof(comparison_parameter) + sizeof(comparison_threshold)];
+        bool written = visit_serialized([&](const DecisionTreeNode *node) {
+            size_t length;
+            if (node->is_leaf()) {
+                node->serialize_leaf(record);
+                length = 1 + sizeof(node->default_value);
+            } else {
+                node->serialize_branch(record);
+                length = 1 + sizeof(node->comparison_parameter) + sizeof(node->comparison_threshold);
+            }
+            // nodes can straddle chunks, so that every chunk but the last is full.
+            for (size_t copied = 0; copied < length;) {
+                size_t part = length - copied < capacity - used ? length - copied : capacity - used;
+                memcpy(buffer + used, record + copied, part);
+                used += part;
+                copied += part;
+                if (used == capacity) {
+                    if (!writer(buffer, used, context)) return false;
+                    used = 0;
                 }
-                next_node = next_node->parent_branch;
-                //printf("Serialize branch node: %p\n", next_node);
-                next_node->serialize_branch(buffer_location);
-                buffer_location += 1 + sizeof(comparison_parameter) + sizeof(comparison_threshold);
             }
-            if (next_node->parent_branch == nullptr) break;
-        }
-
-        return buffer;
+            return true;
+        });
+        return written && (used == 0 || writer(buffer, used, context));
     }
 
     DecisionTreeNode::~DecisionTreeNode() {
-        delete lesser_branch;
-        delete greater_branch;
+        // arena nodes are only ever freed all at once, along with the arena.
+        if (arena != nullptr) return;
+
+        // free the subtree from a list of pending nodes, linked through parent_branch, instead of recursing, so deep
+        // trees can't overflow the stack. each node is cut off from its branches before it is deleted.
+        DecisionTreeNode *pending = nullptr;
+        DecisionTreeNode *branches[2] = {lesser_branch, greater_branch};
+        for (DecisionTreeNode *branch: branches) {
+            if (branch == nullptr) continue;
+            branch->parent_branch = pending;
+            pending = branch;
+        }
+        while (pending != nullptr) {
+            DecisionTreeNode *node = pending;
+            pending = node->parent_branch;
+            if (node->lesser_branch != nullptr) {
+                node->lesser_branch->parent_branch = pending;
+                pending = node->lesser_branch;
+            }
+            if (node->greater_branch != nullptr) {
+                node->greater_branch->parent_branch = pending;
+                pending = node->greater_branch;
+            }
+            node->lesser_branch = nullptr;
+            node->greater_branch = nullptr;
+            delete node;
+        }
     }
 
 #pragma clang diagnostic push
 #pragma ide diagnostic ignored "NullDereference"  // null dereferences are a know, and desired, effect.
 
     DecisionTreeNode *
-    deserialize_decision_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length) {
+    deserialize_decision_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length,
+                              TreeArena *arena) {
+        if (is_portable_tree(buffer, buffer_length)) {
+            DecisionTreeNode *tree = deserialize_portable_tree(buffer, buffer_length, arena);
+            if (tree != nullptr &&
+                (tree->get_parameter_count() != parameter_count || tree->get_label_count() != label_count)) {
+                if (arena == nullptr) delete tree;
+                return nullptr;
+            }
+            return tree;
+        }
+
         DecisionTreeNode *dt_stack = nullptr;
         for (size_t buffer_pointer = 0; buffer_pointer < buffer_length; ++buffer_pointer) {
             int default_value;
@@ -384,7 +1321,8 @@ namespace pico_dt {
                 case PICO_DT_LEAF_FLAG:
                     memcpy(&default_value, buffer + buffer_pointer + 1, sizeof(default_value));
                     buffer_pointer += sizeof(default_value);
-                    new_node = new DecisionTreeNode(parameter_count, label_count, default_value);
+                    new_node = create_decision_tree_node(arena, parameter_count, label_count, default_value);
+                    if (new_node == nullptr) return nullptr;
                     new_node->parent_branch = dt_stack;
                     dt_stack = new_node;
                     break;
@@ -397,9 +1335,9 @@ namespace pico_dt {
                     dt_stack = greater_branch->parent_branch;
                     lesser_branch = dt_stack;
                     dt_stack = lesser_branch->parent_branch;
-                    new_node = new DecisionTreeNode(parameter_count, label_count, comparison_parameter,
-                                                    comparison_threshold, lesser_branch,
-                                                    greater_branch);
+                    new_node = create_decision_tree_node(arena, parameter_count, label_count, comparison_parameter,
+                                                         comparison_threshold, lesser_branch, greater_branch);
+                    if (new_node == nullptr) return nullptr;
                     new_node->parent_branch = dt_stack;
                     dt_stack = new_node;
                     break;
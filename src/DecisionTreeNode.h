@@ -5,28 +5,65 @@
 #ifndef PICO_DT_DECISIONTREENODE_H
 #define PICO_DT_DECISIONTREENODE_H
 
+#include <atomic>
 #include <cstddef>
 #include <cstdint>
+#include <new>
+
+#include "Dataset.h"
+#include "FeatureBinner.h"
+#include "TreeArena.h"
+#include "TreeStats.h"
+#include "WorkStealingPool.h"
 
 #define PICO_DT_LEAF_FLAG 0xAA
 #define PICO_DT_BRANCH_FLAG 0xBB
 
+// nodes with fewer samples than this are fit on the thread that split them off, instead of being handed to the pool.
+#ifndef PICO_DT_PARALLEL_MIN_SAMPLES
+#define PICO_DT_PARALLEL_MIN_SAMPLES 1024
+#endif
+// how many pending nodes the fit stack grows by at a time.
+#ifndef PICO_DT_FIT_STACK_BLOCK
+#define PICO_DT_FIT_STACK_BLOCK 64
+#endif
+// nodes with at least this many samples search for their split on several threads.
+#ifndef PICO_DT_PARALLEL_SPLIT_MIN_SAMPLES
+#define PICO_DT_PARALLEL_SPLIT_MIN_SAMPLES 8192
+#endif
+// the fewest samples each thread gets when a node's split search is shared out.
+#ifndef PICO_DT_PARALLEL_SPLIT_MIN_CHUNK
+#define PICO_DT_PARALLEL_SPLIT_MIN_CHUNK 2048
+#endif
+
 //#define PICO_DT_LOW_USE_FEATURES
 
 namespace pico_dt {
 
+    /// Called by DecisionTreeNode::serialize_chunked with each chunk of the serialized tree, in order.
+    /// \param chunk The chunk's bytes. They are only valid until the writer returns.
+    /// \param length How many bytes the chunk has.
+    /// \param context Whatever was passed to serialize_chunked along with the writer.
+    /// \return Whether the chunk was written. Returning false stops serialization.
+    typedef bool (*SerializedChunkWriter)(const uint8_t *chunk, size_t length, void *context);
+
     class DecisionTreeNode {
     public:
         /// Create a new Decision Tree Node.
         /// \param p_parameter_count The number of parameters this decision tree node can handle.
         /// \param p_label_count The number of labels the decision tree might classify an item as.
-        DecisionTreeNode(size_t p_parameter_count, int p_label_count);
+        /// \param p_arena The arena fit allocates every node below this one, and all of its scratch space, from, or
+        /// nullptr to use the heap. Arena nodes are never freed one at a time, only all at once with the arena. Fitting
+        /// on one thread with an arena never touches the heap; with more, only the thread pool itself does.
+        DecisionTreeNode(size_t p_parameter_count, int p_label_count, TreeArena *p_arena = nullptr);
 
         /// Create a new Decision Tree Node. This is mainly for internal use deserializing.
         /// \param p_parameter_count The number of parameters this decision tree node can handle.
         /// \param p_label_count The number of labels the decision tree might classify an item as.
         /// \param p_default_value The default value to use for this node.
-        DecisionTreeNode(size_t p_parameter_count, int p_label_count, int p_default_value);
+        /// \param p_arena The arena this node was allocated from, or nullptr if it wasn't.
+        DecisionTreeNode(size_t p_parameter_count, int p_label_count, int p_default_value,
+                         TreeArena *p_arena = nullptr);
 
         /// Create a new Decision Tree Node. This is mainly for internal use deserializing.
         /// \param p_parameter_count The number of parameters the decision tree can handle.
@@ -35,26 +72,120 @@ namespace pico_dt {
         /// \param p_comparison_threshold The threshold this node should compare against.
         /// \param p_lesser_branch The node for parameters lesser than the test threshold.
         /// \param p_greater_branch The node for parameters greater than the test threshold.
+        /// \param p_arena The arena this node and its branches were allocated from, or nullptr if they weren't.
         DecisionTreeNode(size_t p_parameter_count, int p_label_count, size_t p_comparison_parameter,
                          double p_comparison_threshold, DecisionTreeNode *p_lesser_branch,
-                         DecisionTreeNode *p_greater_branch);
+                         DecisionTreeNode *p_greater_branch, TreeArena *p_arena = nullptr);
 
-        /// Fit a decision tree to a given set of parameters and labels. This is called recursively.
+        /// Fit a decision tree to a given set of parameters and labels. Each parameter is sorted once up front, then every
+        /// node finds its split with a single sweep over the sorted samples. Nodes are fit from an explicit stack, not by
+        /// recursion, and with more than one thread separate subtrees are fit in parallel, while big nodes near the root
+        /// share their split search out across threads. The tree is the same no matter how many threads are used.
         /// \param parameters An array of pointers pointing to arrays of parameters. Arrays of parameters must be parameter_count long.
         /// \param labels An array of labels, with one label for each parameter array given.
         /// \param count The length of both the parameter pointer array (parameters) and label array (labels).
-        void fit(double **parameters, int *labels, size_t count, int limit = -1);
+        /// \param limit The maximum depth of the tree below this node, or -1 for no limit.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit(double **parameters, int *labels, size_t count, int limit = -1, unsigned int thread_count = 1);
+
+        /// Fit a decision tree to a Dataset. The same as the other fit, which copies its samples into columns and
+        /// calls this, but without the copy. Weighted samples fit exactly as that many copies of them would, so a
+        /// Dataset from merge_duplicate_samples gives the same tree as the samples it was merged from.
+        /// \param data The samples and labels to fit to, with at least parameter_count parameters each.
+        /// \param limit The maximum depth of the tree below this node, or -1 for no limit.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit(const Dataset &data, int limit = -1, unsigned int thread_count = 1);
+
+        /// Fit a decision tree to some of a Dataset's samples, already sorted by every parameter, so that several trees
+        /// fit to different subsets (like the folds of a cross validation) can share a single sort. Gives the same tree
+        /// as fitting a Dataset of just those samples, kept in the same order.
+        /// \param data The samples and labels to pick from, with at least parameter_count parameters each.
+        /// \param sorted_samples For every parameter, an array of the indices of the samples to fit to, ordered by that
+        /// parameter's value, lowest first. Each array holds the same count samples. They are copied, not changed.
+        /// \param count How many samples to fit to.
+        /// \param limit The maximum depth of the tree below this node, or -1 for no limit.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit_presorted(const Dataset &data, const size_t *const *sorted_samples, size_t count, int limit = -1,
+                           unsigned int thread_count = 1);
+
+        /// Fit a decision tree to a given set of parameters and labels, only trying splits between bins. Each parameter
+        /// is quantized into at most max_bins bins once up front, and each node finds its split from per bin label
+        /// histograms. Only the smaller child of a split is rescanned; the larger child's histograms are the parent's
+        /// minus the smaller child's. The bin edges become the comparison thresholds, so the result is an ordinary tree.
+        /// Leaves that can't be made pure are given the most common label.
+        /// \param parameters An array of pointers pointing to arrays of parameters. Arrays of parameters must be parameter_count long.
+        /// \param labels An array of labels, with one label for each parameter array given.
+        /// \param count The length of both the parameter pointer array (parameters) and label array (labels).
+        /// \param max_bins The most bins any one parameter may be split into.
+        /// \param mode How the edges between bins are picked.
+        /// \param limit The maximum depth of the tree below this node, or -1 for no limit.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit_binned(double **parameters, int *labels, size_t count, size_t max_bins,
+                        BinningMode mode = BinningMode::quantile, int limit = -1, unsigned int thread_count = 1);
+
+        /// Fit a decision tree to a Dataset, only trying splits between bins. The same as the other fit_binned, which
+        /// copies its samples into columns and calls this, but without the copy. Weighted samples fit, and are
+        /// binned, exactly as that many copies of them would be.
+        /// \param data The samples and labels to fit to, with at least parameter_count parameters each.
+        /// \param max_bins The most bins any one parameter may be split into.
+        /// \param mode How the edges between bins are picked.
+        /// \param limit The maximum depth of the tree below this node, or -1 for no limit.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit_binned(const Dataset &data, size_t max_bins, BinningMode mode = BinningMode::quantile, int limit = -1,
+                        unsigned int thread_count = 1);
+
+#ifdef PICO_DT_ENABLE_FIT_STATS
+
+        /// Have fit and fit_binned, called on this node, report what fitting each depth of the tree took once they finish.
+        /// \param callback The function to call for each depth, or nullptr to stop reporting.
+        /// \param context Anything, passed along to the callback.
+        void set_fit_stats_callback(FitStatsCallback callback, void *context);
+
+#endif
 
         /// Predict a value given some parameters.
         /// \param parameters An array of parameters to use.
         /// \return The predicted valeue.
-        [[maybe_unused]] int predict(const double *parameters);
+        [[maybe_unused]] int predict(const double *parameters) const;
+
+        /// Check if this node is a leaf. Leaves always predict their default value.
+        /// \return True if this node has no branches.
+        bool is_leaf() const;
+
+        /// Get the number of parameters this node can handle.
+        /// \return The parameter count.
+        size_t get_parameter_count() const;
+
+        /// Get the number of labels this node might classify an item as.
+        /// \return The label count.
+        int get_label_count() const;
+
+        /// Get the value a leaf predicts.
+        /// \return The default value.
+        int get_default_value() const;
+
+        /// Get the parameter a branch compares by.
+        /// \return The comparison parameter.
+        size_t get_comparison_parameter() const;
+
+        /// Get the threshold a branch compares against. Parameters lesser than this go down the lesser branch.
+        /// \return The comparison threshold.
+        double get_comparison_threshold() const;
+
+        /// Get the node for parameters lesser than the comparison threshold.
+        /// \return The lesser branch, or nullptr for leaves.
+        const DecisionTreeNode *get_lesser_branch() const;
+
+        /// Get the node for parameters greater than or equal to the comparison threshold.
+        /// \return The greater branch, or nullptr for leaves.
+        const DecisionTreeNode *get_greater_branch() const;
 
         /// Calculate the entropy at this node. Mainly used internally. See https://en.wikipedia.org/wiki/Entropy_(information_theory)
         /// \param labels An array of labels present at this node.
         /// \param count The number of labels given.
+        /// \param weights How many samples each label stands for, or nullptr for 1 each.
         /// \return The entropy of this node.
-        double calculate_entropy(const int *labels, size_t count) const;
+        double calculate_entropy(const int *labels, size_t count, const size_t *weights = nullptr) const;
 
         /// Calculate the information gain at this node. Mainly used internally. See https://en.wikipedia.org/wiki/Information_gain_(decision_tree)
         /// \param parameters An array of pointers to arrays of doubles giving sets of input parameters.
@@ -62,20 +193,39 @@ namespace pico_dt {
         /// \param count The number of labels and parameters given.
         /// \param split_parameter Which parameter to split the data on.
         /// \param split_threshold What value to split the data at.
+        /// \param weights How many samples each set of parameters and label stands for, or nullptr for 1 each.
         /// \return The information gain of this node when split by the threshold.
         [[maybe_unused]] double
         calculate_information_gain(double **parameters, const int *labels, size_t count,
                                    size_t split_parameter,
-                                   double split_threshold) const;
+                                   double split_threshold, const size_t *weights = nullptr) const;
 
-        /// Calculate how large this decision tree will be once serialized.
+        /// Calculate how large this decision tree will be once serialized. The size is remembered, so until the tree
+        /// changes, asking again takes constant time. Any number of threads reading the same tree can ask at once.
         /// \return The final size of the serialized decision tree.
-        size_t calculate_serialized_size();
+        size_t calculate_serialized_size() const;
 
         /// Serialize the decision tree into raw bytes.
         /// \return A pointer to a buffer containing the serialized decision tree.
         uint8_t *serialize();
 
+        /// Serialize the decision tree into a buffer, without allocating anything.
+        /// \param buffer The buffer to serialize the tree into.
+        /// \param capacity The size of the buffer, in bytes.
+        /// \return How many bytes were written, which is calculate_serialized_size, or 0 if they wouldn't fit. Nothing is
+        /// written if they wouldn't.
+        size_t serialize_into(uint8_t *buffer, size_t capacity);
+
+        /// Serialize the decision tree a chunk at a time, through a buffer of any size, without allocating anything. So
+        /// a tree can be streamed to a file or to flash without ever holding all of its serialized bytes in memory.
+        /// Every chunk but the last fills the buffer, so with a buffer the size of a flash page, each chunk is a page.
+        /// \param buffer The buffer to collect each chunk in.
+        /// \param capacity The size of the buffer, in bytes. It can be smaller than a node.
+        /// \param writer Called with each chunk, in order.
+        /// \param context Anything, passed along to the writer.
+        /// \return Whether every chunk was written. False as soon as the writer fails, or if the buffer has no capacity.
+        bool serialize_chunked(uint8_t *buffer, size_t capacity, SerializedChunkWriter writer, void *context);
+
         ~ DecisionTreeNode();
 
 #ifdef PICO_DT_ENABLE_LOW_USE_FEATURES
@@ -109,6 +259,13 @@ namespace pico_dt {
 
         DecisionTreeNode *parent_branch;
     private:
+        // grows trees one leaf at a time, without fit.
+        friend class HoeffdingTree;
+        // compacts and prunes trained trees in place.
+        friend class TreeRewriter;
+        // diffs trees and replaces their subtrees in place.
+        friend class TreePatcher;
+
         size_t parameter_count;
 
         int label_count;
@@ -123,19 +280,102 @@ namespace pico_dt {
 
         DecisionTreeNode *greater_branch;
 
-        void serialize_leaf(uint8_t *location);
+        TreeArena *arena;
+
+        /// What calculate_serialized_size last gave, or 0 if the tree below has changed since. Atomic, so threads
+        /// reading the same tree can all fill it in; any of them stores the same size.
+        mutable std::atomic<size_t> serialized_size;
+
+#ifdef PICO_DT_ENABLE_FIT_STATS
+        FitStatsCallback fit_stats_callback;
+
+        void *fit_stats_context;
+#endif
+
+        struct SplitCandidate {
+            double score;
+            double threshold;
+            size_t lesser_count;
+        };
+
+        void fit_sorted(const Dataset &data, const size_t *const *presorted_samples, size_t count, int limit,
+                        unsigned int thread_count);
+
+        size_t fit_presorted_node(const Dataset &data, const int *labels, size_t **sorted_samples, size_t begin,
+                                  size_t count, int limit, size_t *partition_buffer, size_t *label_counts,
+                                  WorkStealingPool *pool);
+
+        size_t find_best_split(const Dataset &data, const int *labels, size_t **sorted_samples, size_t begin,
+                               size_t count, size_t weight, const size_t *parent_label_counts, size_t *lesser_label_counts,
+                               size_t *greater_label_counts, WorkStealingPool *pool, size_t &split_parameter,
+                               double &split_threshold) const;
+
+#ifdef PICO_DT_ENABLE_THREADS
+
+        void find_best_split_parallel(const Dataset &data, const int *labels, size_t **sorted_samples, size_t begin,
+                                      size_t count, const size_t *parent_label_counts, double parent_entropy,
+                                      WorkStealingPool *pool, SplitCandidate &best, size_t &split_parameter) const;
+
+#endif
+
+        void sweep_split_candidates(const Dataset &data, const int *labels, const size_t *column, size_t count,
+                                    size_t parameter, size_t run_begin, size_t run_end, double parent_entropy,
+                                    size_t *lesser_label_counts, size_t *greater_label_counts,
+                                    SplitCandidate &best) const;
+
+        struct HistogramPool;
+
+        size_t fit_histogram_node(const FeatureBinner &binner, uint16_t **bins, const int *labels,
+                                  const size_t *weights, size_t *samples, size_t count, const size_t *bin_offsets,
+                                  size_t *histogram, int limit, size_t *label_counts, HistogramPool &histograms,
+                                  size_t *&smaller_histogram);
+
+        size_t find_best_bin_split(const FeatureBinner &binner, const size_t *bin_offsets, const size_t *histogram,
+                                   size_t weight, const size_t *parent_label_counts, size_t *lesser_label_counts,
+                                   size_t *greater_label_counts, size_t &split_parameter, size_t &split_bin) const;
+
+        void build_histogram(uint16_t **bins, const int *labels, const size_t *weights, const size_t *samples,
+                             size_t count, const size_t *bin_offsets, size_t *histogram) const;
+
+        double calculate_entropy_from_counts(const size_t *label_counts, size_t total_count) const;
+
+        bool create_branches();
+
+        void forget_serialized_size();
+
+        template<typename Visit>
+        bool visit_serialized(Visit visit) const;
+
+        void serialize_leaf(uint8_t *location) const;
 
-        void serialize_branch(uint8_t *location);
+        void serialize_branch(uint8_t *location) const;
     };
 
-    /// Create a new decision tree from serialized data.
+    /// Create a new decision tree from serialized data. Reads both data from DecisionTreeNode::serialize and data from
+    /// serialize_portable_tree (see PortableFormat.h).
     /// \param parameter_count How many input parameters the tree will accept.
     /// \param label_count How many labels the tree will group samples into.
     /// \param buffer pointer to the serialized tree data.
     /// \param buffer_length length of the serialized data buffer.
-    /// \return A pointer to a new decision tree, made from the serialized data.
+    /// \param arena The arena to allocate every node from, or nullptr to use the heap. Trees from an arena must not be
+    /// deleted; they are freed with the arena.
+    /// \return A pointer to a new decision tree, made from the serialized data. For portable data, nullptr if it is
+    /// invalid or its counts don't match. nullptr if the arena fills up.
     DecisionTreeNode *
-    deserialize_decision_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length);
+    deserialize_decision_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length,
+                              TreeArena *arena = nullptr);
+
+    /// Create a new decision tree node, from an arena if there is one. Mainly used internally deserializing.
+    /// \param arena The arena to allocate the node from, or nullptr to use the heap.
+    /// \param arguments The arguments for the node's constructor, leaving out the arena.
+    /// \return The new node, or nullptr if the arena is full.
+    template<typename... Arguments>
+    DecisionTreeNode *create_decision_tree_node(TreeArena *arena, Arguments... arguments) {
+        if (arena == nullptr) return new DecisionTreeNode(arguments...);
+        void *memory = arena->allocate(sizeof(DecisionTreeNode), alignof(DecisionTreeNode));
+        if (memory == nullptr) return nullptr;
+        return new(memory) DecisionTreeNode(arguments..., arena);
+    }
 
 } // pico_dt
 
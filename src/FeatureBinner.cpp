@@ -0,0 +1,202 @@
+#include <algorithm>
+
+#include "FeatureBinner.h"
+
+namespace pico_dt {
+    template<typename T>
+    T *FeatureBinner::allocate(size_t count) {
+        if (arena == nullptr) return new T[count];
+        return arena->allocate_scratch_array<T>(count);
+    }
+
+    FeatureBinner::FeatureBinner(size_t p_parameter_count, size_t p_max_bins, BinningMode p_mode,
+                                 TreeArena *p_arena) {
+        parameter_count = p_parameter_count;
+        max_bins = p_max_bins < 1 ? 1 : (p_max_bins > PICO_DT_MAX_BINS ? PICO_DT_MAX_BINS : p_max_bins);
+        mode = p_mode;
+        arena = p_arena;
+        scratch_mark = arena != nullptr ? arena->get_scratch_mark() : 0;
+        thresholds = allocate<double *>(parameter_count);
+        threshold_counts = allocate<size_t>(parameter_count);
+        thresholds_mark = arena != nullptr ? arena->get_scratch_mark() : 0;
+        if (thresholds == nullptr || threshold_counts == nullptr) {
+            // the arena is full, so there's nowhere to keep any thresholds, and every parameter gets a single bin.
+            thresholds = nullptr;
+            threshold_counts = nullptr;
+            return;
+        }
+        for (size_t i = 0; i < parameter_count; ++i) {
+            thresholds[i] = nullptr;
+            threshold_counts[i] = 0;
+        }
+    }
+
+    void FeatureBinner::fit(double **parameters, size_t count) {
+        clear();
+        if (count == 0) return;
+
+        // with an arena, every parameter's thresholds come before the values, so the values can be released first.
+        if (!allocate_thresholds()) return;
+        size_t values_mark = arena != nullptr ? arena->get_scratch_mark() : 0;
+        auto *values = allocate<double>(count);
+        if (values == nullptr) {
+            clear();
+            return;
+        }
+        for (size_t i = 0; i < parameter_count; ++i) {
+            for (size_t j = 0; j < count; ++j) {
+                values[j] = parameters[j][i];
+            }
+            fit_parameter(i, values, nullptr, count);
+        }
+        if (arena == nullptr) delete[] values;
+        else arena->release_scratch(values_mark);
+    }
+
+    void FeatureBinner::fit(const Dataset &data) {
+        clear();
+        size_t count = data.get_count();
+        if (count == 0) return;
+
+        if (!allocate_thresholds()) return;
+        size_t values_mark = arena != nullptr ? arena->get_scratch_mark() : 0;
+        auto *values = allocate<double>(count);
+        bool weighted = data.get_weights() != nullptr;
+        size_t *order = weighted ? allocate<size_t>(count) : nullptr;
+        size_t *ends = weighted ? allocate<size_t>(count) : nullptr;
+        if (values == nullptr || (weighted && (order == nullptr || ends == nullptr))) {
+            // only an arena can run out.
+            arena->release_scratch(values_mark);
+            clear();
+            return;
+        }
+        for (size_t i = 0; i < parameter_count; ++i) {
+            const double *column = data.get_column(i);
+            if (!weighted) {
+                for (size_t j = 0; j < count; ++j) {
+                    values[j] = column[j];
+                }
+                fit_parameter(i, values, nullptr, count);
+                continue;
+            }
+
+            // weighted samples are sorted along with their weights, so the edges land where they would among copies.
+            for (size_t j = 0; j < count; ++j) {
+                order[j] = j;
+            }
+            std::sort(order, order + count, [column](size_t a, size_t b) {
+                return column[a] < column[b];
+            });
+            size_t end = 0;
+            for (size_t j = 0; j < count; ++j) {
+                values[j] = column[order[j]];
+                end += data.get_weight(order[j]);
+                ends[j] = end;
+            }
+            fit_parameter(i, values, ends, count);
+        }
+        if (arena == nullptr) {
+            delete[] values;
+            delete[] order;
+            delete[] ends;
+        } else {
+            arena->release_scratch(values_mark);
+        }
+    }
+
+    bool FeatureBinner::allocate_thresholds() {
+        if (thresholds == nullptr) return false;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            thresholds[i] = allocate<double>(max_bins);
+            if (thresholds[i] == nullptr) {
+                // only an arena can run out.
+                clear();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void FeatureBinner::fit_parameter(size_t parameter, double *values, const size_t *ends, size_t count) {
+        if (ends == nullptr) std::sort(values, values + count);
+
+        // positions count copies of weighted values, as if every copy were there. value_at gives the value at a
+        // position, and position_of the position a value starts at.
+        size_t total = ends != nullptr ? ends[count - 1] : count;
+        auto value_at = [values, ends, count](size_t position) {
+            if (ends == nullptr) return values[position];
+            return values[std::upper_bound(ends, ends + count, position) - ends];
+        };
+        auto position_of = [ends](size_t index) -> size_t {
+            if (ends == nullptr) return index;
+            return index == 0 ? 0 : ends[index - 1];
+        };
+
+        // thresholds are only ever added in increasing order, and only when they leave samples on both sides.
+        size_t threshold_count = 0;
+        auto add_threshold = [&](double threshold) {
+            if (threshold <= values[0] || threshold > values[count - 1]) return;
+            if (threshold_count > 0 && threshold <= thresholds[parameter][threshold_count - 1]) return;
+            thresholds[parameter][threshold_count++] = threshold;
+        };
+
+        if (mode == BinningMode::fixed_width) {
+            double width = (values[count - 1] - values[0]) / (double) max_bins;
+            for (size_t k = 1; k < max_bins; ++k) {
+                add_threshold(values[0] + width * (double) k);
+            }
+        } else {
+            for (size_t k = 1; k < max_bins; ++k) {
+                // going to use the midpoints between values, like fit does. a cut landing inside a run of equal
+                // values is moved to the start of the run, or to its end if the run starts at the smallest value.
+                size_t position = k * total / max_bins;
+                if (position == 0) continue;
+                if (value_at(position - 1) == value_at(position)) {
+                    position = position_of(std::lower_bound(values, values + count, value_at(position)) - values);
+                    if (position == 0) {
+                        position = position_of(std::upper_bound(values, values + count, values[0]) - values);
+                    }
+                    if (position == total) continue;
+                }
+                add_threshold((value_at(position - 1) + value_at(position)) / 2);
+            }
+        }
+        threshold_counts[parameter] = threshold_count;
+    }
+
+    uint16_t FeatureBinner::bin(size_t parameter, double value) const {
+        if (thresholds == nullptr) return 0;
+        const double *parameter_thresholds = thresholds[parameter];
+        return (uint16_t) (std::upper_bound(parameter_thresholds, parameter_thresholds + threshold_counts[parameter],
+                                            value) - parameter_thresholds);
+    }
+
+    size_t FeatureBinner::get_bin_count(size_t parameter) const {
+        return threshold_counts != nullptr ? threshold_counts[parameter] + 1 : 1;
+    }
+
+    double FeatureBinner::get_threshold(size_t parameter, size_t index) const {
+        return thresholds[parameter][index];
+    }
+
+    void FeatureBinner::clear() {
+        if (thresholds == nullptr) return;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            if (arena == nullptr) delete[] thresholds[i];
+            thresholds[i] = nullptr;
+            threshold_counts[i] = 0;
+        }
+        // every parameter's thresholds sit right after the two arrays the constructor took.
+        if (arena != nullptr) arena->release_scratch(thresholds_mark);
+    }
+
+    FeatureBinner::~FeatureBinner() {
+        clear();
+        if (arena != nullptr) {
+            arena->release_scratch(scratch_mark);
+            return;
+        }
+        delete[] thresholds;
+        delete[] threshold_counts;
+    }
+} // pico_dt
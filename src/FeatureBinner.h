@@ -0,0 +1,96 @@
+#ifndef PICO_DT_FEATUREBINNER_H
+#define PICO_DT_FEATUREBINNER_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Dataset.h"
+#include "TreeArena.h"
+
+#define PICO_DT_MAX_BINS 65536
+
+namespace pico_dt {
+
+    /// How a FeatureBinner picks the edges between bins.
+    enum class BinningMode {
+        /// Bins hold roughly the same number of samples each. Edges sit halfway between neighbouring sample values.
+        quantile,
+        /// Bins split the range between the smallest and largest sample values into equal widths.
+        fixed_width
+    };
+
+    class FeatureBinner {
+    public:
+        /// Create a new Feature Binner.
+        /// \param p_parameter_count The number of parameters each sample has.
+        /// \param p_max_bins The most bins any one parameter may be split into. Clamped to PICO_DT_MAX_BINS.
+        /// \param p_mode How the edges between bins are picked.
+        /// \param p_arena The arena to take every array from, as scratch space released when the binner goes away, or
+        /// nullptr to use the heap. Nothing else may be allocated from the arena's scratch space and kept after the
+        /// binner goes away. If the arena fills up, parameters get a single bin.
+        FeatureBinner(size_t p_parameter_count, size_t p_max_bins, BinningMode p_mode, TreeArena *p_arena = nullptr);
+
+        /// Pick the bin edges of every parameter from a set of samples.
+        /// \param parameters An array of pointers pointing to arrays of parameters. Arrays of parameters must be parameter_count long.
+        /// \param count The length of the parameter pointer array (parameters).
+        void fit(double **parameters, size_t count);
+
+        /// Pick the bin edges of every parameter from a Dataset. Weighted samples count as that many copies.
+        /// \param data The samples to pick the edges from.
+        void fit(const Dataset &data);
+
+        /// Find which bin a parameter value falls in. A value lands in bin b when it is lesser than threshold b and not
+        /// lesser than threshold b - 1, so "bin <= b" is the same test as "value < threshold b".
+        /// \param parameter Which parameter the value belongs to.
+        /// \param value The value to bin.
+        /// \return The bin the value falls in.
+        uint16_t bin(size_t parameter, double value) const;
+
+        /// Get how many bins a parameter was split into. This is always one more than the number of thresholds.
+        /// \param parameter Which parameter to check.
+        /// \return The number of bins.
+        size_t get_bin_count(size_t parameter) const;
+
+        /// Get the threshold between two neighbouring bins.
+        /// \param parameter Which parameter to check.
+        /// \param index Which threshold to get, from 0 to get_bin_count(parameter) - 2.
+        /// \return The threshold between bin index and bin index + 1.
+        double get_threshold(size_t parameter, size_t index) const;
+
+        FeatureBinner(const FeatureBinner &) = delete;
+
+        FeatureBinner &operator=(const FeatureBinner &) = delete;
+
+        ~ FeatureBinner();
+
+    private:
+        size_t parameter_count;
+
+        size_t max_bins;
+
+        BinningMode mode;
+
+        TreeArena *arena;
+
+        /// The arena's scratch marks from before anything was allocated, and from before any thresholds were.
+        size_t scratch_mark;
+
+        size_t thresholds_mark;
+
+        double **thresholds;
+
+        size_t *threshold_counts;
+
+        void fit_parameter(size_t parameter, double *values, const size_t *ends, size_t count);
+
+        bool allocate_thresholds();
+
+        template<typename T>
+        T *allocate(size_t count);
+
+        void clear();
+    };
+
+} // pico_dt
+
+#endif //PICO_DT_FEATUREBINNER_H
@@ -0,0 +1,490 @@
+#include <cstring>
+
+#include "FlatTree.h"
+
+#if !defined(PICO_DT_DISABLE_SIMD) && defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define PICO_DT_X86_SIMD
+#include <immintrin.h>
+#endif
+
+// the first bytes of a mapped tree. Serialized trees always start with PICO_DT_LEAF_FLAG instead.
+#define PICO_DT_MAPPED_MAGIC "PDTM"
+// written in the processor's byte ordering, so a processor with another ordering reads it differently.
+#define PICO_DT_MAPPED_BYTE_ORDER 0x01020304
+
+namespace pico_dt {
+    namespace {
+        /// The start of a mapped tree. The nodes follow straight after, and the size keeps them 8 byte aligned.
+        struct MappedTreeHeader {
+            char magic[4];
+            uint32_t byte_order;
+            uint32_t parameter_count;
+            int32_t label_count;
+            uint64_t node_count;
+            uint64_t reserved;
+        };
+
+        static_assert(sizeof(MappedTreeHeader) % alignof(FlatNode) == 0, "mapped nodes should stay aligned");
+
+        /// Lay out a tree into flat nodes, depth first, giving every branch's children a pair of neighbouring slots.
+        /// Node is any handle get_branches can open up into its two children; it returns false for leaves, and fills in
+        /// the branch or leaf part of the flat node either way. first_branch picks which of a branch's two children
+        /// (0 for lesser, 1 for greater) has its subtree laid out first, right after the pair.
+        template<typename Node, typename GetBranches, typename FirstBranch>
+        void lay_out_flat_nodes(Node root, size_t node_count, FlatNode *nodes, GetBranches get_branches,
+                                FirstBranch first_branch) {
+            struct PendingNode {
+                Node node;
+                size_t index;
+            };
+            // depth first, so there can never be more pending nodes than there are nodes.
+            auto *stack = new PendingNode[node_count];
+            size_t stack_size = 0;
+            size_t next_index = 1;
+            stack[stack_size++] = {root, 0};
+            while (stack_size > 0) {
+                PendingNode pending = stack[--stack_size];
+                Node branches[2];
+                FlatNode &flat_node = nodes[pending.index];
+                if (!get_branches(pending.node, branches, flat_node)) continue;
+                flat_node.child = (int32_t) next_index;
+                int first = first_branch(pending.node, branches);
+                stack[stack_size++] = {branches[1 - first], next_index + 1 - first};
+                stack[stack_size++] = {branches[first], next_index + first};
+                next_index += 2;
+            }
+            delete[] stack;
+        }
+
+        /// Lay out a tree into flat nodes, depth first with the lesser side first.
+        template<typename Node, typename GetBranches>
+        void lay_out_flat_nodes(Node root, size_t node_count, FlatNode *nodes, GetBranches get_branches) {
+            lay_out_flat_nodes(root, node_count, nodes, get_branches, [](Node, const Node *) { return 0; });
+        }
+
+        /// Walk a group of samples down the tree together, one level per pass, so the loads for different samples
+        /// overlap instead of each waiting on the last.
+        void predict_lanes(const FlatNode *nodes, const double *samples, size_t count, size_t sample_stride,
+                           size_t parameter_stride, int *out) {
+            size_t indices[PICO_DT_BATCH_LANES];
+            for (size_t start = 0; start < count; start += PICO_DT_BATCH_LANES) {
+                size_t lanes = count - start < PICO_DT_BATCH_LANES ? count - start : PICO_DT_BATCH_LANES;
+                const double *lane_samples = samples + start * sample_stride;
+                for (size_t i = 0; i < lanes; ++i) {
+                    indices[i] = 0;
+                }
+                bool walking = true;
+                while (walking) {
+                    walking = false;
+                    for (size_t i = 0; i < lanes; ++i) {
+                        const FlatNode &node = nodes[indices[i]];
+                        if (node.child < 0) continue;
+                        double value = lane_samples[i * sample_stride + node.parameter * parameter_stride];
+                        indices[i] = node.child + !(value < node.threshold);
+                        walking = true;
+                    }
+                }
+                for (size_t i = 0; i < lanes; ++i) {
+                    out[start + i] = ~nodes[indices[i]].child;
+                }
+            }
+        }
+
+#ifdef PICO_DT_X86_SIMD
+
+        // Each lane holds a node index. The threshold is gathered from the first 8 bytes of the node, and the
+        // parameter and child together from the second 8, with the child in the top half. That makes the whole 64 bit
+        // value negative exactly when the node is a leaf. A single vector spends most of its time waiting on its
+        // gathers, so PICO_DT_SIMD_GROUPS vectors are walked together to keep several gathers in flight.
+
+        __attribute__((target("avx2")))
+        size_t predict_avx2(const FlatNode *nodes, const double *samples, size_t count, size_t sample_stride,
+                            size_t parameter_stride, int *out) {
+            const auto *node_words = reinterpret_cast<const long long *>(nodes);
+            const auto *node_thresholds = reinterpret_cast<const double *>(nodes);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i one = _mm256_set1_epi64x(1);
+            const __m256i low_half = _mm256_set1_epi64x(0xFFFFFFFF);
+            const __m256i stride = _mm256_set1_epi64x((long long) parameter_stride);
+            const __m256i lane_offsets = _mm256_set_epi64x(3 * (long long) sample_stride, 2 * (long long) sample_stride,
+                                                           (long long) sample_stride, 0);
+            __m256i indices[PICO_DT_SIMD_GROUPS];
+            __m256i words[PICO_DT_SIMD_GROUPS];
+            __m256i leaves[PICO_DT_SIMD_GROUPS];
+            size_t start = 0;
+            for (; start + 4 * PICO_DT_SIMD_GROUPS <= count; start += 4 * PICO_DT_SIMD_GROUPS) {
+                for (auto &group_indices : indices) {
+                    group_indices = zero;
+                }
+                while (true) {
+                    int all_leaves = 0xF;
+                    for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                        words[g] = _mm256_i64gather_epi64(node_words + 1, _mm256_add_epi64(indices[g], indices[g]), 8);
+                        leaves[g] = _mm256_cmpgt_epi64(zero, words[g]);
+                        all_leaves &= _mm256_movemask_pd(_mm256_castsi256_pd(leaves[g]));
+                    }
+                    if (all_leaves == 0xF) break;
+                    for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                        const double *lane_samples = samples + (start + 4 * g) * sample_stride;
+                        __m256d thresholds = _mm256_i64gather_pd(node_thresholds,
+                                                                 _mm256_add_epi64(indices[g], indices[g]), 8);
+                        // leaves have parameter 0, so their lanes still read from a real sample.
+                        __m256i parameters = _mm256_and_si256(words[g], low_half);
+                        __m256i offsets = _mm256_add_epi64(lane_offsets, _mm256_mul_epu32(parameters, stride));
+                        __m256d values = _mm256_i64gather_pd(lane_samples, offsets, 8);
+                        // lesser is all ones (-1) when the value is lesser, so child + 1 + lesser picks the right
+                        // child.
+                        __m256i lesser = _mm256_castpd_si256(_mm256_cmp_pd(values, thresholds, _CMP_LT_OQ));
+                        __m256i next = _mm256_add_epi64(_mm256_add_epi64(_mm256_srli_epi64(words[g], 32), one), lesser);
+                        indices[g] = _mm256_blendv_epi8(next, indices[g], leaves[g]);
+                    }
+                }
+                for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                    __m256i children = _mm256_srli_epi64(words[g], 32);
+                    out[start + 4 * g] = ~(int32_t) _mm256_extract_epi64(children, 0);
+                    out[start + 4 * g + 1] = ~(int32_t) _mm256_extract_epi64(children, 1);
+                    out[start + 4 * g + 2] = ~(int32_t) _mm256_extract_epi64(children, 2);
+                    out[start + 4 * g + 3] = ~(int32_t) _mm256_extract_epi64(children, 3);
+                }
+            }
+            return start;
+        }
+
+        __attribute__((target("avx512f")))
+        size_t predict_avx512(const FlatNode *nodes, const double *samples, size_t count, size_t sample_stride,
+                              size_t parameter_stride, int *out) {
+            const auto *node_words = reinterpret_cast<const long long *>(nodes);
+            // every lane is used, but through the masked forms of any intrinsic whose unmasked form passes an
+            // undefined operand through, which GCC warns about.
+            const __mmask8 all_lanes = 0xFF;
+            const __m512i zero = _mm512_setzero_si512();
+            const __m512d zero_values = _mm512_setzero_pd();
+            const __m512i one = _mm512_set1_epi64(1);
+            const __m512i low_half = _mm512_set1_epi64(0xFFFFFFFF);
+            const __m512i stride = _mm512_set1_epi64((long long) parameter_stride);
+            const __m512i lane_offsets = _mm512_maskz_mul_epu32(all_lanes, _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0),
+                                                                _mm512_set1_epi64((long long) sample_stride));
+            __m512i indices[PICO_DT_SIMD_GROUPS];
+            __m512i words[PICO_DT_SIMD_GROUPS];
+            __mmask8 branches[PICO_DT_SIMD_GROUPS];
+            size_t start = 0;
+            for (; start + 8 * PICO_DT_SIMD_GROUPS <= count; start += 8 * PICO_DT_SIMD_GROUPS) {
+                for (auto &group_indices : indices) {
+                    group_indices = zero;
+                }
+                while (true) {
+                    int any_branches = 0;
+                    for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                        __m512i node_offsets = _mm512_add_epi64(indices[g], indices[g]);
+                        words[g] = _mm512_mask_i64gather_epi64(zero, all_lanes, node_offsets, node_words + 1, 8);
+                        branches[g] = _mm512_cmpge_epi64_mask(words[g], zero);
+                        any_branches |= branches[g];
+                    }
+                    if (any_branches == 0) break;
+                    for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                        const double *lane_samples = samples + (start + 8 * g) * sample_stride;
+                        __m512i node_offsets = _mm512_add_epi64(indices[g], indices[g]);
+                        __m512d thresholds = _mm512_mask_i64gather_pd(zero_values, all_lanes, node_offsets, nodes, 8);
+                        __m512i parameters = _mm512_and_si512(words[g], low_half);
+                        __m512i offsets = _mm512_add_epi64(lane_offsets,
+                                                           _mm512_maskz_mul_epu32(all_lanes, parameters, stride));
+                        __m512d values = _mm512_mask_i64gather_pd(zero_values, all_lanes, offsets, lane_samples, 8);
+                        __mmask8 lesser = _mm512_cmp_pd_mask(values, thresholds, _CMP_LT_OQ);
+                        __m512i next = _mm512_add_epi64(_mm512_maskz_srai_epi64(all_lanes, words[g], 32), one);
+                        next = _mm512_mask_sub_epi64(next, lesser, next, one);
+                        indices[g] = _mm512_mask_mov_epi64(indices[g], branches[g], next);
+                    }
+                }
+                for (int g = 0; g < PICO_DT_SIMD_GROUPS; ++g) {
+                    __m512i labels = _mm512_xor_si512(_mm512_maskz_srai_epi64(all_lanes, words[g], 32),
+                                                      _mm512_set1_epi64(-1));
+                    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + start + 8 * g),
+                                        _mm512_maskz_cvtepi64_epi32(all_lanes, labels));
+                }
+            }
+            return start;
+        }
+
+#endif
+    }
+
+    FlatTree::FlatTree(const DecisionTreeNode &tree) {
+        parameter_count = tree.get_parameter_count();
+        label_count = tree.get_label_count();
+
+        // count the nodes first, so the array only needs allocating once.
+        node_count = 0;
+        const DecisionTreeNode *node = &tree;
+        const DecisionTreeNode **stack = nullptr;
+        size_t stack_size = 0;
+        size_t stack_capacity = 0;
+        while (node != nullptr) {
+            ++node_count;
+            if (!node->is_leaf()) {
+                if (stack_size == stack_capacity) {
+                    stack_capacity = stack_capacity * 2 + 16;
+                    auto **bigger_stack = new const DecisionTreeNode *[stack_capacity];
+                    if (stack_size > 0) memcpy(bigger_stack, stack, stack_size * sizeof(*stack));
+                    delete[] stack;
+                    stack = bigger_stack;
+                }
+                stack[stack_size++] = node->get_greater_branch();
+                node = node->get_lesser_branch();
+                continue;
+            }
+            node = stack_size > 0 ? stack[--stack_size] : nullptr;
+        }
+        delete[] stack;
+
+        auto *flat_nodes = new FlatNode[node_count];
+        nodes = flat_nodes;
+        lay_out_flat_nodes(&tree, node_count, flat_nodes,
+                           [](const DecisionTreeNode *tree_node, const DecisionTreeNode **branches,
+                              FlatNode &flat_node) {
+                               if (tree_node->is_leaf()) {
+                                   flat_node = {0, 0, ~(int32_t) tree_node->get_default_value()};
+                                   return false;
+                               }
+                               flat_node.threshold = tree_node->get_comparison_threshold();
+                               flat_node.parameter = (uint32_t) tree_node->get_comparison_parameter();
+                               branches[0] = tree_node->get_lesser_branch();
+                               branches[1] = tree_node->get_greater_branch();
+                               return true;
+                           });
+    }
+
+    FlatTree::FlatTree(const FlatTreeView &tree, const size_t *visit_counts)
+            : FlatTreeView(tree.get_parameter_count(), tree.get_label_count(), tree.get_node_count(), nullptr) {
+        const FlatNode *tree_nodes = tree.get_nodes();
+        auto *flat_nodes = new FlatNode[node_count];
+        nodes = flat_nodes;
+        // ties go lesser first, like any other layout.
+        lay_out_flat_nodes((size_t) 0, node_count, flat_nodes,
+                           [tree_nodes](size_t index, size_t *branches, FlatNode &flat_node) {
+                               flat_node = tree_nodes[index];
+                               if (flat_node.child < 0) return false;
+                               branches[0] = (size_t) flat_node.child;
+                               branches[1] = (size_t) flat_node.child + 1;
+                               return true;
+                           },
+                           [visit_counts](size_t, const size_t *branches) {
+                               return visit_counts[branches[1]] > visit_counts[branches[0]] ? 1 : 0;
+                           });
+    }
+
+    FlatTree::FlatTree(size_t p_parameter_count, int p_label_count, size_t p_node_count, FlatNode *p_nodes)
+            : FlatTreeView(p_parameter_count, p_label_count, p_node_count, p_nodes) {
+    }
+
+    FlatTreeView::FlatTreeView() {
+        parameter_count = 0;
+        label_count = 0;
+        node_count = 0;
+        nodes = nullptr;
+    }
+
+    FlatTreeView::FlatTreeView(size_t p_parameter_count, int p_label_count, size_t p_node_count,
+                               const FlatNode *p_nodes) {
+        parameter_count = p_parameter_count;
+        label_count = p_label_count;
+        node_count = p_node_count;
+        nodes = p_nodes;
+    }
+
+    int FlatTreeView::predict(const double *parameters) const {
+        const FlatNode *node = nodes;
+        while (node->child >= 0) {
+            // lesser child when the parameter is lesser than the threshold, otherwise the greater child right after it.
+            node = nodes + node->child + !(parameters[node->parameter] < node->threshold);
+        }
+        return ~node->child;
+    }
+
+    void FlatTreeView::profile(const double *rows, size_t count, size_t stride, size_t *visit_counts) const {
+        for (size_t i = 0; i < count; ++i) {
+            const double *parameters = rows + i * stride;
+            size_t index = 0;
+            ++visit_counts[index];
+            while (nodes[index].child >= 0) {
+                index = nodes[index].child + !(parameters[nodes[index].parameter] < nodes[index].threshold);
+                ++visit_counts[index];
+            }
+        }
+    }
+
+    void FlatTreeView::predict_batch(const double *rows, size_t count, size_t stride, int *out) const {
+        predict_strided(rows, count, stride, 1, out);
+    }
+
+    void FlatTreeView::predict_batch_columns(const double *columns, size_t count, size_t stride, int *out) const {
+        predict_strided(columns, count, 1, stride, out);
+    }
+
+    void FlatTreeView::predict_strided(const double *samples, size_t count, size_t sample_stride,
+                                       size_t parameter_stride, int *out) const {
+        size_t done = 0;
+#ifdef PICO_DT_X86_SIMD
+        // the vector paths multiply parameter indices by the stride 32 bits at a time.
+        if (parameter_stride <= 0xFFFFFFFF && sample_stride <= 0xFFFFFFFF) {
+            if (__builtin_cpu_supports("avx512f")) {
+                done = predict_avx512(nodes, samples, count, sample_stride, parameter_stride, out);
+            } else if (__builtin_cpu_supports("avx2")) {
+                done = predict_avx2(nodes, samples, count, sample_stride, parameter_stride, out);
+            }
+        }
+#endif
+        predict_lanes(nodes, samples + done * sample_stride, count - done, sample_stride, parameter_stride,
+                      out + done);
+    }
+
+    size_t FlatTreeView::get_parameter_count() const {
+        return parameter_count;
+    }
+
+    int FlatTreeView::get_label_count() const {
+        return label_count;
+    }
+
+    size_t FlatTreeView::get_node_count() const {
+        return node_count;
+    }
+
+    const FlatNode *FlatTreeView::get_nodes() const {
+        return nodes;
+    }
+
+    bool FlatTreeView::is_well_formed() const {
+        if (node_count == 0) return false;
+        for (size_t i = 0; i < node_count; ++i) {
+            const FlatNode &node = nodes[i];
+            if (node.child < 0) {
+                // the vector paths of predict_batch still read a sample's parameter for lanes that reached a leaf.
+                if (~node.child >= label_count || node.parameter != 0) return false;
+                continue;
+            }
+            // children always come after their parent, so predict can't loop.
+            if ((size_t) node.child <= i || (size_t) node.child + 1 >= node_count) return false;
+            if (node.parameter >= parameter_count) return false;
+        }
+        return true;
+    }
+
+    size_t FlatTreeView::calculate_mapped_size() const {
+        return sizeof(MappedTreeHeader) + node_count * sizeof(FlatNode);
+    }
+
+    uint8_t *FlatTreeView::serialize_mapped() const {
+        auto *buffer = new uint8_t[calculate_mapped_size()];
+        MappedTreeHeader header{};
+        memcpy(header.magic, PICO_DT_MAPPED_MAGIC, sizeof(header.magic));
+        header.byte_order = PICO_DT_MAPPED_BYTE_ORDER;
+        header.parameter_count = (uint32_t) parameter_count;
+        header.label_count = label_count;
+        header.node_count = node_count;
+        memcpy(buffer, &header, sizeof(header));
+        memcpy(buffer + sizeof(header), nodes, node_count * sizeof(FlatNode));
+        return buffer;
+    }
+
+    FlatTree::~FlatTree() {
+        delete[] nodes;
+    }
+
+    FlatTree *
+    deserialize_flat_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length) {
+        // first pass: count the nodes and check the data is well formed. leaves store the bitwise not of their label,
+        // so a label out of range would turn a leaf into a branch, and a parameter out of range would be read past.
+        size_t node_count = 0;
+        size_t stack_size = 0;
+        for (size_t buffer_pointer = 0; buffer_pointer < buffer_length; ++buffer_pointer) {
+            switch (buffer[buffer_pointer]) {
+                case PICO_DT_LEAF_FLAG: {
+                    if (buffer_length - buffer_pointer <= sizeof(int)) return nullptr;
+                    int label;
+                    memcpy(&label, buffer + buffer_pointer + 1, sizeof(int));
+                    if (label < 0 || label >= label_count) return nullptr;
+                    buffer_pointer += sizeof(int);
+                    ++stack_size;
+                    break;
+                }
+                case PICO_DT_BRANCH_FLAG: {
+                    if (buffer_length - buffer_pointer <= sizeof(size_t) + sizeof(double)) return nullptr;
+                    size_t parameter;
+                    memcpy(&parameter, buffer + buffer_pointer + 1, sizeof(size_t));
+                    if (parameter >= parameter_count) return nullptr;
+                    buffer_pointer += sizeof(size_t) + sizeof(double);
+                    if (stack_size < 2) return nullptr;
+                    --stack_size;
+                    break;
+                }
+                default:
+                    return nullptr;
+            }
+            ++node_count;
+        }
+        if (stack_size != 1) return nullptr;
+
+        // second pass: rebuild the links between the nodes, in the order they were serialized. every node's children
+        // come before it, so a stack of unclaimed nodes is enough, just like deserialize_decision_tree.
+        struct PostfixNode {
+            double threshold;
+            size_t parameter;
+            int default_value;
+            size_t lesser_index;
+            size_t greater_index;
+        };
+        auto *postfix_nodes = new PostfixNode[node_count];
+        auto *index_stack = new size_t[node_count];
+        stack_size = 0;
+        size_t node_index = 0;
+        for (size_t buffer_pointer = 0; buffer_pointer < buffer_length; ++buffer_pointer, ++node_index) {
+            PostfixNode &postfix_node = postfix_nodes[node_index];
+            if (buffer[buffer_pointer] == PICO_DT_LEAF_FLAG) {
+                memcpy(&postfix_node.default_value, buffer + buffer_pointer + 1, sizeof(int));
+                buffer_pointer += sizeof(int);
+                postfix_node.lesser_index = node_count;
+            } else {
+                memcpy(&postfix_node.parameter, buffer + buffer_pointer + 1, sizeof(size_t));
+                buffer_pointer += sizeof(size_t);
+                memcpy(&postfix_node.threshold, buffer + buffer_pointer + 1, sizeof(double));
+                buffer_pointer += sizeof(double);
+                postfix_node.greater_index = index_stack[--stack_size];
+                postfix_node.lesser_index = index_stack[--stack_size];
+            }
+            index_stack[stack_size++] = node_index;
+        }
+        delete[] index_stack;
+
+        auto *nodes = new FlatNode[node_count];
+        lay_out_flat_nodes(node_count - 1, node_count, nodes,
+                           [postfix_nodes, node_count](size_t index, size_t *branches, FlatNode &flat_node) {
+                               const PostfixNode &postfix_node = postfix_nodes[index];
+                               if (postfix_node.lesser_index == node_count) {
+                                   flat_node = {0, 0, ~(int32_t) postfix_node.default_value};
+                                   return false;
+                               }
+                               flat_node.threshold = postfix_node.threshold;
+                               flat_node.parameter = (uint32_t) postfix_node.parameter;
+                               branches[0] = postfix_node.lesser_index;
+                               branches[1] = postfix_node.greater_index;
+                               return true;
+                           });
+        delete[] postfix_nodes;
+        return new FlatTree(parameter_count, label_count, node_count, nodes);
+    }
+
+    bool map_flat_tree(const uint8_t *buffer, size_t buffer_length, FlatTreeView &view) {
+        if (buffer_length < sizeof(MappedTreeHeader)) return false;
+        if (reinterpret_cast<uintptr_t>(buffer) % alignof(FlatNode) != 0) return false;
+        MappedTreeHeader header;
+        memcpy(&header, buffer, sizeof(header));
+        if (memcmp(header.magic, PICO_DT_MAPPED_MAGIC, sizeof(header.magic)) != 0) return false;
+        if (header.byte_order != PICO_DT_MAPPED_BYTE_ORDER) return false;
+        if (header.node_count == 0 || header.node_count > (buffer_length - sizeof(header)) / sizeof(FlatNode)) {
+            return false;
+        }
+        view = FlatTreeView(header.parameter_count, header.label_count, (size_t) header.node_count,
+                            reinterpret_cast<const FlatNode *>(buffer + sizeof(header)));
+        return true;
+    }
+} // pico_dt
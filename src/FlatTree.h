@@ -0,0 +1,180 @@
+#ifndef PICO_DT_FLATTREE_H
+#define PICO_DT_FLATTREE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DecisionTreeNode.h"
+
+// how many samples the portable batch prediction walks down the tree together.
+#ifndef PICO_DT_BATCH_LANES
+#define PICO_DT_BATCH_LANES 8
+#endif
+
+// how many vectors of samples the AVX2 and AVX-512 batch predictions walk down the tree together.
+#ifndef PICO_DT_SIMD_GROUPS
+#define PICO_DT_SIMD_GROUPS 4
+#endif
+
+//#define PICO_DT_DISABLE_SIMD
+
+namespace pico_dt {
+
+    /// One node of a FlatTree. Branches point at their lesser child, and the greater child always comes right after it,
+    /// so both children share a cache line. Leaves store the bitwise not of their label in child, which is negative for
+    /// every label (labels are never negative), so no separate leaf flag or null check is needed.
+    struct FlatNode {
+        double threshold;
+        uint32_t parameter;
+        int32_t child;
+    };
+
+    static_assert(sizeof(FlatNode) == 16, "FlatNode should pack into 16 bytes");
+
+    /// A read-only view of a compiled decision tree: an array of flat nodes it doesn't own, which can live anywhere,
+    /// like in flash, in a memory mapped file, or in a FlatTree. Views are cheap to copy, and never allocate. The
+    /// root is always node 0.
+    class FlatTreeView {
+    public:
+        /// Create an empty view, with no nodes. Don't predict with it.
+        FlatTreeView();
+
+        /// Create a view of an array of flat nodes.
+        /// \param p_parameter_count How many input parameters the tree will accept.
+        /// \param p_label_count How many labels the tree will group samples into.
+        /// \param p_node_count How many nodes there are.
+        /// \param p_nodes The nodes. They must outlive the view.
+        FlatTreeView(size_t p_parameter_count, int p_label_count, size_t p_node_count, const FlatNode *p_nodes);
+
+        /// Predict a value given some parameters. Gives exactly what DecisionTreeNode::predict gives.
+        /// \param parameters An array of parameters to use.
+        /// \return The predicted value.
+        int predict(const double *parameters) const;
+
+        /// Predict values for many samples stored one after another (row-major). Samples are walked down the tree
+        /// together in small groups, using AVX-512 or AVX2 gathers when the processor has them. Gives exactly what
+        /// predict gives for each sample.
+        /// \param rows Pointer to the parameters of the first sample.
+        /// \param count The number of samples.
+        /// \param stride How many doubles apart consecutive samples start. At least the parameter count.
+        /// \param out An array of count predictions to fill in.
+        void predict_batch(const double *rows, size_t count, size_t stride, int *out) const;
+
+        /// Predict values for many samples stored one parameter at a time (column-major). Otherwise the same as
+        /// predict_batch.
+        /// \param columns Pointer to the first parameter of the first sample.
+        /// \param count The number of samples.
+        /// \param stride How many doubles apart consecutive parameters start. At least count.
+        /// \param out An array of count predictions to fill in.
+        void predict_batch_columns(const double *columns, size_t count, size_t stride, int *out) const;
+
+        /// Count how many of some samples pass through each node, to lay out a FlatTree for samples like them. See the
+        /// FlatTree constructor that takes visit counts.
+        /// \param rows Pointer to the parameters of the first sample, stored one after another (row-major).
+        /// \param count The number of samples.
+        /// \param stride How many doubles apart consecutive samples start. At least the parameter count.
+        /// \param visit_counts An array of node_count counts, one for each node, which every sample passing through the
+        /// node adds one to. They aren't cleared first, so the counts from several calls add up.
+        void profile(const double *rows, size_t count, size_t stride, size_t *visit_counts) const;
+
+        /// Check every node, so a tree from an untrusted source can't make predict or predict_batch read outside of
+        /// it, or outside of the samples, or loop forever. map_flat_tree only checks the header, to load in constant
+        /// time.
+        /// \return Whether every child index is in range and after its parent, every parameter and label is in range,
+        /// and every leaf's parameter is 0.
+        bool is_well_formed() const;
+
+        /// Calculate the size of the mapped form of this tree, made by serialize_mapped.
+        /// \return The size, in bytes.
+        size_t calculate_mapped_size() const;
+
+        /// Serialize this tree into a form that map_flat_tree can predict with in place: a small header followed by the
+        /// nodes exactly as they are in memory. Like serialize, it uses the processor's byte ordering, so it is only
+        /// for processors with the same byte ordering, but map_flat_tree checks this instead of misreading it.
+        /// \return The serialized data, calculate_mapped_size bytes long.
+        uint8_t *serialize_mapped() const;
+
+        /// Get the number of parameters this tree can handle.
+        /// \return The parameter count.
+        size_t get_parameter_count() const;
+
+        /// Get the number of labels this tree might classify an item as.
+        /// \return The label count.
+        int get_label_count() const;
+
+        /// Get the number of nodes, branches and leaves both, in this tree.
+        /// \return The node count.
+        size_t get_node_count() const;
+
+        /// Get the nodes of this tree. The root is node 0.
+        /// \return A pointer to the first node.
+        const FlatNode *get_nodes() const;
+
+    protected:
+        size_t parameter_count;
+
+        int label_count;
+
+        size_t node_count;
+
+        const FlatNode *nodes;
+
+    private:
+        void predict_strided(const double *samples, size_t count, size_t sample_stride, size_t parameter_stride,
+                             int *out) const;
+    };
+
+    /// A read-only decision tree compiled into a single contiguous array of nodes, for fast prediction. Unlike
+    /// DecisionTreeNode, it keeps nothing that prediction doesn't need. It owns its nodes, and is a view of them.
+    class FlatTree : public FlatTreeView {
+    public:
+        /// Compile a decision tree into a Flat Tree.
+        /// \param tree The root of the decision tree to compile. It isn't needed afterwards.
+        explicit FlatTree(const DecisionTreeNode &tree);
+
+        /// Lay out a copy of a flat tree for the samples it was profiled with (see FlatTreeView::profile). Every branch's
+        /// children still sit side by side, but the subtree of whichever child more samples went to is laid out first,
+        /// straight after them. So the paths most samples take run through consecutive nodes, and touch as few cache
+        /// lines as they can. Every prediction stays the same.
+        /// \param tree The tree to copy. It isn't needed afterwards.
+        /// \param visit_counts How many samples passed through each of the tree's nodes.
+        FlatTree(const FlatTreeView &tree, const size_t *visit_counts);
+
+        FlatTree(const FlatTree &) = delete;
+
+        FlatTree &operator=(const FlatTree &) = delete;
+
+        ~ FlatTree();
+
+    private:
+        FlatTree(size_t p_parameter_count, int p_label_count, size_t p_node_count, FlatNode *p_nodes);
+
+        friend FlatTree *
+        deserialize_flat_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length);
+    };
+
+    /// Compile a Flat Tree straight from serialized data, without building a DecisionTreeNode tree first.
+    /// \param parameter_count How many input parameters the tree will accept.
+    /// \param label_count How many labels the tree will group samples into.
+    /// \param buffer pointer to the serialized tree data, as made by DecisionTreeNode::serialize.
+    /// \param buffer_length length of the serialized data buffer.
+    /// \return A pointer to a new Flat Tree, or nullptr if the data isn't a valid serialized tree, or any of its labels
+    /// or parameters is out of range.
+    FlatTree *
+    deserialize_flat_tree(size_t parameter_count, int label_count, const uint8_t *buffer, size_t buffer_length);
+
+    /// Predict straight from data made by FlatTreeView::serialize_mapped, without copying or allocating anything. This
+    /// takes the same time for any size of tree, as only the header is checked, so the data can be a memory mapped
+    /// file (shared by every process that maps it) or a region of flash. Use FlatTreeView::is_well_formed as well if
+    /// the data might not have come from serialize_mapped: a node with a parameter out of range, even a leaf, makes
+    /// predict_batch read outside of the samples.
+    /// \param buffer pointer to the mapped tree data. Must be aligned to 8 bytes, and outlive the view.
+    /// \param buffer_length length of the mapped tree data.
+    /// \param view The view to point at the tree's nodes.
+    /// \return Whether the data had a valid header, for a processor with this byte ordering. The view is only changed
+    /// if it did.
+    bool map_flat_tree(const uint8_t *buffer, size_t buffer_length, FlatTreeView &view);
+
+} // pico_dt
+
+#endif //PICO_DT_FLATTREE_H
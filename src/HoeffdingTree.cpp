@@ -0,0 +1,238 @@
+#include <cmath>
+#include <cstring>
+
+#include "HoeffdingTree.h"
+
+namespace pico_dt {
+    namespace {
+        // every slot starts with how many samples its leaf has seen, and how many since it last looked for a split.
+        const size_t seen_index = 0;
+        const size_t unchecked_index = 1;
+        const size_t header_size = 2;
+
+        double calculate_entropy_from_weights(const double *label_weights, int label_count, double total_weight) {
+            double entropy = 0.0;
+            for (int i = 0; i < label_count; ++i) {  // run the summation
+                double p_i = label_weights[i] / total_weight;
+                if (p_i <= 0) continue;
+                entropy += p_i * log2(p_i);
+            }
+            return -entropy;
+        }
+
+        int most_common_label(const double *label_weights, int label_count) {
+            int best_label = 0;
+            for (int i = 1; i < label_count; ++i) {
+                if (label_weights[i] > label_weights[best_label]) best_label = i;
+            }
+            return best_label;
+        }
+    }
+
+    HoeffdingTree::HoeffdingTree(size_t p_parameter_count, int p_label_count, size_t p_max_leaves, double p_delta,
+                                 size_t p_grace_period, double p_tie_threshold, size_t p_candidate_count) {
+        parameter_count = p_parameter_count;
+        label_count = p_label_count;
+        max_leaves = p_max_leaves < 1 ? 1 : p_max_leaves;
+        delta = p_delta;
+        grace_period = p_grace_period < 1 ? 1 : p_grace_period;
+        tie_threshold = p_tie_threshold;
+        candidate_count = p_candidate_count < 1 ? 1 : p_candidate_count;
+        sample_count = 0;
+        leaf_count = 1;
+        root = new DecisionTreeNode(parameter_count, label_count);
+        statistics = new double[max_leaves * slot_size()];
+        free_slots = new size_t[max_leaves];
+        for (size_t i = 0; i < max_leaves; ++i) {
+            free_slots[i] = max_leaves - 1 - i;
+        }
+        free_slot_count = max_leaves;
+        start_leaf(root, nullptr);
+    }
+
+    HoeffdingTree::~HoeffdingTree() {
+        delete root;
+        delete[] statistics;
+        delete[] free_slots;
+    }
+
+    size_t HoeffdingTree::slot_size() const {
+        // the header, then label weights (estimated from the parent at a split, plus every sample seen since) that
+        // pick the leaf's label, then the label counts actually seen, then every parameter's lowest and highest value,
+        // then every parameter's mean and sum of squared differences from the mean (as in Welford's algorithm) for
+        // each label.
+        return header_size + 2 * (size_t) label_count + 2 * parameter_count +
+               2 * parameter_count * (size_t) label_count;
+    }
+
+    void HoeffdingTree::start_leaf(DecisionTreeNode *leaf, const double *label_weights) {
+        leaf->default_value = label_weights != nullptr ? most_common_label(label_weights, label_count) : 0;
+        size_t slot_index = free_slots[--free_slot_count];
+        double *slot = statistics + slot_index * slot_size();
+        for (size_t i = 0; i < slot_size(); ++i) {
+            slot[i] = 0;
+        }
+        if (label_weights != nullptr) memcpy(slot + header_size, label_weights, label_count * sizeof(double));
+        leaf_slots[leaf] = slot_index;
+    }
+
+    void HoeffdingTree::learn(const double *parameters, int label) {
+        ++sample_count;
+        DecisionTreeNode *leaf = root;
+        while (!leaf->is_leaf()) {
+            leaf = parameters[leaf->comparison_parameter] < leaf->comparison_threshold ? leaf->lesser_branch
+                                                                                       : leaf->greater_branch;
+        }
+        double *slot = statistics + leaf_slots[leaf] * slot_size();
+        double *label_weights = slot + header_size;
+        double *label_counts = label_weights + label_count;
+        double *ranges = label_counts + label_count;
+        double *moments = ranges + 2 * parameter_count;
+
+        slot[seen_index] += 1;
+        slot[unchecked_index] += 1;
+        label_weights[label] += 1;
+        label_counts[label] += 1;
+        leaf->default_value = most_common_label(label_weights, label_count);
+        for (size_t i = 0; i < parameter_count; ++i) {
+            double value = parameters[i];
+            if (slot[seen_index] == 1 || value < ranges[2 * i]) ranges[2 * i] = value;
+            if (slot[seen_index] == 1 || value > ranges[2 * i + 1]) ranges[2 * i + 1] = value;
+            double *moment = moments + 2 * (i * label_count + label);
+            double difference = value - moment[0];
+            moment[0] += difference / label_counts[label];
+            moment[1] += difference * (value - moment[0]);
+        }
+
+        if (slot[unchecked_index] >= (double) grace_period) {
+            slot[unchecked_index] = 0;
+            try_split(leaf, slot);
+        }
+    }
+
+    double HoeffdingTree::find_best_threshold(const double *slot, size_t parameter, double parent_entropy,
+                                              double *weights, double &threshold, double *lesser_weights) const {
+        double seen = slot[seen_index];
+        const double *label_counts = slot + header_size + label_count;
+        const double *ranges = label_counts + label_count;
+        const double *moments = ranges + 2 * parameter_count;
+        double low = ranges[2 * parameter];
+        double high = ranges[2 * parameter + 1];
+        double *greater_weights = weights + label_count;
+        double best_gain = 0;
+        if (!(high > low)) return best_gain;
+
+        // estimate how many samples of each label fall below each threshold, assuming each label's values are normally
+        // distributed. information gain is weighted by how many samples go each way, as the Hoeffding bound is on
+        // information gain.
+        for (size_t k = 1; k <= candidate_count; ++k) {
+            double candidate = low + (high - low) * (double) k / (double) (candidate_count + 1);
+            double lesser_weight = 0;
+            for (int j = 0; j < label_count; ++j) {
+                const double *moment = moments + 2 * (parameter * label_count + j);
+                double count = label_counts[j];
+                if (count == 0) {
+                    weights[j] = 0;
+                } else {
+                    double deviation = sqrt(moment[1] / count);
+                    if (deviation == 0) weights[j] = moment[0] < candidate ? count : 0;
+                    else weights[j] = count * 0.5 * erfc((moment[0] - candidate) / (deviation * sqrt(2.0)));
+                }
+                greater_weights[j] = count - weights[j];
+                lesser_weight += weights[j];
+            }
+            double greater_weight = seen - lesser_weight;
+            if (lesser_weight <= 0 || greater_weight <= 0) continue;
+            double gain = parent_entropy -
+                          (lesser_weight / seen) * calculate_entropy_from_weights(weights, label_count, lesser_weight) -
+                          (greater_weight / seen) *
+                          calculate_entropy_from_weights(greater_weights, label_count, greater_weight);
+            if (gain > best_gain) {
+                best_gain = gain;
+                threshold = candidate;
+                memcpy(lesser_weights, weights, label_count * sizeof(double));
+            }
+        }
+        return best_gain;
+    }
+
+    void HoeffdingTree::try_split(DecisionTreeNode *leaf, double *slot) {
+        if (leaf_count >= max_leaves) return;
+        double seen = slot[seen_index];
+        const double *label_counts = slot + header_size + label_count;
+        for (int i = 0; i < label_count; ++i) {
+            // nothing to gain from a split if every sample had the same label.
+            if (label_counts[i] == seen) return;
+        }
+
+        // the best threshold of each parameter. the bound compares the best parameter with the next best.
+        double parent_entropy = calculate_entropy_from_weights(label_counts, label_count, seen);
+        auto *weights = new double[4 * (size_t) label_count];
+        double *lesser_weights = weights + 2 * label_count;
+        double *best_lesser_weights = weights + 3 * label_count;
+        double best_gain = 0;
+        double second_best_gain = 0;
+        size_t best_parameter = 0;
+        double best_threshold = 0;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            double threshold = 0;
+            double gain = find_best_threshold(slot, i, parent_entropy, weights, threshold, lesser_weights);
+            if (gain > best_gain) {
+                second_best_gain = best_gain;
+                best_gain = gain;
+                best_parameter = i;
+                best_threshold = threshold;
+                memcpy(best_lesser_weights, lesser_weights, label_count * sizeof(double));
+            } else if (gain > second_best_gain) {
+                second_best_gain = gain;
+            }
+        }
+
+        // the Hoeffding bound: with probability 1 - delta, the real gains are within epsilon of these estimates.
+        double range = log2((double) label_count);
+        double epsilon = sqrt(range * range * log(1 / delta) / (2 * seen));
+        if (best_gain <= 0 || (best_gain - second_best_gain <= epsilon && epsilon >= tie_threshold)) {
+            delete[] weights;
+            return;
+        }
+
+        // split. each child starts out weighing labels by how many of each were estimated to go its way.
+        double *best_greater_weights = weights;
+        for (int j = 0; j < label_count; ++j) {
+            best_greater_weights[j] = label_counts[j] - best_lesser_weights[j];
+        }
+        auto *lesser = new DecisionTreeNode(parameter_count, label_count);
+        auto *greater = new DecisionTreeNode(parameter_count, label_count);
+        leaf->comparison_parameter = best_parameter;
+        leaf->comparison_threshold = best_threshold;
+        leaf->lesser_branch = lesser;
+        lesser->parent_branch = leaf;
+        leaf->greater_branch = greater;
+        greater->parent_branch = leaf;
+        leaf->forget_serialized_size();
+        ++leaf_count;
+
+        auto found = leaf_slots.find(leaf);
+        free_slots[free_slot_count++] = found->second;
+        leaf_slots.erase(found);
+        start_leaf(lesser, best_lesser_weights);
+        start_leaf(greater, best_greater_weights);
+        delete[] weights;
+    }
+
+    int HoeffdingTree::predict(const double *parameters) {
+        return root->predict(parameters);
+    }
+
+    DecisionTreeNode &HoeffdingTree::get_tree() {
+        return *root;
+    }
+
+    size_t HoeffdingTree::get_leaf_count() const {
+        return leaf_count;
+    }
+
+    size_t HoeffdingTree::get_sample_count() const {
+        return sample_count;
+    }
+} // pico_dt
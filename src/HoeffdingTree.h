@@ -0,0 +1,108 @@
+#ifndef PICO_DT_HOEFFDINGTREE_H
+#define PICO_DT_HOEFFDINGTREE_H
+
+#include <cstddef>
+#include <unordered_map>
+
+#include "DecisionTreeNode.h"
+
+namespace pico_dt {
+
+    /// Learns a decision tree from a stream of samples, one at a time, without keeping any of them (a Hoeffding tree,
+    /// see https://en.wikipedia.org/wiki/Incremental_decision_tree#VFDT). Each growing leaf keeps only its label
+    /// counts, and for every parameter the range of its values and the mean and variance of its values for each label.
+    /// Every grace_period samples a leaf estimates the information gain of evenly spaced thresholds across each
+    /// parameter's range from those, and splits once the Hoeffding bound says the best parameter really is better than
+    /// the next best.
+    ///
+    /// Memory is bounded no matter how long the stream runs: the tree stops splitting at max_leaves leaves (so
+    /// 2 * max_leaves - 1 nodes), and the statistics for that many leaves are allocated up front. Once it stops, leaves
+    /// still keep their labels up to date. The tree is an ordinary DecisionTreeNode tree, which can be predicted with
+    /// and serialized at any time.
+    class HoeffdingTree {
+    public:
+        /// Create a new Hoeffding Tree, which starts out as a single leaf.
+        /// \param p_parameter_count The number of parameters each sample has.
+        /// \param p_label_count The number of labels a sample might have.
+        /// \param p_max_leaves The most leaves the tree may have.
+        /// \param p_delta The chance a split is wrong that the Hoeffding bound allows. Smaller waits for more samples.
+        /// \param p_grace_period How many samples a leaf takes between looking for a split.
+        /// \param p_tie_threshold Splits whose best two parameters are this close are made anyway, once the bound is
+        /// this small, since more samples would hardly tell them apart.
+        /// \param p_candidate_count How many evenly spaced thresholds to try across each parameter's range.
+        HoeffdingTree(size_t p_parameter_count, int p_label_count, size_t p_max_leaves = 64, double p_delta = 1e-6,
+                      size_t p_grace_period = 200, double p_tie_threshold = 0.05, size_t p_candidate_count = 16);
+
+        /// Learn from one more sample. It isn't kept.
+        /// \param parameters An array of parameter_count parameters.
+        /// \param label The sample's label.
+        void learn(const double *parameters, int label);
+
+        /// Predict a value given some parameters, with the tree learnt so far.
+        /// \param parameters An array of parameters to use.
+        /// \return The predicted value.
+        int predict(const double *parameters);
+
+        /// Get the tree learnt so far. It stays owned by this, and keeps changing as more samples are learnt.
+        /// \return The root of the tree.
+        DecisionTreeNode &get_tree();
+
+        /// Get the number of leaves the tree has.
+        /// \return The leaf count.
+        size_t get_leaf_count() const;
+
+        /// Get the number of samples learnt so far.
+        /// \return The sample count.
+        size_t get_sample_count() const;
+
+        HoeffdingTree(const HoeffdingTree &) = delete;
+
+        HoeffdingTree &operator=(const HoeffdingTree &) = delete;
+
+        ~ HoeffdingTree();
+
+    private:
+        size_t parameter_count;
+
+        int label_count;
+
+        size_t max_leaves;
+
+        double delta;
+
+        size_t grace_period;
+
+        double tie_threshold;
+
+        size_t candidate_count;
+
+        size_t sample_count;
+
+        size_t leaf_count;
+
+        DecisionTreeNode *root;
+
+        /// The statistics of every leaf, in max_leaves equally sized slots. See slot_size.
+        double *statistics;
+
+        /// Which slots are free, as a stack of slot indices.
+        size_t *free_slots;
+
+        size_t free_slot_count;
+
+        /// The slot of every leaf.
+        std::unordered_map<const DecisionTreeNode *, size_t> leaf_slots;
+
+        size_t slot_size() const;
+
+        void start_leaf(DecisionTreeNode *leaf, const double *label_weights);
+
+        double find_best_threshold(const double *slot, size_t parameter, double parent_entropy, double *weights,
+                                   double &threshold, double *lesser_weights) const;
+
+        void try_split(DecisionTreeNode *leaf, double *slot);
+    };
+
+} // pico_dt
+
+#endif //PICO_DT_HOEFFDINGTREE_H
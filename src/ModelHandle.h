@@ -0,0 +1,136 @@
+#ifndef PICO_DT_MODELHANDLE_H
+#define PICO_DT_MODELHANDLE_H
+
+#include <cstddef>
+
+#ifdef PICO_DT_ENABLE_THREADS
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#include "DecisionTreeNode.h"
+
+namespace pico_dt {
+
+    /// Holds the model that many threads predict with, and lets a newly trained or deserialized model replace it while
+    /// they do, in the style of read-copy-update (see https://en.wikipedia.org/wiki/Read-copy-update). Readers take a
+    /// snapshot without locking, and keep whatever model they got until they let the snapshot go, no matter how often
+    /// the model is replaced in the meantime. Publishing a model swaps it in with a single atomic exchange, so every
+    /// reader sees either all of the old model or all of the new one. The old model is then deleted once no snapshot
+    /// of it is left.
+    ///
+    /// Readers are counted in two halves, by the parity of the generation they started in. Publishing moves on to the
+    /// next generation, then waits for the half that counted the previous one to empty. Readers starting meanwhile are
+    /// counted in the other half, so a steady stream of them can't keep a publisher waiting forever.
+    /// \tparam Model The type of model, like DecisionTreeNode or FlatTree. Models are freed with delete, so they must
+    /// not come from an arena.
+    template<typename Model>
+    class ModelHandle {
+    public:
+        /// A reader's view of the model. The model stays the same, and stays alive, for as long as the snapshot does.
+        /// Publishing waits for snapshots of the model it replaces, so let go of them quickly.
+        class Snapshot {
+        public:
+            Snapshot(Snapshot &&other) noexcept {
+                model = other.model;
+                readers = other.readers;
+                other.readers = nullptr;
+            }
+
+            Snapshot(const Snapshot &) = delete;
+
+            Snapshot &operator=(const Snapshot &) = delete;
+
+            /// Get the model this snapshot is of.
+            /// \return The model, or nullptr if none had been published.
+            const Model *get() const {
+                return model;
+            }
+
+            const Model &operator*() const {
+                return *model;
+            }
+
+            const Model *operator->() const {
+                return model;
+            }
+
+            ~ Snapshot() {
+                if (readers != nullptr) readers->fetch_sub(1);
+            }
+
+        private:
+            friend class ModelHandle;
+
+            Snapshot(const Model *p_model, std::atomic<size_t> *p_readers) {
+                model = p_model;
+                readers = p_readers;
+            }
+
+            const Model *model;
+
+            std::atomic<size_t> *readers;
+        };
+
+        /// Create a new Model Handle.
+        /// \param p_model The first model, which the handle takes ownership of, or nullptr to start without one.
+        explicit ModelHandle(Model *p_model = nullptr) : model(p_model), generation(0) {
+            readers[0] = 0;
+            readers[1] = 0;
+        }
+
+        /// Take a snapshot of the current model. Never locks.
+        /// \return The snapshot.
+        Snapshot read() const {
+            while (true) {
+                size_t reader_generation = generation.load();
+                std::atomic<size_t> &half = readers[reader_generation & 1];
+                half.fetch_add(1);
+                // if a publisher moved on before this reader was counted, it might not have waited for it, so count it
+                // again in the new generation.
+                if (generation.load() == reader_generation) return Snapshot(model.load(), &half);
+                half.fetch_sub(1);
+            }
+        }
+
+        /// Replace the model. Returns once every snapshot of the old model has gone, and the old model is deleted.
+        /// Publishers take turns, but never hold up readers.
+        /// \param new_model The new model, fully built, which the handle takes ownership of.
+        void publish(Model *new_model) {
+            std::lock_guard<std::mutex> lock(publishing);
+            Model *old_model = model.exchange(new_model);
+            size_t old_generation = generation.fetch_add(1);
+            while (readers[old_generation & 1].load() != 0) {
+                std::this_thread::yield();
+            }
+            delete old_model;
+        }
+
+        ModelHandle(const ModelHandle &) = delete;
+
+        ModelHandle &operator=(const ModelHandle &) = delete;
+
+        /// Delete the model. No snapshot may outlive the handle.
+        ~ ModelHandle() {
+            delete model.load();
+        }
+
+    private:
+        std::atomic<Model *> model;
+
+        std::atomic<size_t> generation;
+
+        mutable std::atomic<size_t> readers[2];
+
+        std::mutex publishing;
+    };
+
+    /// A handle for trees built by fit or deserialize_decision_tree.
+    typedef ModelHandle<DecisionTreeNode> TreeHandle;
+
+} // pico_dt
+
+#endif
+
+#endif //PICO_DT_MODELHANDLE_H
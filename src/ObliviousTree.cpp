@@ -0,0 +1,413 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "ObliviousTree.h"
+#include "WorkStealingPool.h"
+
+namespace pico_dt {
+    namespace {
+        // magic (4), version (1), label width (1), depth (1), parameter count (2), then the label count (4).
+        const size_t header_size = 13;
+
+        // each level's parameter (2) and threshold (8).
+        const size_t level_size = 10;
+
+        void write_value(uint8_t *&location, uint64_t value, size_t width) {
+            for (size_t i = 0; i < width; ++i) {
+                *location++ = (uint8_t) (value >> (8 * i));
+            }
+        }
+
+        uint64_t read_value(const uint8_t *location, size_t width) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i) {
+                value |= (uint64_t) location[i] << (8 * i);
+            }
+            return value;
+        }
+
+        size_t label_width(uint64_t label_count) {
+            return label_count <= 0x100 ? 1 : 2;
+        }
+
+        /// n log2 n, which is 0 for n = 0. A group of samples with w samples in total, c_k of them with label k, has
+        /// w times its entropy of f(w) - the sum of f(c_k) bits.
+        double weighted_log(size_t n) {
+            return n == 0 ? 0 : (double) n * log2((double) n);
+        }
+
+        /// The best threshold found for one parameter at one level.
+        struct LevelCandidate {
+            double score;
+            double threshold;
+            bool found;
+        };
+    }
+
+    ObliviousTree::ObliviousTree(size_t p_parameter_count, int p_label_count) {
+        parameter_count = p_parameter_count;
+        label_count = p_label_count;
+        depth = 0;
+        level_parameters = nullptr;
+        level_thresholds = nullptr;
+        leaf_labels = nullptr;
+        clear(0);
+    }
+
+    ObliviousTree::~ObliviousTree() {
+        delete[] level_parameters;
+        delete[] level_thresholds;
+        delete[] leaf_labels;
+    }
+
+    void ObliviousTree::clear(size_t new_depth) {
+        delete[] level_parameters;
+        delete[] level_thresholds;
+        delete[] leaf_labels;
+        depth = new_depth;
+        level_parameters = new uint16_t[depth];
+        level_thresholds = new double[depth];
+        leaf_labels = new int[(size_t) 1 << depth];
+        leaf_labels[0] = 0;
+    }
+
+    void ObliviousTree::fit(double **parameters, const int *labels, size_t count, size_t max_depth,
+                            unsigned int thread_count) {
+        fit(Dataset(parameters, labels, count, parameter_count), max_depth, thread_count);
+    }
+
+    void ObliviousTree::fit(const Dataset &data, size_t max_depth, unsigned int thread_count) {
+        clear(0);
+        size_t count = data.get_count();
+        const int *labels = data.get_labels();
+        if (count == 0 || parameter_count > 0xFFFF || label_count > 0x10000) return;
+        if (max_depth > PICO_DT_OBLIVIOUS_MAX_DEPTH) max_depth = PICO_DT_OBLIVIOUS_MAX_DEPTH;
+
+        // sort every parameter once. each level sweeps every parameter in order, for all of its leaves at once.
+        auto *sorted_samples = new size_t[parameter_count * count];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            size_t *column = sorted_samples + i * count;
+            for (size_t j = 0; j < count; ++j) {
+                column[j] = j;
+            }
+            const double *values = data.get_column(i);
+            std::sort(column, column + count, [values](size_t a, size_t b) {
+                return values[a] < values[b];
+            });
+        }
+        size_t total_weight = 0;
+        for (size_t i = 0; i < count; ++i) {
+            total_weight += data.get_weight(i);
+        }
+        // sums of logs drift a little as samples move between sides, so scores closer than this count as a tie, which
+        // the earlier threshold wins.
+        double tolerance = 1e-9 * (double) total_weight;
+
+#ifdef PICO_DT_ENABLE_THREADS
+        unsigned int worker_count = thread_count < 1 ? 1 : thread_count;
+        WorkStealingPool *pool = worker_count > 1 ? new WorkStealingPool(worker_count) : nullptr;
+#else
+        (void) thread_count;
+        unsigned int worker_count = 1;
+#endif
+
+        // which leaf every sample has reached so far, and the levels found so far.
+        auto *sample_leaves = new size_t[count];
+        for (size_t i = 0; i < count; ++i) {
+            sample_leaves[i] = 0;
+        }
+        auto *found_parameters = new uint16_t[max_depth + 1];
+        auto *found_thresholds = new double[max_depth + 1];
+        auto *candidates = new LevelCandidate[parameter_count];
+        size_t found_depth = 0;
+        while (found_depth < max_depth) {
+            size_t leaf_count = (size_t) 1 << found_depth;
+            auto *leaf_label_counts = new size_t[leaf_count * label_count];
+            auto *leaf_weights = new size_t[leaf_count];
+            for (size_t i = 0; i < leaf_count * label_count; ++i) {
+                leaf_label_counts[i] = 0;
+            }
+            for (size_t i = 0; i < leaf_count; ++i) {
+                leaf_weights[i] = 0;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                size_t weight = data.get_weight(i);
+                leaf_label_counts[sample_leaves[i] * label_count + labels[i]] += weight;
+                leaf_weights[sample_leaves[i]] += weight;
+            }
+            double level_score = 0;
+            for (size_t i = 0; i < leaf_count; ++i) {
+                level_score += weighted_log(leaf_weights[i]);
+                for (int k = 0; k < label_count; ++k) {
+                    level_score -= weighted_log(leaf_label_counts[i * label_count + k]);
+                }
+            }
+            if (level_score <= tolerance) {
+                // every leaf is pure already.
+                delete[] leaf_label_counts;
+                delete[] leaf_weights;
+                break;
+            }
+
+            // every worker sweeps with its own counts of what has passed to the lesser side of each leaf.
+            auto *lesser_label_counts = new size_t[worker_count * leaf_count * label_count];
+            auto *lesser_weights = new size_t[worker_count * leaf_count];
+            auto search = [&](size_t parameter) {
+#ifdef PICO_DT_ENABLE_THREADS
+                unsigned int worker = pool != nullptr ? pool->current_worker() : 0;
+#else
+                unsigned int worker = 0;
+#endif
+                size_t *lesser_counts = lesser_label_counts + worker * leaf_count * label_count;
+                size_t *lesser_leaf_weights = lesser_weights + worker * leaf_count;
+                for (size_t i = 0; i < leaf_count * label_count; ++i) {
+                    lesser_counts[i] = 0;
+                }
+                for (size_t i = 0; i < leaf_count; ++i) {
+                    lesser_leaf_weights[i] = 0;
+                }
+
+                // move each run of equal values from the greater side to the lesser side, updating only the terms of
+                // the leaves its samples are in, and score the midpoint to the next run.
+                const size_t *column = sorted_samples + parameter * count;
+                const double *values = data.get_column(parameter);
+                LevelCandidate best = {std::numeric_limits<double>::infinity(), 0, false};
+                double score = level_score;
+                size_t j = 0;
+                while (j < count) {
+                    double value = values[column[j]];
+                    while (j < count && values[column[j]] == value) {
+                        size_t sample = column[j++];
+                        size_t weight = data.get_weight(sample);
+                        size_t leaf = sample_leaves[sample];
+                        size_t &lesser_count = lesser_counts[leaf * label_count + labels[sample]];
+                        size_t greater_count = leaf_label_counts[leaf * label_count + labels[sample]] - lesser_count;
+                        size_t &lesser_weight = lesser_leaf_weights[leaf];
+                        size_t greater_weight = leaf_weights[leaf] - lesser_weight;
+                        score += weighted_log(lesser_weight + weight) - weighted_log(lesser_weight) -
+                                 weighted_log(lesser_count + weight) + weighted_log(lesser_count) +
+                                 weighted_log(greater_weight - weight) - weighted_log(greater_weight) -
+                                 weighted_log(greater_count - weight) + weighted_log(greater_count);
+                        lesser_count += weight;
+                        lesser_weight += weight;
+                    }
+                    if (j == count) break;
+                    if (score < best.score - tolerance) best = {score, (value + values[column[j]]) / 2, true};
+                }
+                candidates[parameter] = best;
+            };
+#ifdef PICO_DT_ENABLE_THREADS
+            if (pool != nullptr) {
+                pool->parallel_for(parameter_count, search);
+            } else
+#endif
+            {
+                for (size_t i = 0; i < parameter_count; ++i) {
+                    search(i);
+                }
+            }
+            delete[] lesser_label_counts;
+            delete[] lesser_weights;
+            delete[] leaf_label_counts;
+            delete[] leaf_weights;
+
+            // the lowest parameter wins a tie, so the tree doesn't depend on how many threads searched.
+            size_t best_parameter = 0;
+            for (size_t i = 1; i < parameter_count; ++i) {
+                if (!candidates[i].found) continue;
+                if (!candidates[best_parameter].found ||
+                    candidates[i].score < candidates[best_parameter].score - tolerance) {
+                    best_parameter = i;
+                }
+            }
+            if (parameter_count == 0 || !candidates[best_parameter].found ||
+                !(candidates[best_parameter].score < level_score - tolerance)) {
+                break;
+            }
+            double threshold = candidates[best_parameter].threshold;
+            const double *values = data.get_column(best_parameter);
+            for (size_t i = 0; i < count; ++i) {
+                sample_leaves[i] = (sample_leaves[i] << 1) | (size_t) !(values[i] < threshold);
+            }
+            found_parameters[found_depth] = (uint16_t) best_parameter;
+            found_thresholds[found_depth] = threshold;
+            ++found_depth;
+        }
+#ifdef PICO_DT_ENABLE_THREADS
+        delete pool;
+#endif
+        delete[] candidates;
+        delete[] sorted_samples;
+
+        // count every label at every level, as a heap: node h's children are 2h + 1 and 2h + 2, and the leaves are the
+        // last leaf_count nodes. a leaf without samples takes the label of the nearest node above it that had some.
+        size_t leaf_count = (size_t) 1 << found_depth;
+        size_t heap_count = 2 * leaf_count - 1;
+        auto *heap_label_counts = new size_t[heap_count * label_count];
+        for (size_t i = 0; i < heap_count * label_count; ++i) {
+            heap_label_counts[i] = 0;
+        }
+        for (size_t i = 0; i < count; ++i) {
+            heap_label_counts[(leaf_count - 1 + sample_leaves[i]) * label_count + labels[i]] += data.get_weight(i);
+        }
+        for (size_t h = leaf_count - 1; h-- > 0;) {
+            for (int k = 0; k < label_count; ++k) {
+                heap_label_counts[h * label_count + k] = heap_label_counts[(2 * h + 1) * label_count + k] +
+                                                         heap_label_counts[(2 * h + 2) * label_count + k];
+            }
+        }
+        auto *heap_labels = new int[heap_count];
+        for (size_t h = 0; h < heap_count; ++h) {
+            const size_t *counts = heap_label_counts + h * label_count;
+            int best_label = 0;
+            for (int k = 1; k < label_count; ++k) {
+                if (counts[k] > counts[best_label]) best_label = k;
+            }
+            heap_labels[h] = counts[best_label] > 0 || h == 0 ? best_label : heap_labels[(h - 1) / 2];
+        }
+
+        clear(found_depth);
+        memcpy(level_parameters, found_parameters, depth * sizeof(uint16_t));
+        memcpy(level_thresholds, found_thresholds, depth * sizeof(double));
+        memcpy(leaf_labels, heap_labels + leaf_count - 1, leaf_count * sizeof(int));
+        delete[] heap_label_counts;
+        delete[] heap_labels;
+        delete[] sample_leaves;
+        delete[] found_parameters;
+        delete[] found_thresholds;
+    }
+
+    void ObliviousTree::predict_batch(const double *rows, size_t count, size_t stride, int *out) const {
+        size_t indices[PICO_DT_OBLIVIOUS_BATCH_LANES];
+        for (size_t begin = 0; begin < count; begin += PICO_DT_OBLIVIOUS_BATCH_LANES) {
+            size_t lanes = std::min((size_t) PICO_DT_OBLIVIOUS_BATCH_LANES, count - begin);
+            const double *group = rows + begin * stride;
+            for (size_t j = 0; j < lanes; ++j) {
+                indices[j] = 0;
+            }
+            // a level at a time, for every sample in the group. nothing here depends on the values but the bits.
+            for (size_t i = 0; i < depth; ++i) {
+                const double *values = group + level_parameters[i];
+                double threshold = level_thresholds[i];
+                for (size_t j = 0; j < lanes; ++j) {
+                    indices[j] = (indices[j] << 1) | (size_t) !(values[j * stride] < threshold);
+                }
+            }
+            for (size_t j = 0; j < lanes; ++j) {
+                out[begin + j] = leaf_labels[indices[j]];
+            }
+        }
+    }
+
+    void ObliviousTree::predict_batch_columns(const double *columns, size_t count, size_t stride, int *out) const {
+        size_t indices[PICO_DT_OBLIVIOUS_BATCH_LANES];
+        for (size_t begin = 0; begin < count; begin += PICO_DT_OBLIVIOUS_BATCH_LANES) {
+            size_t lanes = std::min((size_t) PICO_DT_OBLIVIOUS_BATCH_LANES, count - begin);
+            for (size_t j = 0; j < lanes; ++j) {
+                indices[j] = 0;
+            }
+            for (size_t i = 0; i < depth; ++i) {
+                const double *values = columns + level_parameters[i] * stride + begin;
+                double threshold = level_thresholds[i];
+                for (size_t j = 0; j < lanes; ++j) {
+                    indices[j] = (indices[j] << 1) | (size_t) !(values[j] < threshold);
+                }
+            }
+            for (size_t j = 0; j < lanes; ++j) {
+                out[begin + j] = leaf_labels[indices[j]];
+            }
+        }
+    }
+
+    size_t ObliviousTree::get_depth() const {
+        return depth;
+    }
+
+    size_t ObliviousTree::get_comparison_parameter(size_t level) const {
+        return level_parameters[level];
+    }
+
+    double ObliviousTree::get_comparison_threshold(size_t level) const {
+        return level_thresholds[level];
+    }
+
+    int ObliviousTree::get_leaf_label(size_t leaf) const {
+        return leaf_labels[leaf];
+    }
+
+    size_t ObliviousTree::get_parameter_count() const {
+        return parameter_count;
+    }
+
+    int ObliviousTree::get_label_count() const {
+        return label_count;
+    }
+
+    size_t ObliviousTree::calculate_serialized_size() const {
+        return header_size + depth * level_size + ((size_t) 1 << depth) * label_width((uint64_t) label_count);
+    }
+
+    uint8_t *ObliviousTree::serialize() const {
+        auto *buffer = new uint8_t[calculate_serialized_size()];
+        uint8_t *location = buffer;
+        memcpy(location, PICO_DT_OBLIVIOUS_MAGIC, 4);
+        location += 4;
+        size_t width = label_width((uint64_t) label_count);
+        *location++ = PICO_DT_OBLIVIOUS_VERSION;
+        *location++ = (uint8_t) width;
+        *location++ = (uint8_t) depth;
+        write_value(location, parameter_count, 2);
+        write_value(location, (uint32_t) label_count, 4);
+        for (size_t i = 0; i < depth; ++i) {
+            uint64_t threshold_bits;
+            memcpy(&threshold_bits, &level_thresholds[i], sizeof(threshold_bits));
+            write_value(location, level_parameters[i], 2);
+            write_value(location, threshold_bits, 8);
+        }
+        for (size_t i = 0; i < ((size_t) 1 << depth); ++i) {
+            write_value(location, (uint64_t) leaf_labels[i], width);
+        }
+        return buffer;
+    }
+
+    ObliviousTree *deserialize_oblivious_tree(const uint8_t *buffer, size_t buffer_length) {
+        if (buffer_length < header_size || memcmp(buffer, PICO_DT_OBLIVIOUS_MAGIC, 4) != 0 ||
+            buffer[4] != PICO_DT_OBLIVIOUS_VERSION) {
+            return nullptr;
+        }
+        size_t width = buffer[5];
+        size_t depth = buffer[6];
+        size_t parameter_count = read_value(buffer + 7, 2);
+        uint64_t label_count = read_value(buffer + 9, 4);
+        if (label_count < 1 || label_count > 0x10000 || width != label_width(label_count) ||
+            depth > PICO_DT_OBLIVIOUS_MAX_DEPTH ||
+            buffer_length != header_size + depth * level_size + ((size_t) 1 << depth) * width) {
+            return nullptr;
+        }
+
+        auto *tree = new ObliviousTree(parameter_count, (int) label_count);
+        tree->clear(depth);
+        const uint8_t *location = buffer + header_size;
+        for (size_t i = 0; i < depth; ++i, location += level_size) {
+            auto parameter = (uint16_t) read_value(location, 2);
+            uint64_t threshold_bits = read_value(location + 2, 8);
+            if (parameter >= parameter_count) {
+                delete tree;
+                return nullptr;
+            }
+            tree->level_parameters[i] = parameter;
+            memcpy(&tree->level_thresholds[i], &threshold_bits, sizeof(threshold_bits));
+        }
+        for (size_t i = 0; i < ((size_t) 1 << depth); ++i, location += width) {
+            uint64_t label = read_value(location, width);
+            if (label >= label_count) {
+                delete tree;
+                return nullptr;
+            }
+            tree->leaf_labels[i] = (int) label;
+        }
+        return tree;
+    }
+} // pico_dt
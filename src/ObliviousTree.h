@@ -0,0 +1,157 @@
+#ifndef PICO_DT_OBLIVIOUSTREE_H
+#define PICO_DT_OBLIVIOUSTREE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "Dataset.h"
+
+// the first bytes of serialized oblivious tree data.
+#define PICO_DT_OBLIVIOUS_MAGIC "PDTO"
+#define PICO_DT_OBLIVIOUS_VERSION 1
+
+// the deepest an oblivious tree may be. it has 2 to the power of its depth leaves.
+#ifndef PICO_DT_OBLIVIOUS_MAX_DEPTH
+#define PICO_DT_OBLIVIOUS_MAX_DEPTH 16
+#endif
+
+// how many samples batch prediction takes through each level together.
+#ifndef PICO_DT_OBLIVIOUS_BATCH_LANES
+#define PICO_DT_OBLIVIOUS_BATCH_LANES 64
+#endif
+
+namespace pico_dt {
+
+    /// A decision tree whose nodes at each depth all compare the same parameter against the same threshold (an
+    /// oblivious, or symmetric, tree, as CatBoost grows). Every sample makes the same d comparisons whatever it is, and
+    /// the results, as the bits of a number, pick one of 2^d leaves, so predicting never branches on the data, and
+    /// batches of samples go through each comparison together.
+    ///
+    /// The tree is grown a level at a time. Each level takes the threshold that leaves the fewest bits of label entropy
+    /// across all of the new leaves together, each leaf's entropy weighted by its samples. Thresholds are tried at the
+    /// same midpoints fit tries them, and every parameter is sorted once, up front. Growing stops early once no
+    /// threshold lowers the entropy. A leaf takes its most common label, or, with no samples at all, the label of the
+    /// nearest level above where it had some.
+    class ObliviousTree {
+    public:
+        /// Create a new Oblivious Tree, which predicts 0 until it's fit.
+        /// \param p_parameter_count The number of parameters this tree can handle.
+        /// \param p_label_count The number of labels the tree might classify an item as.
+        ObliviousTree(size_t p_parameter_count, int p_label_count);
+
+        /// Fit the tree to a given set of parameters and labels, replacing whatever it was fit to before.
+        /// \param parameters An array of pointers pointing to arrays of parameters. Arrays of parameters must be parameter_count long.
+        /// \param labels An array of labels, with one label for each parameter array given.
+        /// \param count The length of both the parameter pointer array (parameters) and label array (labels).
+        /// \param max_depth The most levels to grow. Clamped to PICO_DT_OBLIVIOUS_MAX_DEPTH.
+        /// \param thread_count How many threads to fit with. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit(double **parameters, const int *labels, size_t count, size_t max_depth,
+                 unsigned int thread_count = 1);
+
+        /// Fit the tree to a Dataset. The same as the other fit, without copying the samples into columns. Weighted
+        /// samples count as that many copies. Trees with more than 65535 parameters or 65536 labels can't be fit, and
+        /// stay a single leaf.
+        /// \param data The samples and labels to fit to, with at least parameter_count parameters each.
+        /// \param max_depth The most levels to grow. Clamped to PICO_DT_OBLIVIOUS_MAX_DEPTH.
+        /// \param thread_count How many threads to fit with. Parameters are searched for each level's threshold in
+        /// parallel. Only used when PICO_DT_ENABLE_THREADS is defined.
+        void fit(const Dataset &data, size_t max_depth, unsigned int thread_count = 1);
+
+        /// Predict a value given some parameters.
+        /// \param parameters An array of parameters to use.
+        /// \return The predicted value.
+        int predict(const double *parameters) const {
+            size_t index = 0;
+            for (size_t i = 0; i < depth; ++i) {
+                index = (index << 1) | (size_t) !(parameters[level_parameters[i]] < level_thresholds[i]);
+            }
+            return leaf_labels[index];
+        }
+
+        /// Predict values for many samples stored one after another (row-major). Gives exactly what predict gives
+        /// for each sample.
+        /// \param rows Pointer to the parameters of the first sample.
+        /// \param count The number of samples.
+        /// \param stride How many doubles apart consecutive samples start. At least the parameter count.
+        /// \param out An array of count predictions to fill in.
+        void predict_batch(const double *rows, size_t count, size_t stride, int *out) const;
+
+        /// Predict values for many samples stored one parameter at a time (column-major), where each level's
+        /// comparisons read one contiguous run of values. Otherwise the same as predict_batch.
+        /// \param columns Pointer to the first parameter of the first sample.
+        /// \param count The number of samples.
+        /// \param stride How many doubles apart consecutive parameters start. At least count.
+        /// \param out An array of count predictions to fill in.
+        void predict_batch_columns(const double *columns, size_t count, size_t stride, int *out) const;
+
+        /// Get the number of levels the tree has.
+        /// \return The depth.
+        size_t get_depth() const;
+
+        /// Get the parameter every node at a level compares by.
+        /// \param level The level, from 0 at the root to depth - 1.
+        /// \return The comparison parameter.
+        size_t get_comparison_parameter(size_t level) const;
+
+        /// Get the threshold every node at a level compares against. Parameters lesser than this take a 0 bit.
+        /// \param level The level, from 0 at the root to depth - 1.
+        /// \return The comparison threshold.
+        double get_comparison_threshold(size_t level) const;
+
+        /// Get the label of a leaf. The root's comparison gives the highest bit of a leaf's index.
+        /// \param leaf The leaf, from 0 to 2^depth - 1.
+        /// \return The label.
+        int get_leaf_label(size_t leaf) const;
+
+        /// Get the number of parameters this tree can handle.
+        /// \return The parameter count.
+        size_t get_parameter_count() const;
+
+        /// Get the number of labels this tree might classify an item as.
+        /// \return The label count.
+        int get_label_count() const;
+
+        /// Calculate the size of the data serialize makes.
+        /// \return The size, in bytes.
+        size_t calculate_serialized_size() const;
+
+        /// Serialize this tree into compact data: a small header, then each level's parameter (2 bytes) and threshold
+        /// (8 bytes), then every leaf's label, in 1 byte each for up to 256 labels and 2 otherwise. Always little
+        /// endian.
+        /// \return The serialized data, calculate_serialized_size bytes long.
+        uint8_t *serialize() const;
+
+        ObliviousTree(const ObliviousTree &) = delete;
+
+        ObliviousTree &operator=(const ObliviousTree &) = delete;
+
+        ~ ObliviousTree();
+
+    private:
+        size_t parameter_count;
+
+        int label_count;
+
+        size_t depth;
+
+        uint16_t *level_parameters;
+
+        double *level_thresholds;
+
+        /// 2^depth labels, one for each leaf.
+        int *leaf_labels;
+
+        void clear(size_t new_depth);
+
+        friend ObliviousTree *deserialize_oblivious_tree(const uint8_t *buffer, size_t buffer_length);
+    };
+
+    /// Rebuild an Oblivious Tree from data made by ObliviousTree::serialize.
+    /// \param buffer pointer to the serialized tree data.
+    /// \param buffer_length length of the serialized data buffer.
+    /// \return A pointer to a new Oblivious Tree, or nullptr if the data isn't a valid serialized oblivious tree.
+    ObliviousTree *deserialize_oblivious_tree(const uint8_t *buffer, size_t buffer_length);
+
+} // pico_dt
+
+#endif //PICO_DT_OBLIVIOUSTREE_H
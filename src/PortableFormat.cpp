@@ -0,0 +1,312 @@
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "PortableFormat.h"
+
+namespace pico_dt {
+    namespace {
+        // magic (4), version (1), flags (1), parameter index width (1), label width (1), then the parameter, label and
+        // node counts (4 each). The CRC-32 of everything before it comes last (4).
+        const size_t header_size = PICO_DT_PORTABLE_HEADER_SIZE;
+        const size_t crc_size = PICO_DT_PORTABLE_CRC_SIZE;
+
+        const uint8_t single_precision_flag = 0x01;
+
+        uint32_t update_crc(uint32_t crc, const uint8_t *data, size_t length) {
+            // the reflected CRC-32 used by zlib and PNG.
+            static const struct CrcTable {
+                uint32_t entries[256];
+
+                CrcTable() : entries() {
+                    for (uint32_t i = 0; i < 256; ++i) {
+                        uint32_t entry = i;
+                        for (int bit = 0; bit < 8; ++bit) {
+                            entry = entry & 1 ? (entry >> 1) ^ 0xEDB88320 : entry >> 1;
+                        }
+                        entries[i] = entry;
+                    }
+                }
+            } table;
+            for (size_t i = 0; i < length; ++i) {
+                crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+            }
+            return crc;
+        }
+
+        uint8_t width_for(uint64_t largest) {
+            if (largest <= 0xFF) return 1;
+            if (largest <= 0xFFFF) return 2;
+            return 4;
+        }
+
+        void write_value(uint8_t *&location, uint64_t value, size_t width) {
+            for (size_t i = 0; i < width; ++i) {
+                *location++ = (uint8_t) (value >> (8 * i));
+            }
+        }
+
+        uint64_t read_value(const uint8_t *location, size_t width) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i) {
+                value |= (uint64_t) location[i] << (8 * i);
+            }
+            return value;
+        }
+
+        /// Round a threshold up to a float, so x < threshold gives the same answer for every float x.
+        float round_up_to_float(double threshold) {
+            // casting a finite double beyond the float range is undefined, so those are clamped first. Every float is
+            // lesser than infinity, and only negative infinity is lesser than -FLT_MAX, so no answer changes.
+            if (threshold > FLT_MAX) return INFINITY;
+            if (threshold < -FLT_MAX && threshold != -INFINITY) return -FLT_MAX;
+            auto rounded = (float) threshold;
+            if ((double) rounded < threshold) rounded = std::nextafter(rounded, INFINITY);
+            return rounded;
+        }
+
+        /// Call visit on every node of a tree, children before their parents, in the same order serialize uses.
+        template<typename Visit>
+        void visit_postfix(const DecisionTreeNode &tree, Visit visit) {
+            struct PendingNode {
+                const DecisionTreeNode *node;
+                bool children_visited;
+            };
+            std::vector<PendingNode> stack;
+            stack.push_back({&tree, false});
+            while (!stack.empty()) {
+                PendingNode pending = stack.back();
+                stack.pop_back();
+                if (!pending.node->is_leaf() && !pending.children_visited) {
+                    stack.push_back({pending.node, true});
+                    stack.push_back({pending.node->get_greater_branch(), false});
+                    stack.push_back({pending.node->get_lesser_branch(), false});
+                    continue;
+                }
+                visit(pending.node);
+            }
+        }
+
+        uint8_t parameter_width(const DecisionTreeNode &tree) {
+            return get_portable_parameter_width(tree.get_parameter_count());
+        }
+
+        uint8_t label_width(const DecisionTreeNode &tree) {
+            return get_portable_label_width(tree.get_label_count());
+        }
+
+        /// How the nodes of portable tree data are laid out.
+        struct NodeFormat {
+            size_t parameter_count;
+            uint64_t label_count;
+            size_t parameter_bytes;
+            size_t label_bytes;
+            size_t threshold_bytes;
+        };
+
+        /// Read every node of portable tree data into a tree, checking each one. Only a single tree that ends exactly
+        /// at buffer_length is valid.
+        /// \param node_count Set to the number of nodes read.
+        /// \param crc Updated with every byte read.
+        /// \return The root of the tree, or nullptr if the nodes aren't valid.
+        DecisionTreeNode *read_nodes(const uint8_t *buffer, size_t buffer_length, const NodeFormat &format,
+                                     TreeArena *arena, size_t &node_count, uint32_t &crc) {
+            // the same stack of subtrees, linked through parent_branch, that deserialize_decision_tree uses.
+            size_t buffer_pointer = 0;
+            DecisionTreeNode *dt_stack = nullptr;
+            size_t stack_size = 0;
+            node_count = 0;
+            while (buffer_pointer < buffer_length) {
+                const uint8_t *node_data = buffer + buffer_pointer + 1;
+                size_t node_size;
+                DecisionTreeNode *new_node;
+                if (buffer[buffer_pointer] == PICO_DT_LEAF_FLAG) {
+                    node_size = 1 + format.label_bytes;
+                    if (node_size > buffer_length - buffer_pointer) break;
+                    uint64_t label = read_value(node_data, format.label_bytes);
+                    if (label >= format.label_count) break;
+                    new_node = create_decision_tree_node(arena, format.parameter_count, (int) format.label_count,
+                                                         (int) label);
+                    if (new_node == nullptr) break;
+                    ++stack_size;
+                } else if (buffer[buffer_pointer] == PICO_DT_BRANCH_FLAG) {
+                    node_size = 1 + format.parameter_bytes + format.threshold_bytes;
+                    if (node_size > buffer_length - buffer_pointer || stack_size < 2) break;
+                    size_t parameter = read_value(node_data, format.parameter_bytes);
+                    if (parameter >= format.parameter_count) break;
+                    uint64_t threshold_bits = read_value(node_data + format.parameter_bytes, format.threshold_bytes);
+                    double threshold;
+                    if (format.threshold_bytes == sizeof(float)) {
+                        float single_threshold;
+                        auto single_threshold_bits = (uint32_t) threshold_bits;
+                        memcpy(&single_threshold, &single_threshold_bits, sizeof(single_threshold));
+                        threshold = single_threshold;
+                    } else {
+                        memcpy(&threshold, &threshold_bits, sizeof(threshold));
+                    }
+                    DecisionTreeNode *greater_branch = dt_stack;
+                    DecisionTreeNode *lesser_branch = greater_branch->parent_branch;
+                    // the new branch takes over its branches' parent_branch links, so read what's below them first.
+                    DecisionTreeNode *below = lesser_branch->parent_branch;
+                    new_node = create_decision_tree_node(arena, format.parameter_count, (int) format.label_count,
+                                                         parameter, threshold, lesser_branch, greater_branch);
+                    if (new_node == nullptr) break;
+                    dt_stack = below;
+                    --stack_size;
+                } else {
+                    break;
+                }
+                new_node->parent_branch = dt_stack;
+                dt_stack = new_node;
+                crc = update_crc(crc, buffer + buffer_pointer, node_size);
+                buffer_pointer += node_size;
+                ++node_count;
+            }
+
+            // any problem with a node stops the loop early, before the end of the buffer.
+            if (buffer_pointer != buffer_length || stack_size != 1) {
+                // arena nodes are freed with the arena.
+                while (arena == nullptr && dt_stack != nullptr) {
+                    DecisionTreeNode *next = dt_stack->parent_branch;
+                    delete dt_stack;
+                    dt_stack = next;
+                }
+                return nullptr;
+            }
+            return dt_stack;
+        }
+    }
+
+    uint8_t get_portable_parameter_width(size_t parameter_count) {
+        return width_for(parameter_count > 0 ? parameter_count - 1 : 0);
+    }
+
+    uint8_t get_portable_label_width(int label_count) {
+        return width_for(label_count > 0 ? (uint64_t) label_count - 1 : 0);
+    }
+
+    void write_portable_header(uint8_t *location, size_t parameter_count, int label_count, size_t node_count,
+                               bool single_precision) {
+        memcpy(location, PICO_DT_PORTABLE_MAGIC, 4);
+        location += 4;
+        *location++ = PICO_DT_PORTABLE_VERSION;
+        *location++ = single_precision ? single_precision_flag : 0;
+        *location++ = get_portable_parameter_width(parameter_count);
+        *location++ = get_portable_label_width(label_count);
+        write_value(location, parameter_count, 4);
+        write_value(location, (uint32_t) label_count, 4);
+        write_value(location, node_count, 4);
+    }
+
+    size_t write_portable_node(const DecisionTreeNode &node, uint8_t parameter_width, uint8_t label_width,
+                               bool single_precision, uint8_t *location) {
+        uint8_t *start = location;
+        if (node.is_leaf()) {
+            *location++ = PICO_DT_LEAF_FLAG;
+            write_value(location, (uint32_t) node.get_default_value(), label_width);
+            return location - start;
+        }
+        *location++ = PICO_DT_BRANCH_FLAG;
+        write_value(location, node.get_comparison_parameter(), parameter_width);
+        if (single_precision) {
+            float threshold = round_up_to_float(node.get_comparison_threshold());
+            uint32_t threshold_bits;
+            memcpy(&threshold_bits, &threshold, sizeof(threshold));
+            write_value(location, threshold_bits, sizeof(threshold_bits));
+        } else {
+            double threshold = node.get_comparison_threshold();
+            uint64_t threshold_bits;
+            memcpy(&threshold_bits, &threshold, sizeof(threshold));
+            write_value(location, threshold_bits, sizeof(threshold_bits));
+        }
+        return location - start;
+    }
+
+    uint32_t update_portable_crc(uint32_t crc, const uint8_t *data, size_t length) {
+        return ~update_crc(~crc, data, length);
+    }
+
+    size_t calculate_portable_size(const DecisionTreeNode &tree, bool single_precision) {
+        size_t leaf_size = 1 + label_width(tree);
+        size_t branch_size = 1 + parameter_width(tree) + (single_precision ? sizeof(float) : sizeof(double));
+        size_t size = header_size + crc_size;
+        visit_postfix(tree, [&size, leaf_size, branch_size](const DecisionTreeNode *node) {
+            size += node->is_leaf() ? leaf_size : branch_size;
+        });
+        return size;
+    }
+
+    uint8_t *serialize_portable_tree(const DecisionTreeNode &tree, bool single_precision) {
+        size_t size = calculate_portable_size(tree, single_precision);
+        auto *buffer = new uint8_t[size];
+        uint8_t parameter_bytes = parameter_width(tree);
+        uint8_t label_bytes = label_width(tree);
+        size_t node_count = 0;
+        visit_postfix(tree, [&node_count](const DecisionTreeNode *) {
+            ++node_count;
+        });
+
+        write_portable_header(buffer, tree.get_parameter_count(), tree.get_label_count(), node_count,
+                              single_precision);
+        uint8_t *location = buffer + header_size;
+        visit_postfix(tree, [&location, parameter_bytes, label_bytes, single_precision](const DecisionTreeNode *node) {
+            location += write_portable_node(*node, parameter_bytes, label_bytes, single_precision, location);
+        });
+
+        write_value(location, update_portable_crc(0, buffer, size - crc_size), crc_size);
+        return buffer;
+    }
+
+    bool is_portable_tree(const uint8_t *buffer, size_t buffer_length) {
+        return buffer_length >= 4 && memcmp(buffer, PICO_DT_PORTABLE_MAGIC, 4) == 0;
+    }
+
+    DecisionTreeNode *deserialize_portable_tree(const uint8_t *buffer, size_t buffer_length, TreeArena *arena) {
+        if (!is_portable_tree(buffer, buffer_length) || buffer_length < header_size + crc_size) return nullptr;
+        uint8_t flags = buffer[5];
+        size_t parameter_bytes = buffer[6];
+        size_t label_bytes = buffer[7];
+        if (buffer[4] != PICO_DT_PORTABLE_VERSION || (flags & ~single_precision_flag) != 0) {
+            return nullptr;
+        }
+        if ((parameter_bytes != 1 && parameter_bytes != 2 && parameter_bytes != 4) ||
+            (label_bytes != 1 && label_bytes != 2 && label_bytes != 4)) {
+            return nullptr;
+        }
+        NodeFormat format = {};
+        format.parameter_count = read_value(buffer + 8, 4);
+        format.label_count = read_value(buffer + 12, 4);
+        format.parameter_bytes = parameter_bytes;
+        format.label_bytes = label_bytes;
+        format.threshold_bytes = flags & single_precision_flag ? sizeof(float) : sizeof(double);
+        size_t node_count = read_value(buffer + 16, 4);
+        if (format.label_count > INT32_MAX) return nullptr;
+
+        uint32_t crc = update_crc(0xFFFFFFFF, buffer, header_size);
+        size_t end = buffer_length - crc_size;
+        size_t nodes_read;
+        DecisionTreeNode *tree = read_nodes(buffer + header_size, end - header_size, format, arena, nodes_read, crc);
+        if (tree == nullptr) return nullptr;
+        if (nodes_read != node_count || ~crc != (uint32_t) read_value(buffer + end, crc_size)) {
+            // arena nodes are freed with the arena.
+            if (arena == nullptr) delete tree;
+            return nullptr;
+        }
+        return tree;
+    }
+
+    DecisionTreeNode *deserialize_portable_nodes(const uint8_t *buffer, size_t buffer_length, size_t parameter_count,
+                                                 int label_count, TreeArena *arena) {
+        if (label_count < 0) return nullptr;
+        NodeFormat format = {};
+        format.parameter_count = parameter_count;
+        format.label_count = (uint64_t) label_count;
+        format.parameter_bytes = get_portable_parameter_width(parameter_count);
+        format.label_bytes = get_portable_label_width(label_count);
+        format.threshold_bytes = sizeof(double);
+        size_t node_count;
+        uint32_t crc = 0;
+        return read_nodes(buffer, buffer_length, format, arena, node_count, crc);
+    }
+} // pico_dt
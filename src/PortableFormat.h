@@ -0,0 +1,102 @@
+#ifndef PICO_DT_PORTABLEFORMAT_H
+#define PICO_DT_PORTABLEFORMAT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DecisionTreeNode.h"
+
+// the first bytes of portable tree data. Serialized trees always start with PICO_DT_LEAF_FLAG instead.
+#define PICO_DT_PORTABLE_MAGIC "PDTP"
+#define PICO_DT_PORTABLE_VERSION 2
+// the size of the header portable tree data starts with, and of the CRC-32 it ends with.
+#define PICO_DT_PORTABLE_HEADER_SIZE 20
+#define PICO_DT_PORTABLE_CRC_SIZE 4
+
+namespace pico_dt {
+
+    /// Calculate how large a decision tree will be once serialized by serialize_portable_tree.
+    /// \param tree The root of the decision tree.
+    /// \param single_precision Whether thresholds are stored as floats instead of doubles.
+    /// \return The final size of the serialized decision tree.
+    size_t calculate_portable_size(const DecisionTreeNode &tree, bool single_precision = false);
+
+    /// Serialize a decision tree into a compact format that any processor can read, no matter its byte ordering or
+    /// data sizes. It starts with a header giving the version and the parameter, label and node counts, so none of
+    /// them need storing separately, and ends with a CRC-32 of everything before it. Parameter indices and labels take
+    /// 1, 2 or 4 bytes each, whichever is enough for the tree.
+    /// \param tree The root of the decision tree to serialize.
+    /// \param single_precision Store thresholds as floats instead of doubles. Thresholds are rounded up to the next
+    /// float, so predictions are still exact for parameters that are floats themselves.
+    /// \return A pointer to a buffer containing the serialized decision tree, calculate_portable_size bytes long.
+    uint8_t *serialize_portable_tree(const DecisionTreeNode &tree, bool single_precision = false);
+
+    /// Check whether data starts like portable tree data, as opposed to data from DecisionTreeNode::serialize.
+    /// \param buffer pointer to the serialized tree data.
+    /// \param buffer_length length of the serialized data buffer.
+    /// \return Whether the data starts with the portable format's magic number.
+    bool is_portable_tree(const uint8_t *buffer, size_t buffer_length);
+
+    /// Create a new decision tree from data made by serialize_portable_tree. Everything is checked, including the
+    /// CRC, in a single pass over the data. deserialize_decision_tree reads this format too.
+    /// \param buffer pointer to the serialized tree data.
+    /// \param buffer_length length of the serialized data buffer.
+    /// \param arena The arena to allocate every node from, or nullptr to use the heap. Trees from an arena must not be
+    /// deleted; they are freed with the arena.
+    /// \return A pointer to a new decision tree, or nullptr if the data isn't a valid portable tree or the arena fills
+    /// up.
+    DecisionTreeNode *deserialize_portable_tree(const uint8_t *buffer, size_t buffer_length,
+                                                TreeArena *arena = nullptr);
+
+    /// Get how many bytes the portable format stores each parameter index in.
+    /// \param parameter_count The number of parameters the tree can handle.
+    /// \return 1, 2 or 4.
+    uint8_t get_portable_parameter_width(size_t parameter_count);
+
+    /// Get how many bytes the portable format stores each label in.
+    /// \param label_count The number of labels the tree might classify an item as.
+    /// \return 1, 2 or 4.
+    uint8_t get_portable_label_width(int label_count);
+
+    /// Write the header serialize_portable_tree starts its data with, PICO_DT_PORTABLE_HEADER_SIZE bytes long.
+    /// \param location Where to write the header.
+    /// \param parameter_count The number of parameters the tree can handle.
+    /// \param label_count The number of labels the tree might classify an item as.
+    /// \param node_count The number of nodes, branches and leaves both, in the tree.
+    /// \param single_precision Whether thresholds are stored as floats instead of doubles.
+    void write_portable_header(uint8_t *location, size_t parameter_count, int label_count, size_t node_count,
+                               bool single_precision);
+
+    /// Write one node, without its branches, the way serialize_portable_tree writes it.
+    /// \param node The node to write.
+    /// \param parameter_width The width of parameter indices, from get_portable_parameter_width.
+    /// \param label_width The width of labels, from get_portable_label_width.
+    /// \param single_precision Whether to store the threshold as a float instead of a double.
+    /// \param location Where to write the node. Nodes are at most 13 bytes.
+    /// \return How many bytes were written.
+    size_t write_portable_node(const DecisionTreeNode &node, uint8_t parameter_width, uint8_t label_width,
+                               bool single_precision, uint8_t *location);
+
+    /// Update the CRC-32 portable tree data ends with, so it can be calculated a piece at a time. It is the CRC-32 used
+    /// by zlib and PNG.
+    /// \param crc The CRC of the data before this piece, or 0 for the first piece.
+    /// \param data The piece of data.
+    /// \param length How many bytes the piece has.
+    /// \return The CRC of all of the data so far.
+    uint32_t update_portable_crc(uint32_t crc, const uint8_t *data, size_t length);
+
+    /// Create a new decision tree from just the nodes of portable tree data, as write_portable_node writes them, with
+    /// no header or CRC, in little endian, with double thresholds. Every node is checked.
+    /// \param buffer pointer to the nodes.
+    /// \param buffer_length length of the nodes.
+    /// \param parameter_count The number of parameters the tree can handle, which sets the width of parameter indices.
+    /// \param label_count The number of labels the tree might classify an item as, which sets the width of labels.
+    /// \param arena The arena to allocate every node from, or nullptr to use the heap.
+    /// \return A pointer to a new decision tree, or nullptr if the nodes aren't exactly one valid tree or the arena
+    /// fills up.
+    DecisionTreeNode *deserialize_portable_nodes(const uint8_t *buffer, size_t buffer_length, size_t parameter_count,
+                                                 int label_count, TreeArena *arena = nullptr);
+
+} // pico_dt
+
+#endif //PICO_DT_PORTABLEFORMAT_H
@@ -0,0 +1,158 @@
+#include <algorithm>
+#include <vector>
+
+#include "PredictionCache.h"
+
+namespace pico_dt {
+    namespace {
+        // slots and counters are only atomic with threads, and never need ordering against anything else.
+#ifdef PICO_DT_ENABLE_THREADS
+        template<typename T>
+        T load_relaxed(const std::atomic<T> &value) {
+            return value.load(std::memory_order_relaxed);
+        }
+
+        template<typename T>
+        void store_relaxed(std::atomic<T> &value, T new_value) {
+            value.store(new_value, std::memory_order_relaxed);
+        }
+
+        template<typename T>
+        void increment_relaxed(std::atomic<T> &value) {
+            value.fetch_add(1, std::memory_order_relaxed);
+        }
+#else
+        template<typename T>
+        T load_relaxed(const T &value) {
+            return value;
+        }
+
+        template<typename T>
+        void store_relaxed(T &value, T new_value) {
+            value = new_value;
+        }
+
+        template<typename T>
+        void increment_relaxed(T &value) {
+            ++value;
+        }
+#endif
+    }
+
+    PredictionCache::PredictionCache(const FlatTreeView &p_tree, size_t p_capacity) {
+        tree = p_tree;
+        size_t parameter_count = tree.get_parameter_count();
+        const FlatNode *nodes = tree.get_nodes();
+
+        // gather every parameter's thresholds, then sort them and drop the duplicates.
+        std::vector<std::vector<double>> parameter_thresholds(parameter_count);
+        for (size_t i = 0; i < tree.get_node_count(); ++i) {
+            if (nodes[i].child >= 0) parameter_thresholds[nodes[i].parameter].push_back(nodes[i].threshold);
+        }
+        threshold_offsets = new size_t[parameter_count + 1];
+        threshold_offsets[0] = 0;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            std::vector<double> &distinct = parameter_thresholds[i];
+            std::sort(distinct.begin(), distinct.end());
+            distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+            threshold_offsets[i + 1] = threshold_offsets[i] + distinct.size();
+        }
+        thresholds = new double[threshold_offsets[parameter_count]];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            std::copy(parameter_thresholds[i].begin(), parameter_thresholds[i].end(), thresholds + threshold_offsets[i]);
+        }
+
+        // a parameter with n thresholds has n + 1 ranks, and every combination of ranks, plus one for empty slots,
+        // has to fit above the prediction.
+        label_bits = 0;
+        while (((uint64_t) 1 << label_bits) < (uint64_t) tree.get_label_count()) {
+            ++label_bits;
+        }
+        uint64_t rank_limit = UINT64_MAX >> label_bits;
+        uint64_t rank_combinations = 1;
+        bool fits = true;
+        rank_multipliers = new uint64_t[parameter_count];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            rank_multipliers[i] = rank_combinations;
+            uint64_t ranks = threshold_offsets[i + 1] - threshold_offsets[i] + 1;
+            if (ranks > (rank_limit - 1) / rank_combinations) {
+                fits = false;
+                break;
+            }
+            rank_combinations *= ranks;
+        }
+
+        size_t capacity = 2;
+        slot_shift = 63;
+        while (capacity < p_capacity) {
+            capacity *= 2;
+            --slot_shift;
+        }
+        slots = fits ? new Slot[capacity] : nullptr;
+        if (slots != nullptr) {
+            for (size_t i = 0; i < capacity; ++i) {
+                store_relaxed(slots[i], (uint64_t) 0);
+            }
+        }
+        store_relaxed(hits, (size_t) 0);
+        store_relaxed(misses, (size_t) 0);
+    }
+
+    int PredictionCache::predict(const double *parameters) {
+        if (slots == nullptr) {
+            increment_relaxed(misses);
+            return tree.predict(parameters);
+        }
+
+        // NaNs never compare lesser, just like values at least as great as every threshold.
+        uint64_t ranks = 0;
+        for (size_t i = 0; i < tree.get_parameter_count(); ++i) {
+            const double *begin = thresholds + threshold_offsets[i];
+            const double *end = thresholds + threshold_offsets[i + 1];
+            if (begin == end) continue;
+            double value = parameters[i];
+            size_t rank = value != value ? end - begin : std::upper_bound(begin, end, value) - begin;
+            ranks += rank * rank_multipliers[i];
+        }
+        uint64_t tag = ranks + 1;
+        Slot &slot = slots[(tag * 0x9E3779B97F4A7C15) >> slot_shift];
+        uint64_t word = load_relaxed(slot);
+        if (word >> label_bits == tag) {
+            increment_relaxed(hits);
+            return (int) (word & (((uint64_t) 1 << label_bits) - 1));
+        }
+        increment_relaxed(misses);
+        int label = tree.predict(parameters);
+        store_relaxed(slot, tag << label_bits | (uint64_t) label);
+        return label;
+    }
+
+    bool PredictionCache::is_enabled() const {
+        return slots != nullptr;
+    }
+
+    size_t PredictionCache::get_hit_count() const {
+        return load_relaxed(hits);
+    }
+
+    size_t PredictionCache::get_miss_count() const {
+        return load_relaxed(misses);
+    }
+
+    void PredictionCache::clear() {
+        if (slots != nullptr) {
+            for (size_t i = 0; i < ((size_t) 1 << (64 - slot_shift)); ++i) {
+                store_relaxed(slots[i], (uint64_t) 0);
+            }
+        }
+        store_relaxed(hits, (size_t) 0);
+        store_relaxed(misses, (size_t) 0);
+    }
+
+    PredictionCache::~PredictionCache() {
+        delete[] thresholds;
+        delete[] threshold_offsets;
+        delete[] rank_multipliers;
+        delete[] slots;
+    }
+} // pico_dt
@@ -0,0 +1,94 @@
+#ifndef PICO_DT_PREDICTIONCACHE_H
+#define PICO_DT_PREDICTIONCACHE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef PICO_DT_ENABLE_THREADS
+#include <atomic>
+#endif
+
+#include "FlatTree.h"
+
+namespace pico_dt {
+
+    /// Remembers the predictions a flat tree made, so inputs that keep coming back, like readings from a sensor that
+    /// sits in a few regimes, don't walk the tree every time. Every parameter is reduced to its rank among the distinct
+    /// thresholds the tree compares that parameter against, which tells exactly which way every branch on it goes. So
+    /// inputs with the same ranks always get the same prediction, and a remembered prediction is always right.
+    ///
+    /// The cache has a fixed number of slots, picked by a hash of the ranks, and a new prediction simply replaces
+    /// whatever its slot held. Each slot is one 64 bit word holding both the ranks and the prediction, so with
+    /// PICO_DT_ENABLE_THREADS defined, any number of threads can predict through one cache without locking.
+    class PredictionCache {
+    public:
+        /// Create a new Prediction Cache.
+        /// \param p_tree The tree to predict with. Its nodes must outlive the cache.
+        /// \param p_capacity How many predictions to remember. Rounded up to a power of 2.
+        PredictionCache(const FlatTreeView &p_tree, size_t p_capacity = 1024);
+
+        /// Predict a value given some parameters, from the cache if it can. Gives exactly what the tree gives.
+        /// \param parameters An array of parameters to use.
+        /// \return The predicted value.
+        int predict(const double *parameters);
+
+        /// Check whether predictions are being remembered. They can't be when the tree has so many thresholds that
+        /// every combination of ranks doesn't fit in a slot, and then predict always walks the tree.
+        /// \return Whether the cache is in use.
+        bool is_enabled() const;
+
+        /// Get how many predictions came from the cache.
+        /// \return The hit count.
+        size_t get_hit_count() const;
+
+        /// Get how many predictions had to walk the tree.
+        /// \return The miss count.
+        size_t get_miss_count() const;
+
+        /// Forget every remembered prediction, and set the hit and miss counts back to 0.
+        void clear();
+
+        PredictionCache(const PredictionCache &) = delete;
+
+        PredictionCache &operator=(const PredictionCache &) = delete;
+
+        ~ PredictionCache();
+
+    private:
+#ifdef PICO_DT_ENABLE_THREADS
+        typedef std::atomic<uint64_t> Slot;
+        typedef std::atomic<size_t> Counter;
+#else
+        typedef uint64_t Slot;
+        typedef size_t Counter;
+#endif
+
+        FlatTreeView tree;
+
+        /// Every parameter's distinct thresholds, in ascending order, one parameter after another.
+        double *thresholds;
+
+        /// Where each parameter's thresholds start in thresholds, with one more at the end.
+        size_t *threshold_offsets;
+
+        /// What each parameter's rank is multiplied by, so the ranks add up to a single number.
+        uint64_t *rank_multipliers;
+
+        /// How many low bits of a slot hold the prediction. The rest hold one more than the ranks' number, so an empty
+        /// slot is 0.
+        unsigned int label_bits;
+
+        /// How far a hash is shifted to pick a slot.
+        unsigned int slot_shift;
+
+        /// The slots, or nullptr when the cache isn't in use.
+        Slot *slots;
+
+        Counter hits;
+
+        Counter misses;
+    };
+
+} // pico_dt
+
+#endif //PICO_DT_PREDICTIONCACHE_H
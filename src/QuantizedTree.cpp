@@ -0,0 +1,298 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "QuantizedTree.h"
+
+namespace pico_dt {
+    namespace {
+        // magic (4), version (1), reading width (1), parameter count (2), then the label and node counts (4 each).
+        const size_t header_size = 16;
+
+        // the parameter a serialized leaf has instead of a real one.
+        const uint16_t leaf_parameter = 0xFFFF;
+
+        void write_value(uint8_t *&location, uint64_t value, size_t width) {
+            for (size_t i = 0; i < width; ++i) {
+                *location++ = (uint8_t) (value >> (8 * i));
+            }
+        }
+
+        uint64_t read_value(const uint8_t *location, size_t width) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i) {
+                value |= (uint64_t) location[i] << (8 * i);
+            }
+            return value;
+        }
+
+        double calibrate(int64_t reading, const FeatureCalibration &calibration) {
+            return (double) reading * calibration.scale + calibration.offset;
+        }
+
+        /// Find the smallest reading that calibrates to at least a threshold, so reading < it exactly when the
+        /// calibrated reading < threshold. Gives something at most the lowest Raw if every reading goes to the greater
+        /// side, and something above the highest Raw if every reading goes to the lesser side.
+        template<typename Raw>
+        int64_t quantize_threshold(double threshold, const FeatureCalibration &calibration) {
+            const int64_t lowest = std::numeric_limits<Raw>::min();
+            const int64_t highest = std::numeric_limits<Raw>::max();
+            // start from the exact answer, which rounding can put a reading off, then walk to the real one.
+            double estimate = std::ceil((threshold - calibration.offset) / calibration.scale);
+            int64_t reading;
+            if (!(estimate > (double) lowest)) reading = lowest;
+            else if (estimate > (double) highest) reading = highest + 1;
+            else reading = (int64_t) estimate;
+            while (reading > lowest && calibrate(reading - 1, calibration) >= threshold) --reading;
+            while (reading <= highest && calibrate(reading, calibration) < threshold) ++reading;
+            return reading;
+        }
+    }
+
+    template<typename Raw>
+    QuantizedTree<Raw> *quantize_tree(const DecisionTreeNode &tree, const FeatureCalibration *calibrations) {
+        size_t parameter_count = tree.get_parameter_count();
+        int label_count = tree.get_label_count();
+        if (parameter_count >= leaf_parameter || label_count > 0x10000) return nullptr;
+        for (size_t i = 0; i < parameter_count; ++i) {
+            if (!(calibrations[i].scale > 0)) return nullptr;
+        }
+
+        // count the nodes first. dropping branches only ever makes the quantized tree smaller.
+        size_t tree_node_count = 0;
+        const DecisionTreeNode *node = &tree;
+        const DecisionTreeNode **counting_stack = nullptr;
+        size_t stack_size = 0;
+        size_t stack_capacity = 0;
+        while (node != nullptr) {
+            ++tree_node_count;
+            if (!node->is_leaf()) {
+                if (stack_size == stack_capacity) {
+                    stack_capacity = stack_capacity * 2 + 16;
+                    auto **bigger_stack = new const DecisionTreeNode *[stack_capacity];
+                    if (stack_size > 0) memcpy(bigger_stack, counting_stack, stack_size * sizeof(*counting_stack));
+                    delete[] counting_stack;
+                    counting_stack = bigger_stack;
+                }
+                counting_stack[stack_size++] = node->get_greater_branch();
+                node = node->get_lesser_branch();
+                continue;
+            }
+            node = stack_size > 0 ? counting_stack[--stack_size] : nullptr;
+        }
+        delete[] counting_stack;
+
+        // lay the nodes out the same way FlatTree does, depth first with each branch's children side by side.
+        struct PendingNode {
+            const DecisionTreeNode *node;
+            size_t index;
+        };
+        auto *stack = new PendingNode[tree_node_count];
+        auto *nodes = new QuantizedNode<Raw>[tree_node_count];
+        size_t next_index = 1;
+        stack_size = 0;
+        stack[stack_size++] = {&tree, 0};
+        while (stack_size > 0) {
+            PendingNode pending = stack[--stack_size];
+            node = pending.node;
+            int64_t threshold = 0;
+            while (!node->is_leaf()) {
+                threshold = quantize_threshold<Raw>(node->get_comparison_threshold(),
+                                                    calibrations[node->get_comparison_parameter()]);
+                if (threshold > std::numeric_limits<Raw>::max()) node = node->get_lesser_branch();
+                else if (threshold <= std::numeric_limits<Raw>::min()) node = node->get_greater_branch();
+                else break;
+            }
+            if (node->is_leaf()) {
+                nodes[pending.index] = {0, 0, ~(int32_t) node->get_default_value()};
+                continue;
+            }
+            nodes[pending.index] = {(Raw) threshold, (uint16_t) node->get_comparison_parameter(), (int32_t) next_index};
+            stack[stack_size++] = {node->get_greater_branch(), next_index + 1};
+            stack[stack_size++] = {node->get_lesser_branch(), next_index};
+            next_index += 2;
+        }
+        delete[] stack;
+
+        if (next_index < tree_node_count) {
+            auto *smaller_nodes = new QuantizedNode<Raw>[next_index];
+            memcpy(smaller_nodes, nodes, next_index * sizeof(*nodes));
+            delete[] nodes;
+            nodes = smaller_nodes;
+        }
+        return new QuantizedTree<Raw>(parameter_count, label_count, next_index, nodes);
+    }
+
+    template<typename Raw>
+    QuantizedTree<Raw>::QuantizedTree(size_t p_parameter_count, int p_label_count, size_t p_node_count,
+                                      QuantizedNode<Raw> *p_nodes) {
+        parameter_count = p_parameter_count;
+        label_count = p_label_count;
+        node_count = p_node_count;
+        nodes = p_nodes;
+    }
+
+    template<typename Raw>
+    QuantizedTree<Raw>::~QuantizedTree() {
+        delete[] nodes;
+    }
+
+    template<typename Raw>
+    int QuantizedTree<Raw>::predict(const Raw *readings) const {
+        const QuantizedNode<Raw> *node = nodes;
+        while (node->child >= 0) {
+            node = nodes + node->child + !(readings[node->parameter] < node->threshold);
+        }
+        return ~node->child;
+    }
+
+    template<typename Raw>
+    size_t QuantizedTree<Raw>::calculate_serialized_size() const {
+        return header_size + node_count * (sizeof(uint16_t) + sizeof(Raw));
+    }
+
+    template<typename Raw>
+    uint8_t *QuantizedTree<Raw>::serialize() const {
+        auto *buffer = new uint8_t[calculate_serialized_size()];
+        uint8_t *location = buffer;
+        memcpy(location, PICO_DT_QUANTIZED_MAGIC, 4);
+        location += 4;
+        *location++ = PICO_DT_QUANTIZED_VERSION;
+        *location++ = (uint8_t) sizeof(Raw);
+        write_value(location, parameter_count, 2);
+        write_value(location, (uint32_t) label_count, 4);
+        write_value(location, node_count, 4);
+
+        // prefix order, lesser side first. deserialize_quantized_tree gives the children their slots again.
+        auto *stack = new size_t[node_count];
+        size_t stack_size = 0;
+        stack[stack_size++] = 0;
+        while (stack_size > 0) {
+            const QuantizedNode<Raw> &node = nodes[stack[--stack_size]];
+            if (node.child < 0) {
+                write_value(location, leaf_parameter, 2);
+                write_value(location, (uint64_t) ~node.child, sizeof(Raw));
+                continue;
+            }
+            write_value(location, node.parameter, 2);
+            write_value(location, (uint64_t) node.threshold, sizeof(Raw));
+            stack[stack_size++] = node.child + 1;
+            stack[stack_size++] = node.child;
+        }
+        delete[] stack;
+        return buffer;
+    }
+
+    template<typename Raw>
+    QuantizedTree<Raw> *deserialize_quantized_tree(const uint8_t *buffer, size_t buffer_length) {
+        if (buffer_length < header_size || memcmp(buffer, PICO_DT_QUANTIZED_MAGIC, 4) != 0 ||
+            buffer[4] != PICO_DT_QUANTIZED_VERSION || buffer[5] != sizeof(Raw)) {
+            return nullptr;
+        }
+        size_t parameter_count = read_value(buffer + 6, 2);
+        uint64_t label_count = read_value(buffer + 8, 4);
+        size_t node_count = read_value(buffer + 12, 4);
+        const size_t node_size = sizeof(uint16_t) + sizeof(Raw);
+        if (node_count == 0 || label_count > 0x10000 || (buffer_length - header_size) / node_size != node_count ||
+            (buffer_length - header_size) % node_size != 0) {
+            return nullptr;
+        }
+
+        // every node in the data takes the slot on top of the stack, and a branch pushes the slots of its children.
+        auto *nodes = new QuantizedNode<Raw>[node_count];
+        auto *stack = new size_t[node_count + 1];
+        size_t stack_size = 0;
+        size_t next_index = 1;
+        stack[stack_size++] = 0;
+        const uint8_t *location = buffer + header_size;
+        for (size_t i = 0; i < node_count; ++i, location += node_size) {
+            if (stack_size == 0) break;
+            QuantizedNode<Raw> &node = nodes[stack[--stack_size]];
+            auto parameter = (uint16_t) read_value(location, 2);
+            uint64_t value = read_value(location + 2, sizeof(Raw));
+            if (parameter == leaf_parameter) {
+                if (value >= label_count) break;
+                node = {0, 0, ~(int32_t) value};
+                continue;
+            }
+            if (parameter >= parameter_count || next_index + 2 > node_count) break;
+            node = {(Raw) value, parameter, (int32_t) next_index};
+            stack[stack_size++] = next_index + 1;
+            stack[stack_size++] = next_index;
+            next_index += 2;
+        }
+        delete[] stack;
+        if (location != buffer + buffer_length || stack_size != 0 || next_index != node_count) {
+            delete[] nodes;
+            return nullptr;
+        }
+        return new QuantizedTree<Raw>(parameter_count, (int) label_count, node_count, nodes);
+    }
+
+    template<typename Raw>
+    void quantize_readings(const FeatureCalibration *calibrations, size_t parameter_count, const double *parameters,
+                           Raw *readings) {
+        for (size_t i = 0; i < parameter_count; ++i) {
+            double reading = (parameters[i] - calibrations[i].offset) / calibrations[i].scale;
+            if (!(reading > std::numeric_limits<Raw>::min())) readings[i] = std::numeric_limits<Raw>::min();
+            else if (reading >= std::numeric_limits<Raw>::max()) readings[i] = std::numeric_limits<Raw>::max();
+            else readings[i] = (Raw) std::llround(reading);
+        }
+    }
+
+    template<typename Raw>
+    size_t find_quantization_changes(const DecisionTreeNode &tree, const QuantizedTree<Raw> &quantized,
+                                     const FeatureCalibration *calibrations, double **parameters, size_t count,
+                                     size_t *changed) {
+        size_t parameter_count = tree.get_parameter_count();
+        auto *readings = new Raw[parameter_count];
+        size_t changed_count = 0;
+        for (size_t i = 0; i < count; ++i) {
+            quantize_readings(calibrations, parameter_count, parameters[i], readings);
+            if (quantized.predict(readings) == tree.predict(parameters[i])) continue;
+            if (changed != nullptr) changed[changed_count] = i;
+            ++changed_count;
+        }
+        delete[] readings;
+        return changed_count;
+    }
+
+    template<typename Raw>
+    size_t QuantizedTree<Raw>::get_parameter_count() const {
+        return parameter_count;
+    }
+
+    template<typename Raw>
+    int QuantizedTree<Raw>::get_label_count() const {
+        return label_count;
+    }
+
+    template<typename Raw>
+    size_t QuantizedTree<Raw>::get_node_count() const {
+        return node_count;
+    }
+
+    template<typename Raw>
+    const QuantizedNode<Raw> *QuantizedTree<Raw>::get_nodes() const {
+        return nodes;
+    }
+
+    // readings are 16 or 32 bit integers. 16 bits covers most ADCs, and keeps thresholds in one halfword.
+    template class QuantizedTree<int16_t>;
+    template class QuantizedTree<int32_t>;
+
+    template QuantizedTree<int16_t> *quantize_tree<int16_t>(const DecisionTreeNode &, const FeatureCalibration *);
+    template QuantizedTree<int32_t> *quantize_tree<int32_t>(const DecisionTreeNode &, const FeatureCalibration *);
+
+    template QuantizedTree<int16_t> *deserialize_quantized_tree<int16_t>(const uint8_t *, size_t);
+    template QuantizedTree<int32_t> *deserialize_quantized_tree<int32_t>(const uint8_t *, size_t);
+
+    template void quantize_readings<int16_t>(const FeatureCalibration *, size_t, const double *, int16_t *);
+    template void quantize_readings<int32_t>(const FeatureCalibration *, size_t, const double *, int32_t *);
+
+    template size_t find_quantization_changes<int16_t>(const DecisionTreeNode &, const QuantizedTree<int16_t> &,
+                                                       const FeatureCalibration *, double **, size_t, size_t *);
+    template size_t find_quantization_changes<int32_t>(const DecisionTreeNode &, const QuantizedTree<int32_t> &,
+                                                       const FeatureCalibration *, double **, size_t, size_t *);
+
+} // pico_dt
@@ -0,0 +1,137 @@
+#ifndef PICO_DT_QUANTIZEDTREE_H
+#define PICO_DT_QUANTIZEDTREE_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DecisionTreeNode.h"
+
+// the first bytes of serialized quantized tree data.
+#define PICO_DT_QUANTIZED_MAGIC "PDTQ"
+#define PICO_DT_QUANTIZED_VERSION 1
+
+namespace pico_dt {
+
+    /// How raw integer readings of one parameter map to the values a tree was trained on:
+    /// value = reading * scale + offset. Scale must be positive.
+    struct FeatureCalibration {
+        double scale;
+        double offset;
+    };
+
+    /// One node of a QuantizedTree. Like FlatNode, branches point at their lesser child with the greater child right
+    /// after it, and leaves store the bitwise not of their label in child.
+    template<typename Raw>
+    struct QuantizedNode {
+        Raw threshold;
+        uint16_t parameter;
+        int32_t child;
+    };
+
+    /// A decision tree that compares raw integer readings, like those straight from an ADC, against integer
+    /// thresholds, for processors without a floating point unit. Raw is int16_t or int32_t.
+    ///
+    /// Every threshold is the smallest reading that calibrates to at least the original threshold, so predicting a
+    /// reading gives exactly what DecisionTreeNode::predict gives for its calibrated value. Only rounding values to
+    /// readings can change a prediction; find_quantization_changes reports the samples where it does.
+    template<typename Raw>
+    class QuantizedTree {
+    public:
+        /// Predict a value given some raw readings.
+        /// \param readings An array of readings, one for each parameter.
+        /// \return The predicted value.
+        int predict(const Raw *readings) const;
+
+        /// Calculate the size of the data serialize makes.
+        /// \return The size, in bytes.
+        size_t calculate_serialized_size() const;
+
+        /// Serialize this tree into compact data: a small header, then each node in prefix order, taking 2 bytes for
+        /// its parameter (or a leaf marker) and 2 or 4 for its threshold (or label). Always little endian.
+        /// \return The serialized data, calculate_serialized_size bytes long.
+        uint8_t *serialize() const;
+
+        /// Get the number of parameters this tree can handle.
+        /// \return The parameter count.
+        size_t get_parameter_count() const;
+
+        /// Get the number of labels this tree might classify an item as.
+        /// \return The label count.
+        int get_label_count() const;
+
+        /// Get the number of nodes, branches and leaves both, in this tree.
+        /// \return The node count.
+        size_t get_node_count() const;
+
+        /// Get the nodes of this tree. The root is node 0.
+        /// \return A pointer to the first node.
+        const QuantizedNode<Raw> *get_nodes() const;
+
+        QuantizedTree(const QuantizedTree &) = delete;
+
+        QuantizedTree &operator=(const QuantizedTree &) = delete;
+
+        ~ QuantizedTree();
+
+    private:
+        QuantizedTree(size_t p_parameter_count, int p_label_count, size_t p_node_count, QuantizedNode<Raw> *p_nodes);
+
+        size_t parameter_count;
+
+        int label_count;
+
+        size_t node_count;
+
+        QuantizedNode<Raw> *nodes;
+
+        template<typename R>
+        friend QuantizedTree<R> *quantize_tree(const DecisionTreeNode &tree, const FeatureCalibration *calibrations);
+
+        template<typename R>
+        friend QuantizedTree<R> *deserialize_quantized_tree(const uint8_t *buffer, size_t buffer_length);
+    };
+
+    /// Quantize a trained decision tree. Branches whose threshold lies beyond every reading Raw can hold are replaced
+    /// by the side every reading goes to.
+    /// \param tree The root of the decision tree to quantize. It isn't needed afterwards.
+    /// \param calibrations An array of calibrations, one for each parameter.
+    /// \return A pointer to a new Quantized Tree, or nullptr if a calibration's scale isn't positive, or the tree has
+    /// 65535 or more parameters or more than 65536 labels.
+    template<typename Raw>
+    QuantizedTree<Raw> *quantize_tree(const DecisionTreeNode &tree, const FeatureCalibration *calibrations);
+
+    /// Rebuild a Quantized Tree from data made by QuantizedTree::serialize.
+    /// \param buffer pointer to the serialized tree data.
+    /// \param buffer_length length of the serialized data buffer.
+    /// \return A pointer to a new Quantized Tree, or nullptr if the data isn't a valid serialized quantized tree with
+    /// readings of type Raw.
+    template<typename Raw>
+    QuantizedTree<Raw> *deserialize_quantized_tree(const uint8_t *buffer, size_t buffer_length);
+
+    /// Convert the values of one sample into the nearest raw readings, clamped to the range of Raw.
+    /// \param calibrations An array of calibrations, one for each parameter.
+    /// \param parameter_count How many parameters the sample has.
+    /// \param parameters The values of the sample.
+    /// \param readings An array of parameter_count readings to fill in.
+    template<typename Raw>
+    void quantize_readings(const FeatureCalibration *calibrations, size_t parameter_count, const double *parameters,
+                           Raw *readings);
+
+    /// Find the samples a quantized tree classifies differently from the tree it was quantized from, once their values
+    /// are rounded to readings.
+    /// \param tree The decision tree the quantized tree was made from.
+    /// \param quantized The quantized tree.
+    /// \param calibrations The calibrations the quantized tree was made with.
+    /// \param parameters An array of pointers pointing to arrays of parameters, like DecisionTreeNode::fit takes.
+    /// \param count The number of samples.
+    /// \param changed An array of count sample indices to fill in with the samples that changed, or nullptr to only
+    /// count them.
+    /// \return How many samples changed.
+    template<typename Raw>
+    size_t find_quantization_changes(const DecisionTreeNode &tree, const QuantizedTree<Raw> &quantized,
+                                     const FeatureCalibration *calibrations, double **parameters, size_t count,
+                                     size_t *changed);
+
+} // pico_dt
+
+#endif //PICO_DT_QUANTIZEDTREE_H
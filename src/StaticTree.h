@@ -0,0 +1,31 @@
+#ifndef PICO_DT_STATICTREE_H
+#define PICO_DT_STATICTREE_H
+
+#include <cstddef>
+
+namespace pico_dt {
+
+    /// A leaf of a decision tree encoded as a type. See generate_tree_header.
+    /// \tparam Label The value this leaf predicts.
+    template<int Label>
+    struct StaticLeaf {
+        static constexpr int predict(const double *) {
+            return Label;
+        }
+    };
+
+    /// A branch of a decision tree encoded as a type. See generate_tree_header.
+    /// \tparam Parameter The parameter this branch compares by.
+    /// \tparam Threshold A type with a static constexpr double value, the threshold this branch compares against.
+    /// \tparam Lesser The subtree for parameters lesser than the threshold.
+    /// \tparam Greater The subtree for parameters greater than or equal to the threshold.
+    template<size_t Parameter, typename Threshold, typename Lesser, typename Greater>
+    struct StaticBranch {
+        static constexpr int predict(const double *parameters) {
+            return parameters[Parameter] < Threshold::value ? Lesser::predict(parameters) : Greater::predict(parameters);
+        }
+    };
+
+} // pico_dt
+
+#endif //PICO_DT_STATICTREE_H
@@ -0,0 +1,89 @@
+#include "TreeArena.h"
+
+#ifdef PICO_DT_ENABLE_THREADS
+// trees can be fit on several threads at once, and all of them allocate nodes from the same arena.
+#define PICO_DT_ARENA_LOCK std::lock_guard<std::mutex> lock(mutex)
+#else
+#define PICO_DT_ARENA_LOCK
+#endif
+
+namespace pico_dt {
+    TreeArena::TreeArena(size_t p_capacity) {
+        region = new uint8_t[p_capacity];
+        capacity = p_capacity;
+        bottom = 0;
+        top = p_capacity;
+        owns_region = true;
+        overflowed = false;
+    }
+
+    TreeArena::TreeArena(void *p_region, size_t p_capacity) {
+        region = static_cast<uint8_t *>(p_region);
+        capacity = p_capacity;
+        bottom = 0;
+        top = p_capacity;
+        owns_region = false;
+        overflowed = false;
+    }
+
+    void *TreeArena::allocate(size_t size, size_t alignment) {
+        PICO_DT_ARENA_LOCK;
+        // align the address, not the offset, since a caller's region might not be aligned itself.
+        auto address = reinterpret_cast<uintptr_t>(region) + bottom;
+        size_t start = bottom + ((alignment - address % alignment) % alignment);
+        if (start > top || size > top - start) {
+            overflowed = true;
+            return nullptr;
+        }
+        bottom = start + size;
+        return region + start;
+    }
+
+    void *TreeArena::allocate_scratch(size_t size, size_t alignment) {
+        PICO_DT_ARENA_LOCK;
+        if (size > top - bottom) {
+            overflowed = true;
+            return nullptr;
+        }
+        auto address = reinterpret_cast<uintptr_t>(region) + (top - size);
+        size_t start = top - size - address % alignment;
+        if (start < bottom || start > top) {
+            overflowed = true;
+            return nullptr;
+        }
+        top = start;
+        return region + start;
+    }
+
+    size_t TreeArena::get_scratch_mark() const {
+        return top;
+    }
+
+    void TreeArena::release_scratch(size_t mark) {
+        PICO_DT_ARENA_LOCK;
+        top = mark;
+    }
+
+    void TreeArena::reset() {
+        PICO_DT_ARENA_LOCK;
+        bottom = 0;
+        top = capacity;
+        overflowed = false;
+    }
+
+    size_t TreeArena::get_capacity() const {
+        return capacity;
+    }
+
+    size_t TreeArena::get_used_size() const {
+        return bottom + (capacity - top);
+    }
+
+    bool TreeArena::has_overflowed() const {
+        return overflowed;
+    }
+
+    TreeArena::~TreeArena() {
+        if (owns_region) delete[] region;
+    }
+} // pico_dt
@@ -0,0 +1,110 @@
+#ifndef PICO_DT_TREEARENA_H
+#define PICO_DT_TREEARENA_H
+
+#include <cstddef>
+#include <cstdint>
+
+#ifdef PICO_DT_ENABLE_THREADS
+#include <mutex>
+#endif
+
+namespace pico_dt {
+
+    /// A bump allocator over one region of memory, for trees that are allocated and freed all at once. Nodes are
+    /// allocated upwards from the bottom of the region and live until the arena is reset or destroyed. Scratch space
+    /// is allocated downwards from the top, and can be released in the reverse order it was allocated, so fit can use
+    /// the same region for its working memory without leaving any of it behind.
+    class TreeArena {
+    public:
+        /// Create an arena with a region of its own, allocated once, up front.
+        /// \param p_capacity The size of the region, in bytes.
+        explicit TreeArena(size_t p_capacity);
+
+        /// Create an arena over a region supplied by the caller, such as a static array on a microcontroller without a
+        /// heap. The arena never allocates or frees anything itself.
+        /// \param p_region The region to allocate from. It must outlive the arena, and every tree allocated from it.
+        /// \param p_capacity The size of the region, in bytes.
+        TreeArena(void *p_region, size_t p_capacity);
+
+        /// Allocate memory that lives as long as the arena.
+        /// \param size How many bytes to allocate.
+        /// \param alignment What the memory should be aligned to. Must be a power of 2.
+        /// \return The memory, or nullptr if the arena is full.
+        void *allocate(size_t size, size_t alignment);
+
+        /// Allocate scratch memory from the top of the region.
+        /// \param size How many bytes to allocate.
+        /// \param alignment What the memory should be aligned to. Must be a power of 2.
+        /// \return The memory, or nullptr if the arena is full.
+        void *allocate_scratch(size_t size, size_t alignment);
+
+        /// Allocate an array that lives as long as the arena. The elements aren't constructed.
+        /// \param count How many elements to allocate.
+        /// \return The array, or nullptr if the arena is full.
+        template<typename T>
+        T *allocate_array(size_t count) {
+            if (count > SIZE_MAX / sizeof(T)) return nullptr;
+            return static_cast<T *>(allocate(count * sizeof(T), alignof(T)));
+        }
+
+        /// Allocate a scratch array from the top of the region. The elements aren't constructed.
+        /// \param count How many elements to allocate.
+        /// \return The array, or nullptr if the arena is full.
+        template<typename T>
+        T *allocate_scratch_array(size_t count) {
+            if (count > SIZE_MAX / sizeof(T)) return nullptr;
+            return static_cast<T *>(allocate_scratch(count * sizeof(T), alignof(T)));
+        }
+
+        /// Get a mark for the current top of the scratch space, to release everything allocated after it later.
+        /// \return The mark.
+        size_t get_scratch_mark() const;
+
+        /// Release all scratch memory allocated since a mark was taken.
+        /// \param mark A mark from get_scratch_mark.
+        void release_scratch(size_t mark);
+
+        /// Forget everything allocated from the arena, so the whole region can be used again. Every tree allocated
+        /// from it must be gone by now.
+        void reset();
+
+        /// Get the size of the region.
+        /// \return The capacity, in bytes.
+        size_t get_capacity() const;
+
+        /// Get how much of the region is allocated, scratch space included.
+        /// \return The size, in bytes.
+        size_t get_used_size() const;
+
+        /// Check whether an allocation has failed since the arena was made or last reset. Trees fit into a full arena
+        /// stop splitting, so they still work, but are smaller than they should be.
+        /// \return True if an allocation failed.
+        bool has_overflowed() const;
+
+        TreeArena(const TreeArena &) = delete;
+
+        TreeArena &operator=(const TreeArena &) = delete;
+
+        ~ TreeArena();
+
+    private:
+        uint8_t *region;
+
+        size_t capacity;
+
+        size_t bottom;
+
+        size_t top;
+
+        bool owns_region;
+
+        bool overflowed;
+
+#ifdef PICO_DT_ENABLE_THREADS
+        std::mutex mutex;
+#endif
+    };
+
+} // pico_dt
+
+#endif //PICO_DT_TREEARENA_H
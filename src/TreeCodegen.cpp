@@ -0,0 +1,194 @@
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "TreeCodegen.h"
+
+namespace pico_dt {
+    namespace {
+        std::string format_threshold(double threshold) {
+            if (std::isnan(threshold)) return "std::numeric_limits<double>::quiet_NaN()";
+            if (std::isinf(threshold)) {
+                return threshold > 0 ? "std::numeric_limits<double>::infinity()"
+                                     : "-std::numeric_limits<double>::infinity()";
+            }
+            char text[64];
+            snprintf(text, sizeof(text), "%a", threshold);
+            return text;
+        }
+
+        std::string format_number(size_t number) {
+            char text[32];
+            snprintf(text, sizeof(text), "%zu", number);
+            return text;
+        }
+
+        std::string format_label(int label) {
+            char text[32];
+            snprintf(text, sizeof(text), "%d", label);
+            return text;
+        }
+
+        /// Writes nested if statements. Subtrees deeper than PICO_DT_CODEGEN_MAX_NESTING become calls to functions of
+        /// their own, so deep trees don't run into compiler nesting limits. Nothing recurses, so trees of any shape can
+        /// be written.
+        struct FunctionWriter {
+            const char *name;
+            std::string body;
+            std::vector<const DecisionTreeNode *> subtrees;
+
+            std::string subtree_name(size_t index) const {
+                return std::string(name) + "_subtree_" + format_number(index);
+            }
+
+            void write_node(const DecisionTreeNode *root, size_t root_depth) {
+                // a branch is its if statement, with its lesser branch one level deeper inside, then its greater branch
+                // at its own level after it. so chains of greater branches, which fit makes plenty of, never nest, and
+                // are written by this loop instead of by recursion.
+                struct PendingNode {
+                    const DecisionTreeNode *node;
+                    size_t depth;
+                    bool closes_if;
+                };
+                std::vector<PendingNode> stack;
+                stack.push_back({root, root_depth, false});
+                while (!stack.empty()) {
+                    PendingNode pending = stack.back();
+                    stack.pop_back();
+                    const DecisionTreeNode *node = pending.node;
+                    std::string indent((pending.depth + 2) * 4, ' ');
+                    if (pending.closes_if) {
+                        body += indent + "}\n";
+                        continue;
+                    }
+                    if (node->is_leaf()) {
+                        body += indent + "return " + format_label(node->get_default_value()) + ";\n";
+                        continue;
+                    }
+                    if (pending.depth == PICO_DT_CODEGEN_MAX_NESTING) {
+                        body += indent + "return " + subtree_name(subtrees.size()) + "(parameters);\n";
+                        subtrees.push_back(node);
+                        continue;
+                    }
+                    body += indent + "if (parameters[" + format_number(node->get_comparison_parameter()) + "] < " +
+                            format_threshold(node->get_comparison_threshold()) + ") {\n";
+                    stack.push_back({node->get_greater_branch(), pending.depth, false});
+                    stack.push_back({node, pending.depth, true});
+                    stack.push_back({node->get_lesser_branch(), pending.depth + 1, false});
+                }
+            }
+
+            void write_function(const std::string &function_name, const DecisionTreeNode *node) {
+                body += "    constexpr int " + function_name + "(const double *parameters) {\n";
+                write_node(node, 0);
+                body += "    }\n";
+            }
+        };
+
+        std::string write_functions(const DecisionTreeNode &tree, const char *name) {
+            FunctionWriter writer{name, "", {}};
+            writer.write_function(name, &tree);
+            // subtrees found while writing a subtree are added to the end, so this picks them up too.
+            for (size_t i = 0; i < writer.subtrees.size(); ++i) {
+                writer.body += "\n";
+                writer.write_function(writer.subtree_name(i), writer.subtrees[i]);
+            }
+
+            std::string text;
+            for (size_t i = 0; i < writer.subtrees.size(); ++i) {
+                text += "    constexpr int " + writer.subtree_name(i) + "(const double *parameters);\n";
+            }
+            if (!writer.subtrees.empty()) text += "\n";
+            text += "    /// Predict a value given some parameters.\n";
+            text += "    /// \\param parameters An array of " + format_number(tree.get_parameter_count()) +
+                    " parameters to use.\n";
+            text += "    /// \\return The predicted value.\n";
+            return text + writer.body;
+        }
+
+        std::string write_types(const DecisionTreeNode &tree, const char *name) {
+            // children need declaring before their parents, so walk the tree in postfix order, like serialize does.
+            // every PICO_DT_CODEGEN_MAX_NESTING levels a node becomes a plain struct instead of an alias of a
+            // template, which stops the chain of template instantiations before it hits the compiler's depth limit.
+            struct PendingNode {
+                const DecisionTreeNode *node;
+                size_t depth;
+                bool children_written;
+            };
+            std::vector<PendingNode> stack;
+            std::vector<size_t> written_children;
+            std::string text;
+            size_t next_index = 0;
+            stack.push_back({&tree, 0, false});
+            while (!stack.empty()) {
+                PendingNode pending = stack.back();
+                stack.pop_back();
+                const DecisionTreeNode *node = pending.node;
+                if (!node->is_leaf() && !pending.children_written) {
+                    stack.push_back({node, pending.depth, true});
+                    stack.push_back({node->get_greater_branch(), pending.depth + 1, false});
+                    stack.push_back({node->get_lesser_branch(), pending.depth + 1, false});
+                    continue;
+                }
+
+                size_t index = next_index++;
+                std::string node_name = std::string(name) + "_node_" + format_number(index);
+                if (node->is_leaf()) {
+                    text += "    using " + node_name + " = pico_dt::StaticLeaf<" +
+                            format_label(node->get_default_value()) + ">;\n";
+                } else {
+                    size_t greater_index = written_children.back();
+                    written_children.pop_back();
+                    size_t lesser_index = written_children.back();
+                    written_children.pop_back();
+                    std::string threshold_name = std::string(name) + "_threshold_" + format_number(index);
+                    text += "    struct " + threshold_name + " {\n";
+                    text += "        static constexpr double value = " +
+                            format_threshold(node->get_comparison_threshold()) + ";\n";
+                    text += "    };\n";
+                    std::string branch = "pico_dt::StaticBranch<" +
+                                         format_number(node->get_comparison_parameter()) + ", " + threshold_name +
+                                         ", " + name + "_node_" + format_number(lesser_index) + ", " +
+                                         name + "_node_" + format_number(greater_index) + ">";
+                    if (pending.depth % PICO_DT_CODEGEN_MAX_NESTING == 0) {
+                        text += "    struct " + node_name + " {\n";
+                        text += "        static constexpr int predict(const double *parameters) {\n";
+                        text += "            return " + branch + "::predict(parameters);\n";
+                        text += "        }\n";
+                        text += "    };\n";
+                    } else {
+                        text += "    using " + node_name + " = " + branch + ";\n";
+                    }
+                }
+                written_children.push_back(index);
+            }
+
+            text += "\n";
+            text += "    /// The decision tree. Predict a value with " + std::string(name) + "::predict(parameters), where\n";
+            text += "    /// parameters is an array of " + format_number(tree.get_parameter_count()) + " parameters.\n";
+            text += "    using " + std::string(name) + " = " + name + "_node_" + format_number(next_index - 1) + ";\n";
+            return text;
+        }
+    }
+
+    std::string generate_tree_header(const DecisionTreeNode &tree, const char *name, CodegenStyle style) {
+        std::string guard = "PICO_DT_GENERATED_";
+        for (const char *character = name; *character != '\0'; ++character) {
+            guard += (char) toupper((unsigned char) *character);
+        }
+        guard += "_H";
+
+        std::string text;
+        text += "// Generated by pico_dt. Do not edit.\n\n";
+        text += "#ifndef " + guard + "\n";
+        text += "#define " + guard + "\n\n";
+        text += "#include <limits>\n";
+        if (style == CodegenStyle::types) text += "\n#include \"StaticTree.h\"\n";
+        text += "\nnamespace pico_dt_generated {\n\n";
+        text += style == CodegenStyle::types ? write_types(tree, name) : write_functions(tree, name);
+        text += "\n} // pico_dt_generated\n\n";
+        text += "#endif //" + guard + "\n";
+        return text;
+    }
+} // pico_dt
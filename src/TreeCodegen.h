@@ -0,0 +1,37 @@
+#ifndef PICO_DT_TREECODEGEN_H
+#define PICO_DT_TREECODEGEN_H
+
+#include <string>
+
+#include "DecisionTreeNode.h"
+
+// the deepest if statements generated code nests before moving a subtree out into its own function.
+#ifndef PICO_DT_CODEGEN_MAX_NESTING
+#define PICO_DT_CODEGEN_MAX_NESTING 64
+#endif
+
+namespace pico_dt {
+
+    /// What kind of code generate_tree_header writes.
+    enum class CodegenStyle {
+        /// constexpr functions made of nested if statements. Needs nothing else to compile.
+        functions,
+        /// One type per node, built from StaticLeaf and StaticBranch (so StaticTree.h must be on the include path).
+        /// The tree is the type named after it, and is called like name::predict(parameters).
+        types
+    };
+
+    /// Write a self-contained C++ header that hard codes a trained decision tree, so no tree data, deserialization or
+    /// heap is needed at runtime, and the compiler can inline and constant fold the whole thing. Everything it declares
+    /// is in the pico_dt_generated namespace. Thresholds are written as hexadecimal floating point literals, so the
+    /// generated code predicts exactly what the tree does.
+    /// \param tree The root of the decision tree to generate code for.
+    /// \param name The name of the generated function or type. Must be a valid C++ identifier.
+    /// \param style What kind of code to write.
+    /// \return The text of the header.
+    std::string generate_tree_header(const DecisionTreeNode &tree, const char *name,
+                                     CodegenStyle style = CodegenStyle::functions);
+
+} // pico_dt
+
+#endif //PICO_DT_TREECODEGEN_H
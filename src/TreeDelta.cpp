@@ -0,0 +1,522 @@
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "PortableFormat.h"
+#include "TreeDelta.h"
+
+namespace pico_dt {
+    namespace {
+        // magic (4), version (1), the parameter and label counts (4 each), then for the source and then the target,
+        // the size of its nodes and their hash (8 each) and the node count (4), and last the replacement count (4).
+        const size_t header_size = 57;
+
+        // the path's length, in branches (4), then after the path's bits, the source subtree's offset and length, and
+        // the target subtree's length (8 each).
+        const size_t replacement_size = 28;
+
+        // the largest node write_portable_node writes: a branch with a 4 byte parameter and a double threshold.
+        const size_t largest_node_size = 1 + 4 + sizeof(double);
+
+        const uint64_t fnv_offset_basis = 0xCBF29CE484222325;
+        const uint64_t fnv_prime = 0x100000001B3;
+
+        uint64_t update_hash(uint64_t hash, const uint8_t *data, size_t length) {
+            for (size_t i = 0; i < length; ++i) {
+                hash = (hash ^ data[i]) * fnv_prime;
+            }
+            return hash;
+        }
+
+        void write_value(uint8_t *&location, uint64_t value, size_t width) {
+            for (size_t i = 0; i < width; ++i) {
+                *location++ = (uint8_t) (value >> (8 * i));
+            }
+        }
+
+        uint64_t read_value(const uint8_t *location, size_t width) {
+            uint64_t value = 0;
+            for (size_t i = 0; i < width; ++i) {
+                value |= (uint64_t) location[i] << (8 * i);
+            }
+            return value;
+        }
+
+        /// How a tree's nodes are written: serialize_portable_tree's node encoding, little endian with double
+        /// thresholds, so the same tree gives the same bytes on every processor.
+        struct NodeEncoding {
+            uint8_t parameter_width;
+            uint8_t label_width;
+
+            NodeEncoding(size_t parameter_count, int label_count)
+                    : parameter_width(get_portable_parameter_width(parameter_count)),
+                      label_width(get_portable_label_width(label_count)) {}
+
+            size_t leaf_size() const { return 1 + label_width; }
+
+            size_t branch_size() const { return 1 + parameter_width + sizeof(double); }
+        };
+
+        /// Call visit with every node of a tree written in the node encoding, children before their parents, in the
+        /// same order serialize_portable_tree writes them.
+        template<typename Visit>
+        void visit_encoded(const DecisionTreeNode &tree, const NodeEncoding &encoding, Visit visit) {
+            struct PendingNode {
+                const DecisionTreeNode *node;
+                bool children_visited;
+            };
+            std::vector<PendingNode> stack;
+            stack.push_back({&tree, false});
+            uint8_t record[largest_node_size];
+            while (!stack.empty()) {
+                PendingNode pending = stack.back();
+                stack.pop_back();
+                if (!pending.node->is_leaf() && !pending.children_visited) {
+                    stack.push_back({pending.node, true});
+                    stack.push_back({pending.node->get_greater_branch(), false});
+                    stack.push_back({pending.node->get_lesser_branch(), false});
+                    continue;
+                }
+                size_t length = write_portable_node(*pending.node, encoding.parameter_width, encoding.label_width,
+                                                    false, record);
+                visit(record, length);
+            }
+        }
+
+        /// The size, node count and hash of a tree's nodes in the node encoding.
+        struct EncodedTree {
+            uint64_t size;
+            uint64_t hash;
+            uint32_t node_count;
+        };
+
+        EncodedTree encode_tree(const DecisionTreeNode &tree, const NodeEncoding &encoding) {
+            EncodedTree encoded = {0, fnv_offset_basis, 0};
+            visit_encoded(tree, encoding, [&encoded](const uint8_t *record, size_t length) {
+                encoded.size += length;
+                encoded.hash = update_hash(encoded.hash, record, length);
+                ++encoded.node_count;
+            });
+            return encoded;
+        }
+
+        struct DeltaHeader {
+            uint32_t parameter_count;
+            uint32_t label_count;
+            EncodedTree source;
+            EncodedTree target;
+            uint32_t replacement_count;
+        };
+
+        bool read_header(const uint8_t *delta, size_t delta_length, DeltaHeader &header) {
+            if (delta_length < header_size || memcmp(delta, PICO_DT_DELTA_MAGIC, 4) != 0 ||
+                delta[4] != PICO_DT_DELTA_VERSION) {
+                return false;
+            }
+            header.parameter_count = (uint32_t) read_value(delta + 5, 4);
+            header.label_count = (uint32_t) read_value(delta + 9, 4);
+            header.source.size = read_value(delta + 13, 8);
+            header.source.hash = read_value(delta + 21, 8);
+            header.source.node_count = (uint32_t) read_value(delta + 29, 4);
+            header.target.size = read_value(delta + 33, 8);
+            header.target.hash = read_value(delta + 41, 8);
+            header.target.node_count = (uint32_t) read_value(delta + 49, 4);
+            header.replacement_count = (uint32_t) read_value(delta + 53, 4);
+            return header.label_count <= INT32_MAX;
+        }
+
+        /// Check that data is one whole tree in the node encoding, with every parameter and label in range, so
+        /// deserializing it can't fail but for memory. Only the stack's height is kept.
+        bool is_encoded_tree(const uint8_t *buffer, size_t buffer_length, const DeltaHeader &header) {
+            NodeEncoding encoding(header.parameter_count, (int) header.label_count);
+            size_t stack_size = 0;
+            size_t buffer_pointer = 0;
+            while (buffer_pointer < buffer_length) {
+                size_t node_size;
+                if (buffer[buffer_pointer] == PICO_DT_LEAF_FLAG) {
+                    node_size = encoding.leaf_size();
+                    if (node_size > buffer_length - buffer_pointer ||
+                        read_value(buffer + buffer_pointer + 1, encoding.label_width) >= header.label_count) {
+                        return false;
+                    }
+                    ++stack_size;
+                } else if (buffer[buffer_pointer] == PICO_DT_BRANCH_FLAG && stack_size >= 2) {
+                    node_size = encoding.branch_size();
+                    if (node_size > buffer_length - buffer_pointer ||
+                        read_value(buffer + buffer_pointer + 1, encoding.parameter_width) >= header.parameter_count) {
+                        return false;
+                    }
+                    --stack_size;
+                } else {
+                    return false;
+                }
+                buffer_pointer += node_size;
+            }
+            return buffer_pointer == buffer_length && stack_size == 1;
+        }
+
+        /// One subtree a delta replaces.
+        struct Replacement {
+            /// The branches to take from the root, one bit each, the root's first: the highest bit of the first byte.
+            /// 0 is the lesser branch and 1 the greater.
+            const uint8_t *path;
+            size_t path_length;
+            /// Where the replaced subtree's nodes are among the source's encoded nodes.
+            size_t source_offset;
+            size_t source_length;
+            /// The new subtree's nodes, encoded.
+            const uint8_t *subtree;
+            size_t subtree_length;
+        };
+
+        /// Read every replacement in a delta, checking that each one fits in the delta and in the source, comes after
+        /// the one before it in the source's nodes, and brings a whole encoded subtree, and that nothing follows the
+        /// last one. Stops as soon as visit returns false.
+        template<typename Visit>
+        bool visit_replacements(const uint8_t *delta, size_t delta_length, const DeltaHeader &header, Visit visit) {
+            size_t location = header_size;
+            size_t source_end = 0;
+            for (uint32_t i = 0; i < header.replacement_count; ++i) {
+                if (delta_length - location < replacement_size) return false;
+                Replacement replacement{};
+                replacement.path_length = (size_t) read_value(delta + location, 4);
+                size_t path_bytes = (replacement.path_length + 7) / 8;
+                location += 4;
+                if (delta_length - location < path_bytes + replacement_size - 4) return false;
+                replacement.path = delta + location;
+                location += path_bytes;
+                uint64_t source_offset = read_value(delta + location, 8);
+                uint64_t source_length = read_value(delta + location + 8, 8);
+                uint64_t subtree_length = read_value(delta + location + 16, 8);
+                location += 24;
+                if (source_offset < source_end || source_length == 0 || source_length > header.source.size ||
+                    source_offset > header.source.size - source_length || subtree_length > delta_length - location) {
+                    return false;
+                }
+                replacement.source_offset = (size_t) source_offset;
+                replacement.source_length = (size_t) source_length;
+                replacement.subtree = delta + location;
+                replacement.subtree_length = (size_t) subtree_length;
+                if (!is_encoded_tree(replacement.subtree, replacement.subtree_length, header)) return false;
+                location += replacement.subtree_length;
+                source_end = replacement.source_offset + replacement.source_length;
+                if (!visit(replacement)) return false;
+            }
+            return location == delta_length;
+        }
+
+        /// Copies the source's nodes with a delta's replacements spliced in, handing each run of bytes to output.
+        template<typename Output>
+        bool splice_delta(const uint8_t *source, size_t source_length, const uint8_t *delta, size_t delta_length,
+                          const DeltaHeader &header, Output output) {
+            size_t copied = 0;
+            bool spliced = visit_replacements(delta, delta_length, header, [&](const Replacement &replacement) {
+                if (!output(source + copied, replacement.source_offset - copied)) return false;
+                copied = replacement.source_offset + replacement.source_length;
+                return output(replacement.subtree, replacement.subtree_length);
+            });
+            return spliced && output(source + copied, source_length - copied);
+        }
+    }
+
+    /// Compares trees node by node, and swaps subtrees into and out of them.
+    class TreePatcher {
+    public:
+        template<typename Visit>
+        static void diff(const DecisionTreeNode &source, const DecisionTreeNode &target, Visit visit);
+
+        static bool apply(DecisionTreeNode &tree, const uint8_t *delta, size_t delta_length);
+
+    private:
+        static bool same_node(const DecisionTreeNode *source, const DecisionTreeNode *target);
+
+        static void swap_contents(DecisionTreeNode *node, DecisionTreeNode *replacement);
+    };
+
+    bool TreePatcher::same_node(const DecisionTreeNode *source, const DecisionTreeNode *target) {
+        if (source->is_leaf() || target->is_leaf()) {
+            return source->is_leaf() && target->is_leaf() && source->default_value == target->default_value;
+        }
+        // thresholds are compared as the bits that get encoded, so 0 and -0 differ, and NaN is the same as itself.
+        return source->comparison_parameter == target->comparison_parameter &&
+               memcmp(&source->comparison_threshold, &target->comparison_threshold, sizeof(double)) == 0;
+    }
+
+    /// Walk both trees from the root together, calling visit with each subtree where they first differ, in the order
+    /// the source's nodes are encoded in, along with the path to it and where its nodes are among the source's.
+    template<typename Visit>
+    void TreePatcher::diff(const DecisionTreeNode &source, const DecisionTreeNode &target, Visit visit) {
+        struct Pending {
+            const DecisionTreeNode *source;
+            const DecisionTreeNode *target;
+            size_t depth;
+            bool greater;
+            bool children_visited;
+        };
+        NodeEncoding encoding(source.parameter_count, source.label_count);
+        std::vector<Pending> stack;
+        std::vector<uint8_t> path;
+        size_t source_offset = 0;
+        stack.push_back({&source, &target, 0, false, false});
+        while (!stack.empty()) {
+            Pending pending = stack.back();
+            stack.pop_back();
+            if (pending.children_visited) {
+                source_offset += encoding.branch_size();
+                continue;
+            }
+            // nodes are visited after everything above them and before everything after them, so the path's bits
+            // for the levels above are still the ones that led here.
+            if (pending.depth > 0) {
+                size_t level = pending.depth - 1;
+                if (level / 8 == path.size()) path.push_back(0);
+                uint8_t bit = 0x80 >> (level % 8);
+                path[level / 8] = pending.greater ? path[level / 8] | bit : path[level / 8] & ~bit;
+            }
+            if (!same_node(pending.source, pending.target)) {
+                auto source_length = (size_t) encode_tree(*pending.source, encoding).size;
+                visit(path.data(), pending.depth, source_offset, source_length, *pending.target);
+                source_offset += source_length;
+                continue;
+            }
+            if (pending.source->is_leaf()) {
+                source_offset += encoding.leaf_size();
+                continue;
+            }
+            stack.push_back({pending.source, pending.target, pending.depth, pending.greater, true});
+            stack.push_back({pending.source->greater_branch, pending.target->greater_branch, pending.depth + 1, true,
+                             false});
+            stack.push_back({pending.source->lesser_branch, pending.target->lesser_branch, pending.depth + 1, false,
+                             false});
+        }
+    }
+
+    void TreePatcher::swap_contents(DecisionTreeNode *node, DecisionTreeNode *replacement) {
+        std::swap(node->default_value, replacement->default_value);
+        std::swap(node->comparison_parameter, replacement->comparison_parameter);
+        std::swap(node->comparison_threshold, replacement->comparison_threshold);
+        std::swap(node->lesser_branch, replacement->lesser_branch);
+        std::swap(node->greater_branch, replacement->greater_branch);
+        for (DecisionTreeNode *swapped: {node, replacement}) {
+            if (swapped->is_leaf()) continue;
+            swapped->lesser_branch->parent_branch = swapped;
+            swapped->greater_branch->parent_branch = swapped;
+        }
+        node->forget_serialized_size();
+        replacement->serialized_size.store(0, std::memory_order_relaxed);
+    }
+
+    bool TreePatcher::apply(DecisionTreeNode &tree, const uint8_t *delta, size_t delta_length) {
+        DeltaHeader header{};
+        if (!read_header(delta, delta_length, header) || tree.parameter_count != header.parameter_count ||
+            tree.label_count != (int) header.label_count) {
+            return false;
+        }
+        NodeEncoding encoding(tree.parameter_count, tree.label_count);
+        EncodedTree source = encode_tree(tree, encoding);
+        if (source.size != header.source.size || source.hash != header.source.hash ||
+            source.node_count != header.source.node_count) {
+            return false;
+        }
+        if (!visit_replacements(delta, delta_length, header, [](const Replacement &) { return true; })) return false;
+
+        // each replaced node swaps contents with its replacement's root, which keeps the old subtree until the
+        // result checks out, and takes it back if it doesn't.
+        std::vector<std::pair<DecisionTreeNode *, DecisionTreeNode *>> swapped;
+        bool applied = visit_replacements(delta, delta_length, header, [&](const Replacement &replacement) {
+            DecisionTreeNode *node = &tree;
+            for (size_t level = 0; level < replacement.path_length; ++level) {
+                if (node->is_leaf()) return false;
+                bool greater = (replacement.path[level / 8] & (0x80 >> (level % 8))) != 0;
+                node = greater ? node->greater_branch : node->lesser_branch;
+            }
+            DecisionTreeNode *subtree = deserialize_portable_nodes(replacement.subtree, replacement.subtree_length,
+                                                                   tree.parameter_count, tree.label_count,
+                                                                   tree.arena);
+            if (subtree == nullptr) return false;
+            swap_contents(node, subtree);
+            swapped.emplace_back(node, subtree);
+            return true;
+        });
+        if (applied) {
+            EncodedTree target = encode_tree(tree, encoding);
+            applied = target.size == header.target.size && target.hash == header.target.hash &&
+                      target.node_count == header.target.node_count;
+        }
+
+        if (!applied) {
+            for (size_t i = swapped.size(); i-- > 0;) {
+                swap_contents(swapped[i].first, swapped[i].second);
+            }
+        }
+        // arena nodes are only ever freed all at once, along with the arena.
+        for (auto &pair: swapped) {
+            if (pair.second->arena == nullptr) delete pair.second;
+        }
+        return applied;
+    }
+
+    uint64_t calculate_tree_hash(const DecisionTreeNode &tree) {
+        return encode_tree(tree, NodeEncoding(tree.get_parameter_count(), tree.get_label_count())).hash;
+    }
+
+    uint64_t calculate_portable_tree_hash(const uint8_t *buffer, size_t buffer_length) {
+        if (!is_portable_tree(buffer, buffer_length) ||
+            buffer_length < PICO_DT_PORTABLE_HEADER_SIZE + PICO_DT_PORTABLE_CRC_SIZE) {
+            return 0;
+        }
+        // the header, with the counts it gives, has to be exactly the one serialize_portable_tree would write for
+        // double thresholds.
+        uint8_t expected[PICO_DT_PORTABLE_HEADER_SIZE];
+        write_portable_header(expected, (size_t) read_value(buffer + 8, 4), (int) (uint32_t) read_value(buffer + 12, 4),
+                              (size_t) read_value(buffer + 16, 4), false);
+        if (memcmp(buffer, expected, sizeof(expected)) != 0) return 0;
+        return update_hash(fnv_offset_basis, buffer + PICO_DT_PORTABLE_HEADER_SIZE,
+                           buffer_length - PICO_DT_PORTABLE_HEADER_SIZE - PICO_DT_PORTABLE_CRC_SIZE);
+    }
+
+    size_t calculate_tree_delta_size(const DecisionTreeNode &source, const DecisionTreeNode &target) {
+        if (source.get_parameter_count() != target.get_parameter_count() ||
+            source.get_label_count() != target.get_label_count()) {
+            return 0;
+        }
+        NodeEncoding encoding(target.get_parameter_count(), target.get_label_count());
+        size_t size = header_size;
+        TreePatcher::diff(source, target, [&size, &encoding](const uint8_t *, size_t path_length, size_t, size_t,
+                                                             const DecisionTreeNode &subtree) {
+            size += replacement_size + (path_length + 7) / 8 + encode_tree(subtree, encoding).size;
+        });
+        return size;
+    }
+
+    uint8_t *create_tree_delta(const DecisionTreeNode &source, const DecisionTreeNode &target) {
+        size_t size = calculate_tree_delta_size(source, target);
+        if (size == 0) return nullptr;
+        NodeEncoding encoding(target.get_parameter_count(), target.get_label_count());
+        auto *delta = new uint8_t[size];
+        uint8_t *location = delta;
+        memcpy(location, PICO_DT_DELTA_MAGIC, 4);
+        location += 4;
+        *location++ = PICO_DT_DELTA_VERSION;
+        write_value(location, target.get_parameter_count(), 4);
+        write_value(location, (uint32_t) target.get_label_count(), 4);
+        for (const DecisionTreeNode *tree: {&source, &target}) {
+            EncodedTree encoded = encode_tree(*tree, encoding);
+            write_value(location, encoded.size, 8);
+            write_value(location, encoded.hash, 8);
+            write_value(location, encoded.node_count, 4);
+        }
+        uint8_t *replacement_count = location;
+        location += 4;
+
+        uint32_t count = 0;
+        TreePatcher::diff(source, target, [&](const uint8_t *path, size_t path_length, size_t source_offset,
+                                              size_t source_length, const DecisionTreeNode &subtree) {
+            write_value(location, path_length, 4);
+            size_t path_bytes = (path_length + 7) / 8;
+            if (path_bytes > 0) memcpy(location, path, path_bytes);
+            // the bits past the end of the path are whatever a deeper path left there.
+            if (path_length % 8 != 0) location[path_bytes - 1] &= (uint8_t) (0xFF00 >> (path_length % 8));
+            location += path_bytes;
+            write_value(location, source_offset, 8);
+            write_value(location, source_length, 8);
+            uint8_t *subtree_length = location;
+            location += 8;
+            size_t length = 0;
+            visit_encoded(subtree, encoding, [&location, &length](const uint8_t *record, size_t record_length) {
+                memcpy(location, record, record_length);
+                location += record_length;
+                length += record_length;
+            });
+            write_value(subtree_length, length, 8);
+            ++count;
+        });
+        write_value(replacement_count, count, 4);
+        return delta;
+    }
+
+    size_t get_tree_delta_target_size(const uint8_t *delta, size_t delta_length) {
+        DeltaHeader header{};
+        if (!read_header(delta, delta_length, header)) return 0;
+        return PICO_DT_PORTABLE_HEADER_SIZE + (size_t) header.target.size + PICO_DT_PORTABLE_CRC_SIZE;
+    }
+
+    bool apply_tree_delta(DecisionTreeNode &tree, const uint8_t *delta, size_t delta_length) {
+        return TreePatcher::apply(tree, delta, delta_length);
+    }
+
+    bool apply_tree_delta_portable(const uint8_t *source, size_t source_length, const uint8_t *delta,
+                                   size_t delta_length, uint8_t *buffer, size_t capacity,
+                                   SerializedChunkWriter writer, void *context) {
+        DeltaHeader header{};
+        if (capacity == 0 || !read_header(delta, delta_length, header) || header.source.size > source_length ||
+            source_length != PICO_DT_PORTABLE_HEADER_SIZE + header.source.size + PICO_DT_PORTABLE_CRC_SIZE) {
+            return false;
+        }
+        uint8_t source_header[PICO_DT_PORTABLE_HEADER_SIZE];
+        write_portable_header(source_header, header.parameter_count, (int) header.label_count,
+                              header.source.node_count, false);
+        if (memcmp(source, source_header, sizeof(source_header)) != 0 ||
+            calculate_portable_tree_hash(source, source_length) != header.source.hash) {
+            return false;
+        }
+        const uint8_t *source_nodes = source + PICO_DT_PORTABLE_HEADER_SIZE;
+        auto source_nodes_length = (size_t) header.source.size;
+
+        // splice once just to hash the result and count its nodes, so nothing is written unless it is the target.
+        NodeEncoding encoding(header.parameter_count, (int) header.label_count);
+        EncodedTree spliced_tree = {0, fnv_offset_basis, 0};
+        size_t node_remaining = 0;
+        bool spliced = splice_delta(source_nodes, source_nodes_length, delta, delta_length, header,
+                                    [&](const uint8_t *data, size_t length) {
+                                        spliced_tree.hash = update_hash(spliced_tree.hash, data, length);
+                                        spliced_tree.size += length;
+                                        for (size_t position = 0; position < length;) {
+                                            if (node_remaining == 0) {
+                                                node_remaining = data[position] == PICO_DT_LEAF_FLAG
+                                                                 ? encoding.leaf_size() : encoding.branch_size();
+                                                ++spliced_tree.node_count;
+                                            }
+                                            size_t part = length - position < node_remaining ? length - position
+                                                                                             : node_remaining;
+                                            position += part;
+                                            node_remaining -= part;
+                                        }
+                                        return true;
+                                    });
+        if (!spliced || spliced_tree.size != header.target.size || spliced_tree.hash != header.target.hash ||
+            spliced_tree.node_count != header.target.node_count) {
+            return false;
+        }
+
+        // then again into the chunks, every one of them full but the last, as serialize_chunked writes them, between
+        // the target's header and the CRC of everything before it.
+        size_t used = 0;
+        uint32_t crc = 0;
+        auto output = [&](const uint8_t *data, size_t length) {
+            crc = update_portable_crc(crc, data, length);
+            for (size_t copied = 0; copied < length;) {
+                size_t part = length - copied < capacity - used ? length - copied : capacity - used;
+                memcpy(buffer + used, data + copied, part);
+                used += part;
+                copied += part;
+                if (used == capacity) {
+                    if (!writer(buffer, used, context)) return false;
+                    used = 0;
+                }
+            }
+            return true;
+        };
+        uint8_t target_header[PICO_DT_PORTABLE_HEADER_SIZE];
+        write_portable_header(target_header, header.parameter_count, (int) header.label_count,
+                              header.target.node_count, false);
+        if (!output(target_header, sizeof(target_header)) ||
+            !splice_delta(source_nodes, source_nodes_length, delta, delta_length, header, output)) {
+            return false;
+        }
+        uint8_t crc_bytes[PICO_DT_PORTABLE_CRC_SIZE];
+        uint8_t *crc_location = crc_bytes;
+        write_value(crc_location, crc, sizeof(crc_bytes));
+        return output(crc_bytes, sizeof(crc_bytes)) && (used == 0 || writer(buffer, used, context));
+    }
+} // pico_dt
@@ -0,0 +1,96 @@
+#ifndef PICO_DT_TREEDELTA_H
+#define PICO_DT_TREEDELTA_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include "DecisionTreeNode.h"
+
+// the first bytes of tree delta data.
+#define PICO_DT_DELTA_MAGIC "PDTD"
+#define PICO_DT_DELTA_VERSION 2
+
+namespace pico_dt {
+
+    /// Hash a decision tree, as the 64 bit FNV-1a hash of its nodes as serialize_portable_tree writes them with double
+    /// thresholds, without allocating anything. The encoding is little endian with fixed widths, so a tree has the
+    /// same hash on every processor. Trees with the same hash predict the same (barring collisions, which are
+    /// astronomically unlikely for trees that weren't made to collide).
+    /// \param tree The root of the decision tree.
+    /// \return The hash.
+    uint64_t calculate_tree_hash(const DecisionTreeNode &tree);
+
+    /// Hash the data serialize_portable_tree gives with double thresholds, as calculate_tree_hash hashes the tree it
+    /// was serialized from.
+    /// \param buffer pointer to the portable tree data.
+    /// \param buffer_length length of the portable tree data.
+    /// \return The hash, or 0 if the data doesn't start with a header for double thresholds.
+    uint64_t calculate_portable_tree_hash(const uint8_t *buffer, size_t buffer_length);
+
+    /// Calculate how large the delta create_tree_delta makes between two trees will be.
+    /// \param source The root of the tree the delta will be applied to.
+    /// \param target The root of the tree the delta turns the source into.
+    /// \return The size of the delta, in bytes, or 0 if the trees' parameter or label counts differ.
+    size_t calculate_tree_delta_size(const DecisionTreeNode &source, const DecisionTreeNode &target);
+
+    /// Make a delta that turns one tree into another, so a retrained model can be sent to devices that have the old
+    /// one as only the subtrees that changed. Both trees are walked from the root together, and wherever their nodes
+    /// differ, the target's whole subtree there replaces the source's. Each replacement gives the path to its node
+    /// from the root, where the source's subtree sits among the source's nodes, and the target's subtree's nodes. Nodes
+    /// are always in serialize_portable_tree's encoding, little endian with double thresholds, so a delta made on a
+    /// server applies the same way on any device. The delta starts with the sizes, node counts and hashes (see
+    /// calculate_tree_hash) of both trees, so it is only ever applied to the tree it was made from, and the result is
+    /// checked against the target.
+    ///
+    /// Two trees that differ at the root make a delta a little larger than the target's portable data, so compare
+    /// calculate_tree_delta_size with calculate_portable_size to pick which to send.
+    /// \param source The root of the tree the delta will be applied to.
+    /// \param target The root of the tree the delta turns the source into.
+    /// \return A pointer to a buffer containing the delta, calculate_tree_delta_size bytes long, or nullptr if the
+    /// trees' parameter or label counts differ.
+    uint8_t *create_tree_delta(const DecisionTreeNode &source, const DecisionTreeNode &target);
+
+    /// Get how large the portable data of the tree a delta makes will be, to set aside room for
+    /// apply_tree_delta_portable.
+    /// \param delta pointer to the delta data.
+    /// \param delta_length length of the delta data.
+    /// \return The target's portable size with double thresholds, or 0 if the delta's header isn't valid.
+    size_t get_tree_delta_target_size(const uint8_t *delta, size_t delta_length);
+
+    /// Apply a delta from create_tree_delta to a tree in place, replacing the subtrees it gives. The tree's counts,
+    /// size and hash are checked against the delta's source first, and once every subtree is replaced, against its
+    /// target. If anything doesn't match, or the delta isn't valid, every replaced subtree is put back, so the tree is
+    /// either entirely the target or left exactly as it was. Only the replaced subtrees' nodes are ever held twice.
+    /// \param tree The root of the tree, which stays where it is. New nodes come from the same arena the root came
+    /// from, if it did, and replaced nodes are deleted unless they came from an arena.
+    /// \param delta pointer to the delta data.
+    /// \param delta_length length of the delta data.
+    /// \return Whether the tree is now the delta's target.
+    bool apply_tree_delta(DecisionTreeNode &tree, const uint8_t *delta, size_t delta_length);
+
+    /// Apply a delta from create_tree_delta to portable tree data, like a model in flash, writing the target's
+    /// portable data a chunk at a time, the way DecisionTreeNode::serialize_chunked does: the target's header, the
+    /// source's nodes with the delta's subtrees spliced in, and the CRC-32 of all of it. Nothing is ever copied out of
+    /// the source but a chunk at a time, so this needs no memory beyond the chunk buffer: devices keep the model in one
+    /// flash slot, write the patched model to another, and switch slots once this returns true.
+    ///
+    /// The source's header, size and hash are checked against the delta's source, and the nodes the delta would make
+    /// are hashed and checked against its target, all before anything is written.
+    /// \param source pointer to the data serialize_portable_tree gave for the tree the delta was made from, with double
+    /// thresholds. It can't overlap the chunks' destination.
+    /// \param source_length length of the source data.
+    /// \param delta pointer to the delta data.
+    /// \param delta_length length of the delta data.
+    /// \param buffer The buffer to collect each chunk in.
+    /// \param capacity The size of the buffer, in bytes.
+    /// \param writer Called with each chunk of the target's portable data, in order.
+    /// \param context Anything, passed along to the writer.
+    /// \return Whether every chunk of the target was written. False without writing anything if the source, the
+    /// delta or the result doesn't check out, or if the buffer has no capacity.
+    bool apply_tree_delta_portable(const uint8_t *source, size_t source_length, const uint8_t *delta,
+                                   size_t delta_length, uint8_t *buffer, size_t capacity,
+                                   SerializedChunkWriter writer, void *context);
+
+} // pico_dt
+
+#endif //PICO_DT_TREEDELTA_H
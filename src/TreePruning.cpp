@@ -0,0 +1,226 @@
+#include <limits>
+#include <vector>
+
+#include "DecisionTreeNode.h"
+#include "TreePruning.h"
+
+namespace pico_dt {
+    /// Changes trained trees in place. The root always stays where it is, so trees can be changed through a reference.
+    class TreeRewriter {
+    public:
+        static size_t compact(DecisionTreeNode &tree);
+
+        static size_t prune(DecisionTreeNode &tree, double **parameters, const int *labels, size_t count,
+                            double alpha);
+
+    private:
+        static size_t count_nodes(DecisionTreeNode &tree);
+
+        static void make_leaf(DecisionTreeNode *node, int value);
+
+        static void replace_with_branch(DecisionTreeNode *node, bool lesser);
+    };
+
+    size_t TreeRewriter::count_nodes(DecisionTreeNode &tree) {
+        // every tree is counted once it has been changed, so this is also where remembered serialized sizes go.
+        tree.forget_serialized_size();
+        size_t node_count = 0;
+        std::vector<DecisionTreeNode *> stack;
+        stack.push_back(&tree);
+        while (!stack.empty()) {
+            DecisionTreeNode *node = stack.back();
+            stack.pop_back();
+            node->serialized_size.store(0, std::memory_order_relaxed);
+            ++node_count;
+            if (node->is_leaf()) continue;
+            stack.push_back(node->greater_branch);
+            stack.push_back(node->lesser_branch);
+        }
+        return node_count;
+    }
+
+    void TreeRewriter::make_leaf(DecisionTreeNode *node, int value) {
+        // arena nodes are only ever freed all at once, along with the arena.
+        if (node->lesser_branch->arena == nullptr) delete node->lesser_branch;
+        if (node->greater_branch->arena == nullptr) delete node->greater_branch;
+        node->lesser_branch = nullptr;
+        node->greater_branch = nullptr;
+        node->default_value = value;
+        node->comparison_parameter = -1;
+        node->comparison_threshold = -1.0;
+    }
+
+    void TreeRewriter::replace_with_branch(DecisionTreeNode *node, bool lesser) {
+        DecisionTreeNode *kept = lesser ? node->lesser_branch : node->greater_branch;
+        DecisionTreeNode *dropped = lesser ? node->greater_branch : node->lesser_branch;
+        node->default_value = kept->default_value;
+        node->comparison_parameter = kept->comparison_parameter;
+        node->comparison_threshold = kept->comparison_threshold;
+        node->lesser_branch = kept->lesser_branch;
+        node->greater_branch = kept->greater_branch;
+        if (!node->is_leaf()) {
+            node->lesser_branch->parent_branch = node;
+            node->greater_branch->parent_branch = node;
+        }
+        kept->lesser_branch = nullptr;
+        kept->greater_branch = nullptr;
+        if (kept->arena == nullptr) delete kept;
+        if (dropped->arena == nullptr) delete dropped;
+    }
+
+    size_t TreeRewriter::compact(DecisionTreeNode &tree) {
+        size_t node_count = count_nodes(tree);
+        size_t parameter_count = tree.parameter_count;
+
+        // the values that can reach the node being visited, from lowest (inclusive) to highest (exclusive). branches
+        // set a bound on the way down into a subtree, and put it back once the subtree is done.
+        auto *lowest = new double[parameter_count];
+        auto *highest = new double[parameter_count];
+        for (size_t i = 0; i < parameter_count; ++i) {
+            lowest[i] = -std::numeric_limits<double>::infinity();
+            highest[i] = std::numeric_limits<double>::infinity();
+        }
+        struct PendingNode {
+            // nullptr to put a bound back.
+            DecisionTreeNode *node;
+            size_t parameter;
+            double bound;
+            bool upper;
+        };
+        std::vector<PendingNode> stack;
+        std::vector<DecisionTreeNode *> visited;
+        stack.push_back({&tree, (size_t) -1, 0, false});
+        while (!stack.empty()) {
+            PendingNode pending = stack.back();
+            stack.pop_back();
+            if (pending.node == nullptr) {
+                (pending.upper ? highest : lowest)[pending.parameter] = pending.bound;
+                continue;
+            }
+            if (pending.parameter < parameter_count) {
+                double &bound = (pending.upper ? highest : lowest)[pending.parameter];
+                stack.push_back({nullptr, pending.parameter, bound, pending.upper});
+                if (pending.upper ? pending.bound < bound : pending.bound > bound) bound = pending.bound;
+            }
+
+            // a branch that always goes the same way is replaced by that branch, which can then be checked in turn.
+            // NaNs never compare lesser, so they can't reach a lesser branch below a real upper bound either.
+            DecisionTreeNode *node = pending.node;
+            while (!node->is_leaf()) {
+                size_t parameter = node->comparison_parameter;
+                double threshold = node->comparison_threshold;
+                if (threshold <= lowest[parameter]) {
+                    replace_with_branch(node, false);
+                } else if (highest[parameter] != std::numeric_limits<double>::infinity() &&
+                           threshold >= highest[parameter]) {
+                    replace_with_branch(node, true);
+                } else {
+                    break;
+                }
+            }
+            if (node->is_leaf()) continue;
+            visited.push_back(node);
+            stack.push_back({node->greater_branch, node->comparison_parameter, node->comparison_threshold, false});
+            stack.push_back({node->lesser_branch, node->comparison_parameter, node->comparison_threshold, true});
+        }
+        delete[] lowest;
+        delete[] highest;
+
+        // every branch comes after the branches above it, so going backwards collapses subtrees from the bottom up.
+        for (size_t i = visited.size(); i-- > 0;) {
+            DecisionTreeNode *node = visited[i];
+            if (node->lesser_branch->is_leaf() && node->greater_branch->is_leaf() &&
+                node->lesser_branch->default_value == node->greater_branch->default_value) {
+                make_leaf(node, node->lesser_branch->default_value);
+            }
+        }
+        return node_count - count_nodes(tree);
+    }
+
+    size_t TreeRewriter::prune(DecisionTreeNode &tree, double **parameters, const int *labels, size_t count,
+                               double alpha) {
+        if (count == 0) return 0;
+        size_t node_count = count_nodes(tree);
+        int label_count = tree.label_count;
+
+        // number the nodes depth first, so every node comes after the node above it, and route every sample down the
+        // tree, counting the labels reaching each node.
+        struct PruningNode {
+            DecisionTreeNode *node;
+            size_t parent;
+            size_t lesser;
+            size_t greater;
+        };
+        std::vector<PruningNode> nodes;
+        struct PendingNode {
+            DecisionTreeNode *node;
+            size_t parent;
+            bool lesser;
+        };
+        std::vector<PendingNode> stack;
+        stack.push_back({&tree, 0, false});
+        while (!stack.empty()) {
+            PendingNode pending = stack.back();
+            stack.pop_back();
+            size_t index = nodes.size();
+            nodes.push_back({pending.node, pending.parent, 0, 0});
+            if (index > 0) (pending.lesser ? nodes[pending.parent].lesser : nodes[pending.parent].greater) = index;
+            if (pending.node->is_leaf()) continue;
+            stack.push_back({pending.node->greater_branch, index, false});
+            stack.push_back({pending.node->lesser_branch, index, true});
+        }
+        std::vector<size_t> label_counts(nodes.size() * label_count);
+        for (size_t i = 0; i < count; ++i) {
+            size_t index = 0;
+            while (true) {
+                ++label_counts[index * label_count + labels[i]];
+                const DecisionTreeNode *node = nodes[index].node;
+                if (node->is_leaf()) break;
+                index = parameters[i][node->comparison_parameter] < node->comparison_threshold ? nodes[index].lesser
+                                                                                                : nodes[index].greater;
+            }
+        }
+
+        // the label each node would predict as a leaf, and how many samples reach it.
+        std::vector<int> majorities(nodes.size());
+        std::vector<size_t> totals(nodes.size());
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            const size_t *node_label_counts = label_counts.data() + i * label_count;
+            int majority = 0;
+            for (int j = 0; j < label_count; ++j) {
+                totals[i] += node_label_counts[j];
+                if (node_label_counts[j] > node_label_counts[majority]) majority = j;
+            }
+            majorities[i] = totals[i] == 0 ? majorities[nodes[i].parent] : majority;
+        }
+
+        // costs are counted in samples, so with an alpha of 0 they are exact.
+        double leaf_cost = alpha * (double) count;
+        std::vector<double> costs(nodes.size());
+        for (size_t i = nodes.size(); i-- > 0;) {
+            DecisionTreeNode *node = nodes[i].node;
+            const size_t *node_label_counts = label_counts.data() + i * label_count;
+            if (node->is_leaf()) {
+                costs[i] = (double) (totals[i] - node_label_counts[node->default_value]) + leaf_cost;
+                continue;
+            }
+            double subtree_cost = costs[nodes[i].lesser] + costs[nodes[i].greater];
+            double pruned_cost = (double) (totals[i] - node_label_counts[majorities[i]]) + leaf_cost;
+            if (pruned_cost <= subtree_cost) {
+                make_leaf(node, majorities[i]);
+                costs[i] = pruned_cost;
+            } else {
+                costs[i] = subtree_cost;
+            }
+        }
+        return node_count - count_nodes(tree);
+    }
+
+    size_t compact_tree(DecisionTreeNode &tree) {
+        return TreeRewriter::compact(tree);
+    }
+
+    size_t prune_tree(DecisionTreeNode &tree, double **parameters, const int *labels, size_t count, double alpha) {
+        return TreeRewriter::prune(tree, parameters, labels, count, alpha);
+    }
+} // pico_dt
@@ -0,0 +1,41 @@
+#ifndef PICO_DT_TREEPRUNING_H
+#define PICO_DT_TREEPRUNING_H
+
+#include <cstddef>
+
+namespace pico_dt {
+
+    class DecisionTreeNode;
+
+    /// Shrink a trained tree without changing a single prediction. Branches whose threshold can never go one way,
+    /// because a branch above already compared the same parameter against a tighter threshold, are replaced by the
+    /// branch they always take. Then every subtree whose leaves all predict the same value is collapsed into one leaf.
+    /// \param tree The root of the tree, which is changed in place. Nodes that go are deleted, unless they came from
+    /// an arena.
+    /// \return How many nodes were removed.
+    size_t compact_tree(DecisionTreeNode &tree);
+
+    /// Prune a trained tree against a set of samples, replacing subtrees with leaves wherever that doesn't cost more
+    /// than it saves. Each subtree's cost is the fraction of the samples it gets wrong, plus alpha for each of its
+    /// leaves, and it is replaced by a leaf predicting the most common label of the samples that reach it whenever
+    /// the leaf costs no more. Subtrees are pruned from the bottom up, in one pass.
+    ///
+    /// With an alpha of 0 and samples held out from fitting, this is reduced error pruning: every subtree that doesn't
+    /// do better on the held out samples than a leaf would goes. With a larger alpha, this is cost complexity pruning
+    /// (see https://en.wikipedia.org/wiki/Decision_tree_pruning), which gives the smallest tree minimizing the cost
+    /// for that alpha, and works with the samples the tree was fit to as well.
+    ///
+    /// Subtrees no sample reaches are replaced by a leaf predicting the most common label of the nearest node above
+    /// them that samples do reach.
+    /// \param tree The root of the tree, which is changed in place. Nodes that go are deleted, unless they came from
+    /// an arena.
+    /// \param parameters An array of pointers pointing to arrays of parameters.
+    /// \param labels An array of labels, with one label for each parameter array given.
+    /// \param count The number of samples given. Nothing is pruned without any.
+    /// \param alpha What each leaf costs, as a fraction of the samples.
+    /// \return How many nodes were removed.
+    size_t prune_tree(DecisionTreeNode &tree, double **parameters, const int *labels, size_t count, double alpha = 0);
+
+} // pico_dt
+
+#endif //PICO_DT_TREEPRUNING_H
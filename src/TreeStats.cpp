@@ -0,0 +1,50 @@
+#include <vector>
+
+#include "DecisionTreeNode.h"
+#include "TreeStats.h"
+
+namespace pico_dt {
+    TreeStats calculate_tree_stats(const DecisionTreeNode &tree, double **parameters, size_t count) {
+        TreeStats stats = {0, 0, 0, 0, 0, 0};
+        size_t depth_total = 0;
+
+        // depth first, like serialize, without recursing.
+        struct PendingNode {
+            const DecisionTreeNode *node;
+            size_t depth;
+        };
+        std::vector<PendingNode> stack;
+        stack.push_back({&tree, 0});
+        while (!stack.empty()) {
+            PendingNode pending = stack.back();
+            stack.pop_back();
+            ++stats.node_count;
+            if (pending.node->is_leaf()) {
+                ++stats.leaf_count;
+                depth_total += pending.depth;
+                if (pending.depth > stats.max_depth) stats.max_depth = pending.depth;
+                continue;
+            }
+            stack.push_back({pending.node->get_greater_branch(), pending.depth + 1});
+            stack.push_back({pending.node->get_lesser_branch(), pending.depth + 1});
+        }
+        stats.average_depth = (double) depth_total / (double) stats.leaf_count;
+        stats.serialized_size = tree.calculate_serialized_size();
+
+        if (parameters == nullptr || count == 0) {
+            stats.average_path_length = stats.average_depth;
+            return stats;
+        }
+        size_t path_total = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const DecisionTreeNode *node = &tree;
+            while (!node->is_leaf()) {
+                node = parameters[i][node->get_comparison_parameter()] < node->get_comparison_threshold()
+                       ? node->get_lesser_branch() : node->get_greater_branch();
+                ++path_total;
+            }
+        }
+        stats.average_path_length = (double) path_total / (double) count;
+        return stats;
+    }
+} // pico_dt
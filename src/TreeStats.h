@@ -0,0 +1,68 @@
+#ifndef PICO_DT_TREESTATS_H
+#define PICO_DT_TREESTATS_H
+
+#include <cstddef>
+
+// record where fit spends its time, and report it to a callback (see DecisionTreeNode::set_fit_stats_callback). Without
+// this, none of the recording is compiled in.
+//#define PICO_DT_ENABLE_FIT_STATS
+
+#ifdef PICO_DT_ENABLE_FIT_STATS
+#define PICO_DT_FIT_STATS(...) __VA_ARGS__
+#else
+#define PICO_DT_FIT_STATS(...)
+#endif
+
+namespace pico_dt {
+
+    class DecisionTreeNode;
+
+    /// What fitting every node at one depth of a tree took.
+    struct FitLevelStats {
+        /// How far below the node fit was called on these nodes are. That node is depth 0.
+        size_t depth;
+        /// How many nodes were fit at this depth, branches and leaves both.
+        size_t nodes_created;
+        /// How many thresholds (or bin edges, for fit_binned) were scored.
+        size_t candidates_evaluated;
+        /// How many times a sample was read, sweeping for splits, partitioning or building histograms.
+        size_t samples_scanned;
+        /// How many bytes were allocated, for the nodes' children and any scratch space. Depth 0 includes the scratch
+        /// space fit sets up before fitting any node.
+        size_t bytes_allocated;
+        /// The wall time spent fitting these nodes, in seconds. With several threads, the time each thread spent is
+        /// added up, so this can add up to more than the fit took.
+        double seconds;
+    };
+
+    /// Called by fit once it finishes, for each depth of the tree in order, when PICO_DT_ENABLE_FIT_STATS is defined.
+    /// \param stats What fitting the nodes at one depth took.
+    /// \param context Whatever was passed to DecisionTreeNode::set_fit_stats_callback along with the callback.
+    typedef void (*FitStatsCallback)(const FitLevelStats &stats, void *context);
+
+    /// The shape of a trained tree.
+    struct TreeStats {
+        size_t node_count;
+        size_t leaf_count;
+        /// The depth of the deepest leaf. A tree that is just a leaf has a depth of 0.
+        size_t max_depth;
+        /// The average depth of the leaves.
+        double average_depth;
+        /// What DecisionTreeNode::calculate_serialized_size gives.
+        size_t serialized_size;
+        /// The average number of branches a sample passes through before reaching its leaf. Without samples, this is
+        /// the average depth.
+        double average_path_length;
+    };
+
+    /// Measure a trained tree.
+    /// \param tree The root of the tree.
+    /// \param parameters An array of pointers pointing to arrays of parameters, to weight the average path length by,
+    /// or nullptr.
+    /// \param count The number of samples given.
+    /// \return The tree's stats.
+    TreeStats calculate_tree_stats(const DecisionTreeNode &tree, double **parameters = nullptr, size_t count = 0);
+
+} // pico_dt
+
+#endif //PICO_DT_TREESTATS_H
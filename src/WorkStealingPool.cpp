@@ -0,0 +1,171 @@
+#include "WorkStealingPool.h"
+
+#ifdef PICO_DT_ENABLE_THREADS
+
+namespace pico_dt {
+    namespace {
+        thread_local const WorkStealingPool *current_pool = nullptr;
+        thread_local unsigned int current_index = 0;
+    }
+
+    WorkStealingPool::WorkStealingPool(unsigned int p_thread_count) {
+        thread_count = p_thread_count < 1 ? 1 : p_thread_count;
+        queues = new TaskQueue[thread_count];
+        queued_count = 0;
+        pending_count = 0;
+        stopping = false;
+        threads = new std::thread[thread_count - 1];
+        for (unsigned int i = 1; i < thread_count; ++i) {
+            threads[i - 1] = std::thread(&WorkStealingPool::run_worker, this, i);
+        }
+    }
+
+    void WorkStealingPool::submit(std::function<void()> task) {
+        ++pending_count;
+        TaskQueue &queue = queues[current_worker()];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back(std::move(task));
+        }
+        {
+            // taking the sleep lock here means a worker can't miss this between checking for work and going to sleep.
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ++queued_count;
+        }
+        sleep_condition.notify_one();
+    }
+
+    void WorkStealingPool::wait() {
+        const WorkStealingPool *previous_pool = current_pool;
+        unsigned int previous_index = current_index;
+        current_pool = this;
+        current_index = 0;
+
+        std::function<void()> task;
+        while (true) {
+            if (take_task(0, task)) {
+                run_task(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            if (pending_count == 0) break;
+            sleep_condition.wait(lock, [this] { return queued_count > 0 || pending_count == 0; });
+        }
+
+        current_pool = previous_pool;
+        current_index = previous_index;
+    }
+
+    void WorkStealingPool::parallel_for(size_t count, const std::function<void(size_t)> &body) {
+        if (count == 0) return;
+        if (count == 1 || thread_count == 1) {
+            for (size_t i = 0; i < count; ++i) {
+                body(i);
+            }
+            return;
+        }
+
+        // helpers can start after this returns, so everything they touch is shared, not on this stack.
+        struct Loop {
+            std::function<void(size_t)> body;
+            size_t count;
+            std::atomic<size_t> next_index;
+            std::atomic<size_t> done_count;
+        };
+        auto loop = std::make_shared<Loop>();
+        loop->body = body;
+        loop->count = count;
+        loop->next_index = 0;
+        loop->done_count = 0;
+        auto run_loop = [](Loop &shared_loop) {
+            size_t index;
+            while ((index = shared_loop.next_index++) < shared_loop.count) {
+                shared_loop.body(index);
+                ++shared_loop.done_count;
+            }
+        };
+
+        size_t helper_count = count - 1 < thread_count - 1 ? count - 1 : thread_count - 1;
+        for (size_t i = 0; i < helper_count; ++i) {
+            submit([loop, run_loop] { run_loop(*loop); });
+        }
+        run_loop(*loop);
+        while (loop->done_count < count) {
+            std::this_thread::yield();
+        }
+    }
+
+    unsigned int WorkStealingPool::current_worker() const {
+        return current_pool == this ? current_index : 0;
+    }
+
+    unsigned int WorkStealingPool::get_thread_count() const {
+        return thread_count;
+    }
+
+    bool WorkStealingPool::take_task(unsigned int worker, std::function<void()> &task) {
+        // newest task from our own queue first.
+        {
+            TaskQueue &queue = queues[worker];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+                --queued_count;
+                return true;
+            }
+        }
+        // then the oldest task from anyone else's.
+        for (unsigned int i = 1; i < thread_count; ++i) {
+            TaskQueue &queue = queues[(worker + i) % thread_count];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (!queue.tasks.empty()) {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+                --queued_count;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void WorkStealingPool::run_task(std::function<void()> &task) {
+        task();
+        task = nullptr;
+        if (--pending_count == 0) {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            sleep_condition.notify_all();
+        }
+    }
+
+    void WorkStealingPool::run_worker(unsigned int worker) {
+        current_pool = this;
+        current_index = worker;
+
+        std::function<void()> task;
+        while (true) {
+            if (take_task(worker, task)) {
+                run_task(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleep_condition.wait(lock, [this] { return queued_count > 0 || stopping; });
+            if (stopping) return;
+        }
+    }
+
+    WorkStealingPool::~WorkStealingPool() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        sleep_condition.notify_all();
+        for (unsigned int i = 0; i < thread_count - 1; ++i) {
+            threads[i].join();
+        }
+        delete[] threads;
+        delete[] queues;
+    }
+} // pico_dt
+
+#endif
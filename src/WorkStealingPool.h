@@ -0,0 +1,92 @@
+#ifndef PICO_DT_WORKSTEALINGPOOL_H
+#define PICO_DT_WORKSTEALINGPOOL_H
+
+#include <cstddef>
+
+namespace pico_dt {
+    class WorkStealingPool;
+}
+
+#ifdef PICO_DT_ENABLE_THREADS
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace pico_dt {
+
+    /// A fixed set of worker threads, each with its own task queue. A worker runs the newest task from its own queue
+    /// first, so it keeps working on whatever it split off last, and steals the oldest task from another worker's queue
+    /// when its own runs dry. The oldest tasks are the biggest ones when work is split recursively.
+    class WorkStealingPool {
+    public:
+        /// Create a new Work Stealing Pool. The thread calling wait() counts as one of the threads.
+        /// \param p_thread_count How many threads should run tasks, including the one calling wait().
+        explicit WorkStealingPool(unsigned int p_thread_count);
+
+        /// Queue a task. Tasks queued from a worker go to that worker's own queue.
+        /// \param task The task to run.
+        void submit(std::function<void()> task);
+
+        /// Run tasks on the calling thread until every queued task, including ones queued by other tasks, is done.
+        void wait();
+
+        /// Run body once for every index from 0 to count - 1, spread across the pool, and return once all are done.
+        /// Safe to call from inside a task. The calling thread only ever runs this body while it waits, never some
+        /// other queued task, so anything it has half finished stays untouched.
+        /// \param count How many times to run body.
+        /// \param body What to run for each index.
+        void parallel_for(size_t count, const std::function<void(size_t)> &body);
+
+        /// Get the index of the worker running the calling thread. The thread calling wait() is worker 0.
+        /// \return The worker index, from 0 to get_thread_count() - 1. Threads outside the pool get 0.
+        unsigned int current_worker() const;
+
+        /// Get how many threads run tasks, including the one calling wait().
+        /// \return The number of threads.
+        unsigned int get_thread_count() const;
+
+        WorkStealingPool(const WorkStealingPool &) = delete;
+
+        WorkStealingPool &operator=(const WorkStealingPool &) = delete;
+
+        ~ WorkStealingPool();
+
+    private:
+        struct TaskQueue {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        unsigned int thread_count;
+
+        TaskQueue *queues;
+
+        std::thread *threads;
+
+        std::atomic<size_t> queued_count;
+
+        std::atomic<size_t> pending_count;
+
+        bool stopping;
+
+        std::mutex sleep_mutex;
+
+        std::condition_variable sleep_condition;
+
+        bool take_task(unsigned int worker, std::function<void()> &task);
+
+        void run_task(std::function<void()> &task);
+
+        void run_worker(unsigned int worker);
+    };
+
+} // pico_dt
+
+#endif
+
+#endif //PICO_DT_WORKSTEALINGPOOL_H
@@ -1,5 +1,24 @@
+#include <cstring>
 #include <iostream>
+#ifdef PICO_DT_ENABLE_THREADS
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+#include "BasicDecisionTree.h"
+#include "CrossValidation.h"
 #include "DecisionTreeNode.h"
+#include "FlatTree.h"
+#include "HoeffdingTree.h"
+#include "ObliviousTree.h"
+#include "ModelHandle.h"
+#include "PortableFormat.h"
+#include "PredictionCache.h"
+#include "QuantizedTree.h"
+#include "TreeStats.h"
+#include "TreeCodegen.h"
+#include "TreeDelta.h"
+#include "TreePruning.h"
 
 int main() {
     double* sample_parameters[] = {
@@ -83,5 +102,390 @@ int main() {
     printf("dt(%lf, %lf, %lf)=%i\n", 0.0, 0.0, 2.9, dt_copy->predict(new double[]{0, 0, 2.9}));
     printf("dt(%lf, %lf, %lf)=%i\n", 0.0, 0.0, 3.1, dt_copy->predict(new double[]{0, 0, 3.1}));
 
+    printf("\n===============================\n  Testing portable serialization.\n===============================\n\n");
+
+    uint8_t *portable_buffer = pico_dt::serialize_portable_tree(dt_root, true);
+    size_t portable_size = pico_dt::calculate_portable_size(dt_root, true);
+    auto* dt_portable = pico_dt::deserialize_decision_tree(3, 12, portable_buffer, portable_size);
+    printf("Portable size: %zu bytes (serialized size: %zu bytes)\n", portable_size, dt_root.calculate_serialized_size());
+    for (auto & sample_parameter : sample_parameters){
+        printf("dt(%lf, %lf, %lf)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], dt_portable->predict(sample_parameter));
+    }
+
+    printf("\n===============================\n  Testing streaming serialization.\n===============================\n\n");
+
+    uint8_t into_buffer[512];
+    size_t into_size = dt_root.serialize_into(into_buffer, sizeof(into_buffer));
+    printf("Serialized into a buffer: %zu bytes, matches: %s\n", into_size,
+           into_size == dt_root.calculate_serialized_size() && memcmp(into_buffer, copied_buffer, into_size) == 0 ? "yes" : "no");
+
+    // a page sized buffer, with each page checked against the serialized tree as it comes.
+    struct StreamCheck {
+        const uint8_t *expected;
+        size_t offset;
+        size_t chunks;
+        bool matches;
+    } stream_check = {copied_buffer, 0, 0, true};
+    uint8_t page[16];
+    bool streamed = dt_root.serialize_chunked(page, sizeof(page), [](const uint8_t *chunk, size_t length, void *context) {
+        auto *check = static_cast<StreamCheck *>(context);
+        check->matches &= memcmp(chunk, check->expected + check->offset, length) == 0;
+        check->offset += length;
+        ++check->chunks;
+        return true;
+    }, &stream_check);
+    printf("Streamed %zu bytes in %zu chunks: %s, matches: %s\n", stream_check.offset, stream_check.chunks,
+           streamed ? "done" : "failed", stream_check.matches && stream_check.offset == into_size ? "yes" : "no");
+
+    printf("\n===============================\n  Testing flat trees.\n===============================\n\n");
+
+    auto flat_tree = pico_dt::FlatTree(dt_root);
+    auto* flat_copy = pico_dt::deserialize_flat_tree(3, 12, copied_buffer, dt_root.calculate_serialized_size());
+    printf("Flat tree has %zu nodes.\n", flat_tree.get_node_count());
+    for (auto & sample_parameter : sample_parameters){
+        printf("flat(%lf, %lf, %lf)=%i, flat_copy(%lf, %lf, %lf)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], flat_tree.predict(sample_parameter), sample_parameter[0], sample_parameter[1], sample_parameter[2], flat_copy->predict(sample_parameter));
+    }
+
+    // every demo sample, three times over, so the vector paths get whole groups and the scalar path a tail.
+    double batch_rows[72 * 3];
+    double batch_columns[3 * 72];
+    for (int i = 0; i < 72; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            batch_rows[i * 3 + j] = sample_parameters[i % 24][j];
+            batch_columns[j * 72 + i] = sample_parameters[i % 24][j];
+        }
+    }
+    int batch_predictions[72];
+    int column_predictions[72];
+    flat_tree.predict_batch(batch_rows, 72, 3, batch_predictions);
+    flat_tree.predict_batch_columns(batch_columns, 72, 72, column_predictions);
+    int batch_mismatches = 0;
+    for (int i = 0; i < 72; ++i) {
+        int expected = dt_root.predict(sample_parameters[i % 24]);
+        batch_mismatches += (batch_predictions[i] != expected) + (column_predictions[i] != expected);
+    }
+    printf("Batch predictions differing from predict: %i of %i\n", batch_mismatches, 2 * 72);
+
+    printf("\n===============================\n  Testing profiled layout.\n===============================\n\n");
+
+    // traffic that mostly comes from the last sample.
+    double profile_rows[32 * 3];
+    for (int i = 0; i < 32; ++i) {
+        memcpy(profile_rows + i * 3, sample_parameters[i < 24 ? i : 23], 3 * sizeof(double));
+    }
+    size_t visit_counts[64] = {};
+    flat_tree.profile(profile_rows, 32, 3, visit_counts);
+    auto profiled_tree = pico_dt::FlatTree(flat_tree, visit_counts);
+    int profiled_changes = 0;
+    for (auto & sample_parameter : sample_parameters){
+        profiled_changes += profiled_tree.predict(sample_parameter) != flat_tree.predict(sample_parameter);
+    }
+    printf("Changed predictions: %i\n", profiled_changes);
+    for (const pico_dt::FlatTreeView *view : {(const pico_dt::FlatTreeView *) &flat_tree, (const pico_dt::FlatTreeView *) &profiled_tree}) {
+        const pico_dt::FlatNode *nodes = view->get_nodes();
+        int32_t index = 0;
+        printf("hot path:");
+        while (true) {
+            printf(" %i", index);
+            if (nodes[index].child < 0) break;
+            index = nodes[index].child + !(sample_parameters[23][nodes[index].parameter] < nodes[index].threshold);
+        }
+        printf("\n");
+    }
+
+    printf("\n===============================\n  Testing prediction caching.\n===============================\n\n");
+
+    // the same readings, over and over.
+    pico_dt::PredictionCache prediction_cache(flat_tree, 64);
+    int cache_changes = 0;
+    for (int pass = 0; pass < 4; ++pass) {
+        for (auto & sample_parameter : sample_parameters){
+            cache_changes += prediction_cache.predict(sample_parameter) != flat_tree.predict(sample_parameter);
+        }
+    }
+    printf("Hits: %zu, misses: %zu, changed predictions: %i\n", prediction_cache.get_hit_count(),
+           prediction_cache.get_miss_count(), cache_changes);
+
+    printf("\n===============================\n  Testing arena trees.\n===============================\n\n");
+
+    static uint8_t arena_region[16384];
+    pico_dt::TreeArena arena(arena_region, sizeof(arena_region));
+    auto* dt_arena = pico_dt::deserialize_decision_tree(3, 12, copied_buffer, dt_root.calculate_serialized_size(), &arena);
+    printf("Deserialized into %zu of %zu arena bytes.\n", arena.get_used_size(), arena.get_capacity());
+    for (auto & sample_parameter : sample_parameters){
+        printf("dt(%lf, %lf, %lf)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], dt_arena->predict(sample_parameter));
+    }
+    arena.reset();
+
+    printf("\n===============================\n  Testing mapped trees.\n===============================\n\n");
+
+    uint8_t *mapped_buffer = flat_tree.serialize_mapped();
+    pico_dt::FlatTreeView mapped_tree;
+    bool mapped = pico_dt::map_flat_tree(mapped_buffer, flat_tree.calculate_mapped_size(), mapped_tree);
+    printf("Mapped %zu bytes: %s, well formed: %s\n", flat_tree.calculate_mapped_size(), mapped ? "yes" : "no",
+           mapped_tree.is_well_formed() ? "yes" : "no");
+    for (auto & sample_parameter : sample_parameters){
+        printf("mapped(%lf, %lf, %lf)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], mapped_tree.predict(sample_parameter));
+    }
+
+    printf("\n===============================\n  Testing threaded fitting.\n===============================\n\n");
+
+    auto dt_threaded = pico_dt::DecisionTreeNode(3, 12);
+    dt_threaded.fit(sample_parameters, sample_labels, 24, -1, 4);
+    uint8_t* threaded_buffer = dt_threaded.serialize();
+    bool threaded_matches = dt_threaded.calculate_serialized_size() == dt_root.calculate_serialized_size() &&
+                            memcmp(threaded_buffer, copied_buffer, dt_root.calculate_serialized_size()) == 0;
+    printf("Same tree as single threaded fit: %s\n", threaded_matches ? "yes" : "no");
+
+    printf("\n===============================\n  Testing columnar fitting.\n===============================\n\n");
+
+    auto sample_dataset = pico_dt::Dataset(sample_parameters, sample_labels, 24, 3);
+    auto dt_columnar = pico_dt::DecisionTreeNode(3, 12);
+    dt_columnar.fit(sample_dataset);
+    uint8_t* columnar_buffer = dt_columnar.serialize();
+    bool columnar_matches = dt_columnar.calculate_serialized_size() == dt_root.calculate_serialized_size() &&
+                            memcmp(columnar_buffer, copied_buffer, dt_root.calculate_serialized_size()) == 0;
+    printf("Same tree as row fit: %s\n", columnar_matches ? "yes" : "no");
+
+    printf("\n===============================\n  Testing duplicate merging.\n===============================\n\n");
+
+    // a log that reads every sample 50 times in a row, like a slow sensor would.
+    double* logged_parameters[24 * 50];
+    int logged_labels[24 * 50];
+    for (size_t i = 0; i < 24 * 50; ++i) {
+        logged_parameters[i] = sample_parameters[i / 50];
+        logged_labels[i] = sample_labels[i / 50];
+    }
+    auto logged_dataset = pico_dt::Dataset(logged_parameters, logged_labels, 24 * 50, 3);
+    pico_dt::Dataset *merged_dataset = pico_dt::merge_duplicate_samples(logged_dataset);
+    auto dt_logged = pico_dt::DecisionTreeNode(3, 12);
+    dt_logged.fit(logged_dataset);
+    auto dt_merged = pico_dt::DecisionTreeNode(3, 12);
+    dt_merged.fit(*merged_dataset);
+    uint8_t* logged_buffer = dt_logged.serialize();
+    uint8_t* merged_buffer = dt_merged.serialize();
+    bool merged_matches = dt_merged.calculate_serialized_size() == dt_logged.calculate_serialized_size() &&
+                          memcmp(merged_buffer, logged_buffer, dt_logged.calculate_serialized_size()) == 0;
+    printf("Logged samples: %zu, merged samples: %zu\n", logged_dataset.get_count(), merged_dataset->get_count());
+    printf("Same tree as unmerged fit: %s\n", merged_matches ? "yes" : "no");
+    delete[] logged_buffer;
+    delete[] merged_buffer;
+    delete merged_dataset;
+
+    printf("\n===============================\n  Testing oblivious trees.\n===============================\n\n");
+
+    auto oblivious_tree = pico_dt::ObliviousTree(3, 12);
+    oblivious_tree.fit(sample_dataset, 4);
+    uint8_t* oblivious_buffer = oblivious_tree.serialize();
+    pico_dt::ObliviousTree *oblivious_copy = pico_dt::deserialize_oblivious_tree(oblivious_buffer,
+                                                                                oblivious_tree.calculate_serialized_size());
+    int oblivious_correct = 0;
+    int oblivious_copy_changes = 0;
+    for (size_t i = 0; i < 24; ++i) {
+        oblivious_correct += oblivious_tree.predict(sample_parameters[i]) == sample_labels[i];
+        oblivious_copy_changes += oblivious_copy == nullptr ||
+                                  oblivious_copy->predict(sample_parameters[i]) != oblivious_tree.predict(sample_parameters[i]);
+    }
+    for (size_t i = 0; i < oblivious_tree.get_depth(); ++i) {
+        printf("level %zu: parameter %zu < %lf\n", i, oblivious_tree.get_comparison_parameter(i),
+               oblivious_tree.get_comparison_threshold(i));
+    }
+    printf("Correct: %i of 24, serialized into %zu bytes, changed by deserializing: %i\n", oblivious_correct,
+           oblivious_tree.calculate_serialized_size(), oblivious_copy_changes);
+    delete oblivious_copy;
+    delete[] oblivious_buffer;
+
+    printf("\n===============================\n  Testing cross validation.\n===============================\n\n");
+
+    int cv_limits[4] = {1, 2, 4, -1};
+    pico_dt::LimitScore cv_scores[4];
+    size_t best_limit = pico_dt::cross_validate_limits(sample_dataset, 12, 2, cv_limits, 4, cv_scores, 2);
+    for (auto & cv_score : cv_scores){
+        printf("limit %i: accuracy %lf, average nodes %lf\n", cv_score.limit, cv_score.accuracy, cv_score.average_node_count);
+    }
+    printf("Best limit: %i\n", cv_limits[best_limit]);
+
+    printf("\n===============================\n  Testing binned fitting.\n===============================\n\n");
+
+    // the third parameter takes 6 different values, so 8 bins keep every one of them apart and every sample is
+    // classified right. with fewer bins, neighbouring values would share a bin, and their samples a label.
+    auto dt_binned = pico_dt::DecisionTreeNode(3, 12);
+    dt_binned.fit_binned(sample_parameters, sample_labels, 24, 8);
+
+    for (auto & sample_parameter : sample_parameters){
+        printf("dt(%lf, %lf, %lf)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], dt_binned.predict(sample_parameter));
+    }
+
+    printf("\n===============================\n  Testing typed trees.\n===============================\n\n");
+
+    float float_parameters[24][3];
+    const float* float_parameter_rows[24];
+    uint8_t float_labels[24];
+    for (int i = 0; i < 24; i++) {
+        for (int j = 0; j < 3; j++) float_parameters[i][j] = (float) sample_parameters[i][j];
+        float_parameter_rows[i] = float_parameters[i];
+        float_labels[i] = (uint8_t) sample_labels[i];
+    }
+    pico_dt::FloatDecisionTree<3, 12> dt_float;
+    dt_float.fit(float_parameter_rows, float_labels, 24);
+    printf("Typed tree has %zu nodes of %zu bytes.\n", dt_float.get_node_count(), sizeof(pico_dt::FloatDecisionTree<3, 12>::Node));
+    for (auto & float_parameter : float_parameters){
+        printf("dt(%f, %f, %f)=%i\n", float_parameter[0], float_parameter[1], float_parameter[2], dt_float.predict(float_parameter));
+    }
+
+    printf("\n===============================\n  Testing quantized trees.\n===============================\n\n");
+
+    // readings are in hundredths.
+    pico_dt::FeatureCalibration calibrations[3] = {{0.01, 0}, {0.01, 0}, {0.01, 0}};
+    auto* dt_quantized = pico_dt::quantize_tree<int16_t>(dt_root, calibrations);
+    uint8_t *quantized_buffer = dt_quantized->serialize();
+    auto* quantized_copy = pico_dt::deserialize_quantized_tree<int16_t>(quantized_buffer, dt_quantized->calculate_serialized_size());
+    printf("Quantized size: %zu bytes, changed samples: %zu\n", dt_quantized->calculate_serialized_size(),
+           pico_dt::find_quantization_changes(dt_root, *dt_quantized, calibrations, sample_parameters, 24, nullptr));
+    for (auto & sample_parameter : sample_parameters){
+        int16_t readings[3];
+        pico_dt::quantize_readings(calibrations, 3, sample_parameter, readings);
+        printf("quantized(%i, %i, %i)=%i\n", readings[0], readings[1], readings[2], quantized_copy->predict(readings));
+    }
+
+    printf("\n===============================\n  Testing tree stats.\n===============================\n\n");
+
+    pico_dt::TreeStats tree_stats = pico_dt::calculate_tree_stats(dt_root, sample_parameters, 24);
+    printf("Nodes: %zu, leaves: %zu, max depth: %zu, average depth: %lf, serialized size: %zu, average path length: %lf\n",
+           tree_stats.node_count, tree_stats.leaf_count, tree_stats.max_depth, tree_stats.average_depth,
+           tree_stats.serialized_size, tree_stats.average_path_length);
+#ifdef PICO_DT_ENABLE_FIT_STATS
+    auto dt_stats = pico_dt::DecisionTreeNode(3, 12);
+    dt_stats.set_fit_stats_callback([](const pico_dt::FitLevelStats &stats, void *) {
+        printf("depth %zu: %zu nodes, %zu candidates, %zu samples scanned, %zu bytes, %lf s\n", stats.depth,
+               stats.nodes_created, stats.candidates_evaluated, stats.samples_scanned, stats.bytes_allocated,
+               stats.seconds);
+    }, nullptr);
+    dt_stats.fit(sample_parameters, sample_labels, 24);
+#endif
+
+    printf("\n===============================\n  Testing incremental learning.\n===============================\n\n");
+
+    // stream the samples over and over, as a sensor would, without keeping any.
+    pico_dt::HoeffdingTree dt_stream(3, 12, 16, 1e-3, 24, 0.25);
+    for (int pass = 0; pass < 200; ++pass) {
+        for (int i = 0; i < 24; ++i) {
+            dt_stream.learn(sample_parameters[i], sample_labels[i]);
+        }
+    }
+    printf("Samples: %zu, leaves: %zu\n", dt_stream.get_sample_count(), dt_stream.get_leaf_count());
+    for (auto & sample_parameter : sample_parameters){
+        printf("stream(%f, %f, %f)=%i\n", sample_parameter[0], sample_parameter[1], sample_parameter[2], dt_stream.predict(sample_parameter));
+    }
+
+    printf("\n===============================\n  Testing delta updates.\n===============================\n\n");
+
+    // a retrain with one sample labelled differently, which only changes the subtree it ends up in.
+    int retrained_labels[24];
+    memcpy(retrained_labels, sample_labels, sizeof(retrained_labels));
+    retrained_labels[11] = 6;
+    auto dt_retrained = pico_dt::DecisionTreeNode(3, 12);
+    dt_retrained.fit(sample_parameters, retrained_labels, 24);
+    size_t delta_size = pico_dt::calculate_tree_delta_size(dt_root, dt_retrained);
+    uint8_t *delta = pico_dt::create_tree_delta(dt_root, dt_retrained);
+    printf("Delta: %zu bytes (retrained tree: %zu bytes)\n", delta_size, pico_dt::calculate_portable_size(dt_retrained));
+
+    auto *dt_device = pico_dt::deserialize_decision_tree(3, 12, copied_buffer, dt_root.calculate_serialized_size());
+    bool patched = pico_dt::apply_tree_delta(*dt_device, delta, delta_size);
+    size_t patched_matches = 0;
+    for (auto &sample_parameter : sample_parameters) {
+        patched_matches += dt_device->predict(sample_parameter) == dt_retrained.predict(sample_parameter);
+    }
+    printf("Patched tree: %s, matches retrained: %zu of 24, applied again: %s\n", patched ? "applied" : "rejected",
+           patched_matches, pico_dt::apply_tree_delta(*dt_device, delta, delta_size) ? "applied" : "rejected");
+
+    // the model in flash is portable data, and the patched model is written a page at a time to a second flash slot,
+    // read back and checked.
+    uint8_t *flashed_model = pico_dt::serialize_portable_tree(dt_root);
+    struct FlashSlot {
+        uint8_t data[512];
+        size_t used;
+    } flash_slot = {{}, 0};
+    uint8_t flash_page[16];
+    bool flashed = pico_dt::apply_tree_delta_portable(
+            flashed_model, pico_dt::calculate_portable_size(dt_root), delta, delta_size, flash_page, sizeof(flash_page),
+            [](const uint8_t *chunk, size_t length, void *context) {
+                auto *slot = static_cast<FlashSlot *>(context);
+                if (length > sizeof(slot->data) - slot->used) return false;
+                memcpy(slot->data + slot->used, chunk, length);
+                slot->used += length;
+                return true;
+            }, &flash_slot);
+    uint8_t *retrained_model = pico_dt::serialize_portable_tree(dt_retrained);
+    printf("Patched flash slot: %s, %zu bytes, hash matches: %s, same as retrained: %s\n",
+           flashed ? "written" : "rejected", flash_slot.used,
+           pico_dt::calculate_portable_tree_hash(flash_slot.data, flash_slot.used) ==
+           pico_dt::calculate_tree_hash(dt_retrained) ? "yes" : "no",
+           flash_slot.used == pico_dt::calculate_portable_size(dt_retrained) &&
+           memcmp(flash_slot.data, retrained_model, flash_slot.used) == 0 ? "yes" : "no");
+    delete[] flashed_model;
+    delete[] retrained_model;
+    delete dt_device;
+    delete[] delta;
+
+    printf("\n===============================\n  Testing pruning.\n===============================\n\n");
+
+    // every sample is labelled right and every label has its own leaf, so only a large cost per leaf prunes anything.
+    for (double alpha : {0.0, 0.1}) {
+        auto dt_pruned = pico_dt::DecisionTreeNode(3, 12);
+        dt_pruned.fit(sample_parameters, sample_labels, 24);
+        size_t compacted_nodes = pico_dt::compact_tree(dt_pruned);
+        size_t pruned_nodes = pico_dt::prune_tree(dt_pruned, sample_parameters, sample_labels, 24, alpha);
+        printf("alpha %lf: compaction removed %zu nodes, pruning removed %zu, leaving %zu\n", alpha, compacted_nodes,
+               pruned_nodes, pico_dt::calculate_tree_stats(dt_pruned).node_count);
+    }
+
+#ifdef PICO_DT_ENABLE_THREADS
+    printf("\n===============================\n  Testing hot swapping.\n===============================\n\n");
+
+    // every model version shifts all the labels by the same amount, so a snapshot whose predictions don't all agree on
+    // one shift saw a torn or freed model.
+    auto make_model = [&sample_parameters, &sample_labels](int version) {
+        int shifted_labels[24];
+        for (int i = 0; i < 24; ++i) {
+            shifted_labels[i] = (sample_labels[i] + version) % 12;
+        }
+        auto *model = new pico_dt::DecisionTreeNode(3, 12);
+        model->fit(sample_parameters, shifted_labels, 24);
+        return model;
+    };
+    pico_dt::TreeHandle tree_handle(make_model(0));
+    std::atomic<bool> publishing(true);
+    std::atomic<size_t> torn_snapshots(0);
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+        readers.emplace_back([&] {
+            do {
+                pico_dt::TreeHandle::Snapshot snapshot = tree_handle.read();
+                int shift = (snapshot->predict(sample_parameters[0]) - sample_labels[0] + 12) % 12;
+                for (int j = 1; j < 24; ++j) {
+                    if (snapshot->predict(sample_parameters[j]) != (sample_labels[j] + shift) % 12) {
+                        ++torn_snapshots;
+                        break;
+                    }
+                }
+            } while (publishing);
+        });
+    }
+    for (int version = 1; version <= 200; ++version) {
+        tree_handle.publish(make_model(version));
+    }
+    publishing = false;
+    for (auto &reader : readers) {
+        reader.join();
+    }
+    printf("Published 200 models to 4 readers, torn snapshots: %zu, final shift: %i\n", torn_snapshots.load(),
+           tree_handle.read()->predict(sample_parameters[0]) - sample_labels[0]);
+#endif
+
+    printf("\n===============================\n  Testing code generation.\n===============================\n\n");
+
+    printf("%s", pico_dt::generate_tree_header(dt_root, "sample_tree").c_str());
+
     return 0;
 }
@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "DecisionTreeNode.h"
+#include "TreeCodegen.h"
+
+// Reads a serialized tree and writes a C++ header that hard codes it. See pico_dt::generate_tree_header.
+int main(int argc, char **argv) {
+    if (argc != 6 && !(argc == 7 && strcmp(argv[6], "--types") == 0)) {
+        fprintf(stderr, "usage: %s <model> <parameter count> <label count> <name> <output header> [--types]\n",
+                argv[0]);
+        return 2;
+    }
+
+    FILE *model_file = fopen(argv[1], "rb");
+    if (model_file == nullptr) {
+        fprintf(stderr, "Could not open %s.\n", argv[1]);
+        return 1;
+    }
+    std::vector<uint8_t> model;
+    uint8_t block[4096];
+    size_t read_size;
+    while ((read_size = fread(block, 1, sizeof(block), model_file)) > 0) {
+        model.insert(model.end(), block, block + read_size);
+    }
+    fclose(model_file);
+
+    size_t parameter_count = strtoul(argv[2], nullptr, 10);
+    int label_count = (int) strtol(argv[3], nullptr, 10);
+    pico_dt::DecisionTreeNode *tree = pico_dt::deserialize_decision_tree(parameter_count, label_count,
+                                                                         model.data(), model.size());
+    if (tree == nullptr) {
+        fprintf(stderr, "%s is not a valid model.\n", argv[1]);
+        return 1;
+    }
+
+    pico_dt::CodegenStyle style = argc == 7 ? pico_dt::CodegenStyle::types : pico_dt::CodegenStyle::functions;
+    std::string header = pico_dt::generate_tree_header(*tree, argv[4], style);
+    delete tree;
+
+    FILE *header_file = fopen(argv[5], "wb");
+    if (header_file == nullptr) {
+        fprintf(stderr, "Could not open %s.\n", argv[5]);
+        return 1;
+    }
+    fwrite(header.data(), 1, header.size(), header_file);
+    fclose(header_file);
+    return 0;
+}